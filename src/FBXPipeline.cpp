@@ -92,6 +92,8 @@ void FBXPipeline::run() {
 
         DracoCompressionParams dracoTemplate;
         dracoTemplate.enable_compression = cfg.enableDraco;
+        dracoTemplate.encoding_speed = cfg.dracoEncodingSpeed;
+        dracoTemplate.decoding_speed = cfg.dracoDecodingSpeed;
 
         // Use build_lod_levels from lod_pipeline.h
         // Ratios are expected to be e.g. [1.0, 0.5, 0.25]
@@ -405,8 +407,8 @@ void FBXPipeline::buildOctree(OctreeNode* node) {
     node->children.erase(it, node->children.end());
 }
 
-struct TileStats { size_t node_count = 0; size_t vertex_count = 0; size_t triangle_count = 0; size_t material_count = 0; };
-void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef>& instances, const PipelineSettings& settings, json* batchTableJson, int* batchIdCounter, const SimplificationParams& simParams, osg::BoundingBoxd* outBox = nullptr, TileStats* stats = nullptr, const char* dbgTileName = nullptr, osg::Vec3d rtcOffset = osg::Vec3d(0,0,0)) {
+struct TileStats { size_t node_count = 0; size_t vertex_count = 0; size_t triangle_count = 0; size_t material_count = 0; double simplify_error = 0.0; };
+void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef>& instances, const PipelineSettings& settings, json* batchTableJson, int* batchIdCounter, const SimplificationParams& simParams, osg::BoundingBoxd* outBox = nullptr, TileStats* stats = nullptr, const char* dbgTileName = nullptr, osg::Vec3d rtcOffset = osg::Vec3d(0,0,0), double dracoPositionError = 0.0) {
     if (instances.empty()) return;
 
     // Ensure model has at least one buffer
@@ -453,7 +455,13 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
             osg::ref_ptr<osg::Geometry> processedGeom = inst.geom;
             if (simParams.enable_simplification) {
                 processedGeom = (osg::Geometry*)inst.geom->clone(osg::CopyOp::DEEP_COPY_ALL);
-                simplify_mesh_geometry(processedGeom.get(), simParams);
+                float simplifyError = 0.0f;
+                if (simplify_mesh_geometry(processedGeom.get(), simParams, &simplifyError) && stats) {
+                    // Measured in mesh units, the instance may scale it
+                    osg::Vec3d scale = inst.matrix.getScale();
+                    double worldError = simplifyError * std::max({scale.x(), scale.y(), scale.z()});
+                    stats->simplify_error = std::max(stats->simplify_error, worldError);
+                }
             }
 
             osg::Matrixd normalXform;
@@ -937,6 +945,31 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
             }
             continue;
         }
+        if (settings.enableOptimizeMesh) {
+            size_t vertexCount = positions.size() / 3;
+            // every per-vertex array present must follow the remap, absent ones stay empty
+            bool hasNormals = !normals.empty();
+            bool hasTexcoords = !texcoords.empty();
+            bool hasBatchIds = !batchIds.empty();
+            std::vector<MeshAttributeStream> streams = { { positions.data(), sizeof(float) * 3 } };
+            if (hasNormals) streams.push_back({ normals.data(), sizeof(float) * 3 });
+            if (hasTexcoords) streams.push_back({ texcoords.data(), sizeof(float) * 2 });
+            if (hasBatchIds) streams.push_back({ batchIds.data(), sizeof(float) });
+            if ((hasNormals && normals.size() != vertexCount * 3)
+                || (hasTexcoords && texcoords.size() != vertexCount * 2)
+                || (hasBatchIds && batchIds.size() != vertexCount)) {
+                LOG_W("mesh not optimized: vertex attributes of different lengths (v=%zu n=%zu uv=%zu batch=%zu)",
+                      vertexCount, normals.size() / 3, texcoords.size() / 2, batchIds.size());
+            } else {
+                size_t optimizedCount = optimize_mesh_buffers(indices, streams, vertexCount);
+                if (optimizedCount > 0) {
+                    positions.resize(optimizedCount * 3);
+                    if (hasNormals) normals.resize(optimizedCount * 3);
+                    if (hasTexcoords) texcoords.resize(optimizedCount * 2);
+                    if (hasBatchIds) batchIds.resize(optimizedCount);
+                }
+            }
+        }
         if (stats) {
             stats->vertex_count += positions.size() / 3;
             stats->triangle_count += indices.size() / 3;
@@ -972,6 +1005,10 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
 
             DracoCompressionParams dracoParams;
             dracoParams.enable_compression = true;
+            dracoParams.encoding_speed = settings.dracoEncodingSpeed;
+            dracoParams.decoding_speed = settings.dracoDecodingSpeed;
+            // bound chosen by processNode() from the tile's geometricError
+            dracoParams.position_max_error = dracoPositionError;
             std::vector<unsigned char> compressedData;
             size_t compressedSize = 0;
 
@@ -1779,32 +1816,9 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
 
     osg::BoundingBoxd tightBox;
     bool hasTightBox = false;
+    double simplifyError = 0.0;
 
-    // 2. Content
-    if (!node->content.empty()) {
-        // Naming convention: tile_{treePath}
-        std::string tileName = "tile_" + treePath;
-
-        // Create content
-        // For B3DM
-        SimplificationParams simParams;
-        simParams.enable_simplification = settings.enableSimplify;
-        simParams.target_ratio = 0.5f;
-        simParams.target_error = 0.0001f; // Base error
-        auto result = createB3DM(node->content, parentPath, tileName, simParams);
-        std::string contentUrl = result.first;
-        osg::BoundingBoxd cBox = result.second;
-
-        if (!contentUrl.empty()) {
-            nodeJson["content"] = {{"uri", contentUrl}};
-            if (cBox.valid()) {
-                tightBox.expandBy(cBox);
-                hasTightBox = true;
-            }
-        }
-    }
-
-    // 3. Children
+    // 2. Children, first so the Draco error bound of the content is known
     if (!node->children.empty()) {
         nodeJson["children"] = json::array();
         for (size_t i = 0; i < node->children.size(); ++i) {
@@ -1833,6 +1847,45 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
         }
     }
 
+    // A refined tile gets at least geScale times the inflated diagonal of
+    // its children's boxes as geometricError (see below), Draco may use a
+    // fraction of it; a leaf is never refined and gets an absolute bound
+    double dracoPositionError = 0.0;
+    if (settings.enableDraco && settings.dracoErrorFraction > 0.0) {
+        dracoPositionError = DRACO_LEAF_POSITION_ERROR;
+        if (hasTightBox) {
+            double hx = std::max((tightBox.xMax() - tightBox.xMin()) / 2.0 * 1.25, 1e-6);
+            double hy = std::max((tightBox.yMax() - tightBox.yMin()) / 2.0 * 1.25, 1e-6);
+            double hz = std::max((tightBox.zMax() - tightBox.zMin()) / 2.0 * 1.25, 1e-6);
+            double childrenGe = std::max(1e-3, settings.geScale * 2.0 * std::sqrt(hx*hx + hy*hy + hz*hz));
+            dracoPositionError = settings.dracoErrorFraction * childrenGe;
+        }
+    }
+
+    // 3. Content
+    if (!node->content.empty()) {
+        // Naming convention: tile_{treePath}
+        std::string tileName = "tile_" + treePath;
+
+        // Create content
+        // For B3DM
+        SimplificationParams simParams;
+        simParams.enable_simplification = settings.enableSimplify;
+        simParams.target_ratio = 0.5f;
+        simParams.target_error = 0.0001f; // Base error
+        auto result = createB3DM(node->content, parentPath, tileName, simParams, &simplifyError, dracoPositionError);
+        std::string contentUrl = result.first;
+        osg::BoundingBoxd cBox = result.second;
+
+        if (!contentUrl.empty()) {
+            nodeJson["content"] = {{"uri", contentUrl}};
+            if (cBox.valid()) {
+                tightBox.expandBy(cBox);
+                hasTightBox = true;
+            }
+        }
+    }
+
     // 1. Calculate Geometric Error and Bounding Volume
     double diagonal = 0.0;
     if (hasTightBox) {
@@ -1906,8 +1959,8 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
         };
     }
 
-    // Geometric error = scale * diagonal (no clamp). Ensure > 0 by epsilon if degenerate.
-    double geOut = std::max(1e-3, settings.geScale * diagonal);
+    // Geometric error = scale * diagonal (no clamp), plus the measured simplification error of the content. Ensure > 0 by epsilon if degenerate.
+    double geOut = std::max(1e-3, settings.geScale * diagonal + settings.errorScale * simplifyError);
     nodeJson["geometricError"] = geOut;
     std::string refineMode = "REPLACE";
     nodeJson["refine"] = refineMode;
@@ -1935,7 +1988,7 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
     return nodeJson;
 }
 
-std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams) {
+std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams, double* simplifyError, double dracoPositionError) {
     // 1. Calculate RTC Offset (Center of all instances in Target Z-Up Coordinates)
     osg::BoundingBoxd totalBox;
     size_t validBoxes = 0;
@@ -1967,8 +2020,11 @@ std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vec
 
     TileStats tileStats;
     osg::Vec3d rtcCenter = totalBox.valid() ? osg::Vec3d(totalBox.center()) : osg::Vec3d(0,0,0);
-    appendGeometryToModel(model, instances, settings, &batchTableJson, &batchIdCounter, simParams, &contentBox, &tileStats, tileName.c_str(), rtcCenter);
+    appendGeometryToModel(model, instances, settings, &batchTableJson, &batchIdCounter, simParams, &contentBox, &tileStats, tileName.c_str(), rtcCenter, dracoPositionError);
     LOG_I("Tile %s: nodes=%zu triangles=%zu vertices=%zu materials=%zu", tileName.c_str(), tileStats.node_count, tileStats.triangle_count, tileStats.vertex_count, tileStats.material_count);
+    if (simplifyError) {
+        *simplifyError = tileStats.simplify_error;
+    }
 
     // Shift contentBox back to World Z-up space so tileset.json gets correct bounding volume
     if (contentBox.valid()) {
@@ -2029,18 +2085,29 @@ std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vec
     std::string filename = tileName + ".b3dm";
     std::string fullPath = (fs::path(tilePath) / filename).string();
 
+    // Serialize GLB to memory
+    std::string glbData;
+    if (settings.enableQuantize) {
+        quantize_model(model);
+    }
+    if (settings.enableMeshoptCompression) {
+        if (!write_meshopt_glb(model, glbData)) {
+            LOG_E("Failed to write meshopt GLB for tile %s", tileName.c_str());
+            return {"", contentBox};
+        }
+    } else {
+        tinygltf::TinyGLTF gltf;
+        std::stringstream ss;
+        gltf.WriteGltfSceneToStream(&model, ss, false, true); // pretty=false, binary=true
+        glbData = ss.str();
+    }
+
     std::ofstream outfile(fullPath, std::ios::binary);
     if (!outfile) {
         LOG_E("Failed to create B3DM file: %s", fullPath.c_str());
         return {"", contentBox};
     }
 
-    // Serialize GLB to memory
-    tinygltf::TinyGLTF gltf;
-    std::stringstream ss;
-    gltf.WriteGltfSceneToStream(&model, ss, false, true); // pretty=false, binary=true
-    std::string glbData = ss.str();
-
     // Create Feature Table JSON
     json featureTable;
 
@@ -2286,7 +2353,9 @@ nlohmann::json FBXPipeline::buildAverageTiles(const osg::BoundingBox& globalBoun
         std::vector<InstanceRef> chunk(all.begin() + start, all.begin() + end);
         std::string tileName = "tile_" + std::to_string(t);
         SimplificationParams simParams;
-        auto b3dm = createB3DM(chunk, parentPath, tileName, simParams);
+        // the chunks are leaves
+        double dracoPositionError = settings.enableDraco && settings.dracoErrorFraction > 0.0 ? DRACO_LEAF_POSITION_ERROR : 0.0;
+        auto b3dm = createB3DM(chunk, parentPath, tileName, simParams, nullptr, dracoPositionError);
         if (b3dm.first.empty()) {
             LOG_I("AvgSplit tile=%s produced no content, skipped", tileName.c_str());
             continue;
@@ -2384,34 +2453,32 @@ nlohmann::json FBXPipeline::buildAverageTiles(const osg::BoundingBox& globalBoun
 
 // C-API Implementation
 extern "C" void* fbx23dtile(
-    const char* in_path,
-    const char* out_path,
+    const FbxConversionParams* params,
     double* box_ptr,
-    int* len,
-    int max_lvl,
-    bool enable_texture_compress,
-    bool enable_meshopt,
-    bool enable_draco,
-    bool enable_unlit,
-    double longitude,
-    double latitude,
-    double height
+    int* len
 ) {
-    std::string input(in_path);
-    std::string output(out_path);
+    std::string input(params->input_path);
+    std::string output(params->output_path);
 
     PipelineSettings settings;
     settings.inputPath = input;
     settings.outputPath = output;
-    settings.maxDepth = max_lvl > 0 ? max_lvl : 5;
-    settings.enableTextureCompress = enable_texture_compress;
-    settings.enableDraco = enable_draco;
-    settings.enableSimplify = enable_meshopt;
+    settings.maxDepth = params->max_lvl > 0 ? params->max_lvl : 5;
+    settings.enableTextureCompress = params->enable_texture_compress;
+    settings.enableDraco = params->enable_draco;
+    settings.enableSimplify = params->enable_meshopt;
     settings.enableLOD = false; // HLOD not yet implemented
-    settings.enableUnlit = enable_unlit;
-    settings.longitude = longitude;
-    settings.latitude = latitude;
-    settings.height = height;
+    settings.enableUnlit = params->enable_unlit;
+    settings.enableOptimizeMesh = params->enable_optimize_mesh;
+    settings.enableMeshoptCompression = params->enable_meshopt_compression;
+    settings.enableQuantize = params->enable_quantize;
+    settings.errorScale = params->geometric_error_scale;
+    settings.dracoErrorFraction = params->draco_error_fraction;
+    settings.dracoEncodingSpeed = params->draco_encoding_speed;
+    settings.dracoDecodingSpeed = params->draco_decoding_speed;
+    settings.longitude = params->longitude;
+    settings.latitude = params->latitude;
+    settings.height = params->height;
 
     FBXPipeline pipeline(settings);
     pipeline.run();
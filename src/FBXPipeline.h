@@ -15,6 +15,29 @@ namespace tinygltf {
     class Model;
 }
 
+// Parameters of fbx23dtile, mirrored by FbxConversionParams in fbx.rs
+struct FbxConversionParams {
+  const char *input_path;            // FBX file
+  const char *output_path;           // Output directory of the tileset
+  int max_lvl;                       // Depth of the tile tree (<= 0: 5)
+  int draco_encoding_speed;          // Draco speed options (0-10), see DracoCompressionParams
+  int draco_decoding_speed;
+  double geometric_error_scale;      // Multiplies the measured simplification error added to geometricError
+  double draco_error_fraction;       // See PipelineSettings::dracoErrorFraction
+  double longitude;                  // Origin (degree)
+  double latitude;
+  double height;
+
+  // Feature flags
+  bool enable_texture_compress;
+  bool enable_meshopt;
+  bool enable_draco;
+  bool enable_unlit;
+  bool enable_optimize_mesh;         // Reorder vertices and triangles for the GPU, see optimize_mesh_buffers
+  bool enable_meshopt_compression;   // EXT_meshopt_compression buffer views instead of Draco
+  bool enable_quantize;              // KHR_mesh_quantization vertex attributes, see quantize_model
+};
+
 struct PipelineSettings {
     std::string inputPath;
     std::string outputPath;
@@ -27,6 +50,11 @@ struct PipelineSettings {
     bool enableTextureCompress = false; // KTX2
     bool enableLOD = false; // Enable Hierarchical LOD generation
     bool enableUnlit = false; // Enable KHR_materials_unlit
+    bool enableOptimizeMesh = false; // Vertex cache/overdraw/fetch order, triangles unchanged
+    bool enableMeshoptCompression = false; // EXT_meshopt_compression buffer views instead of Draco
+    bool enableQuantize = false; // KHR_mesh_quantization vertex attributes
+    int dracoEncodingSpeed = 5; // Draco speed options, 0 (smallest) to 10 (fastest)
+    int dracoDecodingSpeed = 5;
     std::vector<float> lodRatios = {1.0f, 0.5f, 0.25f}; // Default LOD ratios (Fine to Coarse)
 
     // Geolocation (Origin)
@@ -36,6 +64,11 @@ struct PipelineSettings {
 
     // Geometric error scale (multiplier applied to boundingVolume diagonal)
     double geScale = 0.5; // Adjusted for better LOD switching with SSE=16
+    // Multiplier of the measured simplification error added to geometricError
+    double errorScale = 1.0;
+    // Draco position error of refined tiles as a fraction of their geometricError, leaves use
+    // DRACO_LEAF_POSITION_ERROR (0: fixed bits)
+    double dracoErrorFraction = 0.05;
 
     // Split strategy: when true, split by average count using maxItemsPerTile; when false, use octree
     bool splitAverageByCount = false;
@@ -95,7 +128,7 @@ private:
 
     // Converters
     // Returns filename created and the tight bounding box of the content (in ENU)
-    std::pair<std::string, osg::BoundingBoxd> createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams());
+    std::pair<std::string, osg::BoundingBoxd> createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams(), double* simplifyError = nullptr, double dracoPositionError = 0.0);
     std::string createI3DM(MeshInstanceInfo* meshInfo, const std::vector<int>& transformIndices, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams());
 
     // Helpers
@@ -1,6 +1,9 @@
 #include "GeoTransform.h"
 #include <cstdio>
 #include <glm/glm.hpp>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 glm::dmat4 GeoTransform::CalcEnuToEcefMatrix(double lnt, double lat, double height_min)
 {
@@ -55,49 +58,125 @@ glm::dvec3 GeoTransform::CartographicToEcef(double lnt, double lat, double heigh
     return { x, y, z };
 }
 
-void GeoTransform::Init(OGRCoordinateTransformation *pOgrCT, double *Origin)
+namespace {
+std::mutex reference_mutex;
+std::shared_ptr<const GeoReference> current_reference;
+std::atomic<uint64_t> next_reference_id{1};
+
+// Per thread copies of the prototypes, keyed by GeoReference::Id
+using ThreadTransforms = std::unordered_map<uint64_t, std::unique_ptr<OGRCoordinateTransformation, OGRCTDeleter>>;
+thread_local ThreadTransforms thread_transforms;
+std::mutex clone_mutex;
+}
+
+GeoReference::GeoReference(OGRCoordinateTransformation *pOgrCT, const double *Origin)
+    : Id(next_reference_id++), Prototype(pOgrCT)
 {
-    // Use smart pointer to manage coordinate transformation object, automatically releases old resources
-    GeoTransform::pOgrCT.reset(pOgrCT);
-    GeoTransform::OriginX = Origin[0];
-    GeoTransform::OriginY = Origin[1];
-    GeoTransform::OriginZ = Origin[2];
-    GeoTransform::IsENU = false;  // Default to non-ENU, will be set by SetGeographicOrigin if ENU
-
-    glm::dvec3 origin = { GeoTransform::OriginX, GeoTransform::OriginY, GeoTransform::OriginZ };
-    glm::dvec3 origin_cartographic = origin;
-    // Log ENU origin before transform
-    fprintf(stderr, "[GeoTransform] ENU origin: x=%.8f y=%.8f z=%.3f\n", origin.x, origin.y, origin.z);
+    OriginX = Origin[0];
+    OriginY = Origin[1];
+    OriginZ = Origin[2];
+    IsENU = false;  // Default to non-ENU, see the ENU constructor
 
-    // Use get() to obtain raw pointer for coordinate transformation
-    if (GeoTransform::pOgrCT)
+    glm::dvec3 origin_cartographic = { OriginX, OriginY, OriginZ };
+    if (Prototype)
     {
-        GeoTransform::pOgrCT->Transform(1, &origin_cartographic.x, &origin_cartographic.y, &origin_cartographic.z);
+        Prototype->Transform(1, &origin_cartographic.x, &origin_cartographic.y, &origin_cartographic.z);
     }
 
-    // Log cartographic origin after transform (degrees)
-    fprintf(stderr, "[GeoTransform] Cartographic origin: lon=%.10f lat=%.10f h=%.3f\n", origin_cartographic.x, origin_cartographic.y, origin_cartographic.z);
-
     // For EPSG systems, use the transformed cartographic origin
-    // For ENU systems, this will be overridden by SetGeographicOrigin()
-    GeoTransform::GeoOriginLon = origin_cartographic.x;
-    GeoTransform::GeoOriginLat = origin_cartographic.y;
-    GeoTransform::GeoOriginHeight = origin_cartographic.z;
+    GeoOriginLon = origin_cartographic.x;
+    GeoOriginLat = origin_cartographic.y;
+    GeoOriginHeight = origin_cartographic.z;
 
-    glm::dmat4 EnuToEcefMatrix = GeoTransform::CalcEnuToEcefMatrix(origin_cartographic.x, origin_cartographic.y, origin_cartographic.z);
-    GeoTransform::EcefToEnuMatrix = glm::inverse(EnuToEcefMatrix);
+    EnuToEcefMatrix = GeoTransform::CalcEnuToEcefMatrix(GeoOriginLon, GeoOriginLat, GeoOriginHeight);
+    EcefToEnuMatrix = glm::inverse(EnuToEcefMatrix);
 }
 
-void GeoTransform::SetGeographicOrigin(double lon, double lat, double height)
+GeoReference::GeoReference(const GeoReference &other, double lon, double lat, double height)
+    : Id(next_reference_id++)
 {
-    GeoTransform::GeoOriginLon = lon;
-    GeoTransform::GeoOriginLat = lat;
-    GeoTransform::GeoOriginHeight = height;
-    GeoTransform::IsENU = true;
+    if (other.Prototype)
+    {
+        std::lock_guard<std::mutex> lock(clone_mutex);
+        Prototype.reset(other.Prototype->Clone());
+    }
+    OriginX = other.OriginX;
+    OriginY = other.OriginY;
+    OriginZ = other.OriginZ;
+    GeoOriginLon = lon;
+    GeoOriginLat = lat;
+    GeoOriginHeight = height;
+    IsENU = true;
 
     // Recalculate ENU<->ECEF matrices using the geographic origin
-    glm::dmat4 EnuToEcefMatrix = GeoTransform::CalcEnuToEcefMatrix(lon, lat, height);
-    GeoTransform::EcefToEnuMatrix = glm::inverse(EnuToEcefMatrix);
+    EnuToEcefMatrix = GeoTransform::CalcEnuToEcefMatrix(lon, lat, height);
+    EcefToEnuMatrix = glm::inverse(EnuToEcefMatrix);
+}
+
+OGRCoordinateTransformation *GeoReference::ThreadTransform() const
+{
+    if (!Prototype)
+        return nullptr;
+    auto it = thread_transforms.find(Id);
+    if (it != thread_transforms.end())
+        return it->second.get();
+
+    OGRCoordinateTransformation *pCT = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(clone_mutex);
+        pCT = Prototype->Clone();
+    }
+    thread_transforms[Id].reset(pCT);
+    return pCT;
+}
+
+bool GeoReference::Transform(int count, double *x, double *y, double *z) const
+{
+    OGRCoordinateTransformation *pCT = ThreadTransform();
+    if (!pCT)
+        return false;
+    return pCT->Transform(count, x, y, z) != FALSE;
+}
+
+void GeoTransform::Init(OGRCoordinateTransformation *pOgrCT, double *Origin)
+{
+    // Log ENU origin before transform
+    fprintf(stderr, "[GeoTransform] ENU origin: x=%.8f y=%.8f z=%.3f\n", Origin[0], Origin[1], Origin[2]);
+
+    // The reference owns pOgrCT from now on and releases the previous one
+    auto reference = std::make_shared<GeoReference>(pOgrCT, Origin);
+
+    // Log cartographic origin after transform (degrees)
+    fprintf(stderr, "[GeoTransform] Cartographic origin: lon=%.10f lat=%.10f h=%.3f\n",
+            reference->GeoOriginLon, reference->GeoOriginLat, reference->GeoOriginHeight);
+
+    std::lock_guard<std::mutex> lock(reference_mutex);
+    current_reference = reference;
+}
+
+void GeoTransform::SetGeographicOrigin(double lon, double lat, double height)
+{
+    std::shared_ptr<const GeoReference> current = GetReference();
+    std::shared_ptr<const GeoReference> reference;
+    if (current)
+    {
+        reference = std::make_shared<GeoReference>(*current, lon, lat, height);
+    }
+    else
+    {
+        const double origin[3] = { 0.0, 0.0, 0.0 };
+        GeoReference base(nullptr, origin);
+        reference = std::make_shared<GeoReference>(base, lon, lat, height);
+    }
 
     fprintf(stderr, "[GeoTransform] Geographic origin set: lon=%.10f lat=%.10f h=%.3f\n", lon, lat, height);
+
+    std::lock_guard<std::mutex> lock(reference_mutex);
+    current_reference = reference;
+}
+
+std::shared_ptr<const GeoReference> GeoTransform::GetReference()
+{
+    std::lock_guard<std::mutex> lock(reference_mutex);
+    return current_reference;
 }
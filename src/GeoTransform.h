@@ -3,6 +3,7 @@
 #include <ogr_spatialref.h>
 #include <ogrsf_frmts.h>
 #include <memory>
+#include <cstdint>
 
 #include "glm/glm.hpp"
 
@@ -18,30 +19,54 @@ struct OGRCTDeleter
     }
 };
 
-class GeoTransform
+// Immutable georeference of a dataset: source projection, origins and the
+// ECEF<->ENU matrices of the origin. It is built once on the thread that
+// reads metadata.xml and shared read-only by every conversion thread.
+class GeoReference
 {
 public:
-    // Use inline thread_local to ensure each thread has its own coordinate transformation object
-    // This avoids race conditions when multiple threads access pOgrCT concurrently
-    // With inline initialization, no need to define in .cpp file
-    static inline thread_local std::unique_ptr<OGRCoordinateTransformation, OGRCTDeleter> pOgrCT = nullptr;
+    // Takes ownership of pOgrCT (may be null: no correction)
+    GeoReference(OGRCoordinateTransformation *pOgrCT, const double *Origin);
+
+    // Same projection and origin, with an explicit geographic origin (ENU datasets)
+    GeoReference(const GeoReference &other, double lon, double lat, double height);
+
+    bool HasTransform() const { return Prototype != nullptr; }
 
-    static inline thread_local double OriginX = 0.0;
+    // Transforms count points in place with the calling thread's own copy of
+    // the coordinate transformation; returns false if any point failed.
+    bool Transform(int count, double *x, double *y, double *z) const;
 
-    static inline thread_local double OriginY = 0.0;
+    // Unique per instance, usable as a cache key
+    uint64_t Id = 0;
 
-    static inline thread_local double OriginZ = 0.0;
+    double OriginX = 0.0;
+    double OriginY = 0.0;
+    double OriginZ = 0.0;
 
     // For ENU systems: store as geographic origin separately
-    static inline thread_local double GeoOriginLon = 0.0;
-    static inline thread_local double GeoOriginLat = 0.0;
-    static inline thread_local double GeoOriginHeight = 0.0;
+    double GeoOriginLon = 0.0;
+    double GeoOriginLat = 0.0;
+    double GeoOriginHeight = 0.0;
 
     // Flag to indicate if this is an ENU system
-    static inline thread_local bool IsENU = false;
+    bool IsENU = false;
+
+    glm::dmat4 EcefToEnuMatrix = glm::dmat4(1);
+
+    // Inverse of EcefToEnuMatrix, kept so the ENU correction does not redo sin/cos per point
+    glm::dmat4 EnuToEcefMatrix = glm::dmat4(1);
+
+private:
+    OGRCoordinateTransformation *ThreadTransform() const;
 
-    static inline thread_local glm::dmat4 EcefToEnuMatrix = glm::dmat4(1);
+    // Only cloned, never used to transform: OGRCoordinateTransformation is not thread safe
+    std::unique_ptr<OGRCoordinateTransformation, OGRCTDeleter> Prototype;
+};
 
+class GeoTransform
+{
+public:
     static glm::dmat4 CalcEnuToEcefMatrix(double lnt, double lat, double height_min);
 
     static glm::dvec3 CartographicToEcef(double lnt, double lat, double height);
@@ -49,4 +74,8 @@ public:
     static void Init(OGRCoordinateTransformation *pOgrCT, double *Origin);
 
     static void SetGeographicOrigin(double lon, double lat, double height);
-};
\ No newline at end of file
+
+    // The georeference set by the last Init()/SetGeographicOrigin(), or null.
+    // Conversions take it once on entry and pass it down explicitly.
+    static std::shared_ptr<const GeoReference> GetReference();
+};
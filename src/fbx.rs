@@ -2,61 +2,84 @@ use std::{error::Error, fs};
 
 use crate::common::str_to_vec_c;
 
-extern "C" {
-
-    fn fbx23dtile(
-        in_path: *const u8,
-        out_path: *const u8,
-        box_ptr: *mut f64,
-        len: *mut i32,
-        max_lvl: i32,
-        enable_texture_compress: bool,
-        enable_meshopt: bool,
-        enable_draco: bool,
-        enable_unlit: bool,
-        longitude: f64,
-        latitude: f64,
-        height: f64,
-    ) -> *mut libc::c_void;
-}
+#[repr(C)]
+struct FbxConversionParams {
+    input_path: *const libc::c_char,
+    output_path: *const libc::c_char,
+    max_lvl: i32,
+    draco_encoding_speed: i32,
+    draco_decoding_speed: i32,
+    geometric_error_scale: f64,
+    draco_error_fraction: f64,
+    longitude: f64,
+    latitude: f64,
+    height: f64,
 
-pub fn convert_fbx(
-    in_file: &str,
-    out_dir: &str,
-    max_lvl: Option<i32>,
+    // Feature flags
     enable_texture_compress: bool,
     enable_meshopt: bool,
     enable_draco: bool,
     enable_unlit: bool,
-    longitude: f64,
-    latitude: f64,
-    height: f64,
-) -> Result<(), Box<dyn Error>> {
+    enable_optimize_mesh: bool,
+    enable_meshopt_compression: bool,
+    enable_quantize: bool,
+}
+
+extern "C" {
+
+    fn fbx23dtile(params: *const FbxConversionParams, box_ptr: *mut f64, len: *mut i32) -> *mut libc::c_void;
+}
+
+/// Settings of `convert_fbx`
+pub struct FbxSettings {
+    pub max_lvl: Option<i32>, // Depth of the tile tree, 5 if not set
+    pub longitude: f64,       // Origin, degree
+    pub latitude: f64,
+    pub height: f64,
+    pub geometric_error_scale: f64,
+    pub draco_error_fraction: f64,
+    pub draco_encoding_speed: i32,
+    pub draco_decoding_speed: i32,
+    pub enable_texture_compress: bool,
+    pub enable_meshopt: bool,
+    pub enable_draco: bool,
+    pub enable_unlit: bool,
+    pub enable_optimize_mesh: bool,
+    pub enable_meshopt_compression: bool,
+    pub enable_quantize: bool,
+}
+
+pub fn convert_fbx(in_file: &str, out_dir: &str, settings: &FbxSettings) -> Result<(), Box<dyn Error>> {
     let in_path = str_to_vec_c(in_file);
     let out_path = str_to_vec_c(out_dir);
 
     // Create output directory
     fs::create_dir_all(out_dir)?;
 
-    let max_lvl = max_lvl.unwrap_or(5);
     let mut root_box = vec![0f64; 6];
     let mut json_len = 0i32;
+    let params = FbxConversionParams {
+        input_path: in_path.as_ptr() as *const libc::c_char,
+        output_path: out_path.as_ptr() as *const libc::c_char,
+        max_lvl: settings.max_lvl.unwrap_or(5),
+        draco_encoding_speed: settings.draco_encoding_speed,
+        draco_decoding_speed: settings.draco_decoding_speed,
+        geometric_error_scale: settings.geometric_error_scale,
+        draco_error_fraction: settings.draco_error_fraction,
+        longitude: settings.longitude,
+        latitude: settings.latitude,
+        height: settings.height,
+        enable_texture_compress: settings.enable_texture_compress,
+        enable_meshopt: settings.enable_meshopt,
+        enable_draco: settings.enable_draco,
+        enable_unlit: settings.enable_unlit,
+        enable_optimize_mesh: settings.enable_optimize_mesh,
+        enable_meshopt_compression: settings.enable_meshopt_compression,
+        enable_quantize: settings.enable_quantize,
+    };
 
     unsafe {
-        let out_ptr = fbx23dtile(
-            in_path.as_ptr(),
-            out_path.as_ptr(),
-            root_box.as_mut_ptr(),
-            &mut json_len,
-            max_lvl,
-            enable_texture_compress,
-            enable_meshopt,
-            enable_draco,
-            enable_unlit,
-            longitude,
-            latitude,
-            height,
-        );
+        let out_ptr = fbx23dtile(&params, root_box.as_mut_ptr(), &mut json_len);
 
         if out_ptr.is_null() {
             return Err(From::from(format!("FBX conversion failed for {}", in_file)));
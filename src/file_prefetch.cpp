@@ -0,0 +1,166 @@
+#include "file_prefetch.h"
+
+#include <filesystem>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+void hint_willneed(const std::string& path)
+{
+#if defined(__unix__) && defined(POSIX_FADV_WILLNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+bool read_whole_file(const std::string& path, std::string& bytes)
+{
+    std::ifstream in(std::filesystem::path(path), std::ios::binary);
+    if (!in)
+        return false;
+    in.seekg(0, std::ios::end);
+    std::streamoff size = in.tellg();
+    if (size < 0)
+        return false;
+    in.seekg(0, std::ios::beg);
+    bytes.resize((size_t)size);
+    in.read(bytes.data(), size);
+    return (bool)in;
+}
+
+}
+
+FilePrefetcher::FilePrefetcher(size_t budget_bytes, unsigned num_threads)
+    : budget(budget_bytes)
+{
+    for (unsigned i = 0; i < num_threads; i++)
+        threads.emplace_back(&FilePrefetcher::io_loop, this);
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& t : threads) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+FilePrefetcher& FilePrefetcher::instance(size_t budget_bytes)
+{
+    static FilePrefetcher prefetcher(budget_bytes);
+    return prefetcher;
+}
+
+void FilePrefetcher::prefetch(const std::string& path)
+{
+    std::error_code ec;
+    size_t size = (size_t)std::filesystem::file_size(std::filesystem::path(path), ec);
+    if (ec)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count(path))
+            return;
+        if (used + size <= budget) {
+            Entry& entry = entries[path];
+            entry.reserved = size;
+            used += size;
+            queue.push_back(path);
+            work_cv.notify_one();
+            return;
+        }
+    }
+    hint_willneed(path);
+}
+
+void FilePrefetcher::erase(std::unordered_map<std::string, Entry>::iterator it)
+{
+    used -= it->second.reserved;
+    entries.erase(it);
+}
+
+bool FilePrefetcher::take(const std::string& path, std::string& bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end())
+        return false;
+    if (it->second.state == State::Reading) {
+        ready_cv.wait(lock, [&] {
+            it = entries.find(path);
+            return it == entries.end() || it->second.state != State::Reading;
+        });
+        if (it == entries.end())
+            return false;
+    }
+    bool ready = it->second.state == State::Ready;
+    if (ready)
+        bytes = std::move(it->second.bytes);
+    // a queued file is dropped, the I/O threads skip it
+    erase(it);
+    return ready;
+}
+
+void FilePrefetcher::discard(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end())
+        return;
+    if (it->second.state == State::Reading)
+        it->second.discarded = true;
+    else
+        erase(it);
+}
+
+void FilePrefetcher::io_loop()
+{
+    while (true) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            path = std::move(queue.back());
+            queue.pop_back();
+            auto it = entries.find(path);
+            if (it == entries.end() || it->second.state != State::Queued)
+                continue;
+            it->second.state = State::Reading;
+        }
+
+        std::string bytes;
+        bool ok = read_whole_file(path, bytes);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(path);
+            if (it != entries.end()) {
+                if (it->second.discarded) {
+                    erase(it);
+                }
+                else {
+                    it->second.state = ok ? State::Ready : State::Failed;
+                    it->second.bytes = std::move(bytes);
+                }
+            }
+        }
+        ready_cv.notify_all();
+    }
+}
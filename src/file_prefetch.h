@@ -0,0 +1,61 @@
+#ifndef FILE_PREFETCH_H
+#define FILE_PREFETCH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Reads source files ahead of the converters on a few I/O threads, into a
+// byte cache bounded by a budget. Files that do not fit in the budget only
+// get a read-ahead hint to the OS (posix_fadvise WILLNEED).
+// The most recently requested files are read first, which matches the
+// depth first order of the tile pool.
+class FilePrefetcher {
+public:
+    explicit FilePrefetcher(size_t budget_bytes, unsigned num_threads = 2);
+    ~FilePrefetcher();
+
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+    // Process wide prefetcher; budget_bytes only takes effect on the first call
+    static FilePrefetcher& instance(size_t budget_bytes);
+
+    void prefetch(const std::string& path);
+
+    // Moves the bytes of a prefetched file out of the cache, waiting if the
+    // file is being read. False if it is not cached: the caller reads it.
+    bool take(const std::string& path, std::string& bytes);
+
+    // Forgets a file that will not be read after all
+    void discard(const std::string& path);
+
+private:
+    enum class State { Queued, Reading, Ready, Failed };
+    struct Entry {
+        State state = State::Queued;
+        size_t reserved = 0;    // bytes counted in used
+        bool discarded = false; // dropped while being read
+        std::string bytes;
+    };
+
+    void io_loop();
+    void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+    size_t budget;
+    size_t used = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable ready_cv;
+    std::deque<std::string> queue;
+    std::unordered_map<std::string, Entry> entries;
+    std::vector<std::thread> threads;
+};
+
+#endif // FILE_PREFETCH_H
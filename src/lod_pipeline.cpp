@@ -1,12 +1,15 @@
 #include "lod_pipeline.h"
 #include <cstddef>
 
+#include <meshoptimizer.h>
+
 std::vector<LODLevelSettings> build_lod_levels(
     const std::vector<float>& ratios,
     float base_error,
     const SimplificationParams& simplify_template,
     const DracoCompressionParams& draco_template,
-    bool draco_for_lod0) {
+    bool draco_for_lod0,
+    float sloppy_below_ratio) {
 
     std::vector<LODLevelSettings> levels;
     levels.reserve(ratios.size());
@@ -22,6 +25,11 @@ std::vector<LODLevelSettings> build_lod_levels(
         lvl.simplify.target_ratio = ratios[i];
         lvl.simplify.target_error = base_error;
 
+        // Coarse levels only need the triangle budget; topology-preserving
+        // simplification stalls on them long before reaching the ratio
+        lvl.simplify_mode = ratios[i] < sloppy_below_ratio ? SIMPLIFY_SLOPPY : SIMPLIFY_TOPOLOGY;
+        lvl.simplify.mode = lvl.simplify_mode;
+
         lvl.enable_draco = draco_template.enable_compression;
         if (i == 0 && !draco_for_lod0) {
             lvl.enable_draco = false;
@@ -33,3 +41,85 @@ std::vector<LODLevelSettings> build_lod_levels(
 
     return levels;
 }
+
+bool build_lod_chain(
+    std::vector<VertexData>& vertices,
+    std::vector<unsigned int>& indices,
+    const std::vector<LODLevelSettings>& levels,
+    std::vector<LODChainLevel>& chain) {
+
+    chain.clear();
+    if (levels.empty() || vertices.empty() || indices.empty() || indices.size() % 3 != 0) {
+        return false;
+    }
+    const size_t original_index_count = indices.size();
+
+    // The first level pays for the weld, cache and overdraw passes
+    SimplificationParams first = levels[0].simplify;
+    first.target_ratio = levels[0].enable_simplification ? levels[0].target_ratio : 1.0f;
+    first.target_error = levels[0].target_error;
+    first.mode = levels[0].simplify_mode;
+
+    size_t vertex_count = vertices.size();
+    LODChainLevel level;
+    size_t index_count = 0;
+    if (!optimize_and_simplify_mesh(vertices, vertex_count, indices, original_index_count,
+                                    level.indices, index_count, first, &level.error)) {
+        return false;
+    }
+
+    // Errors are relative to the mesh extent, report them in mesh units
+    const float error_scale = meshopt_simplifyScale(&vertices[0].x, vertices.size(), sizeof(VertexData));
+    level.error *= error_scale;
+    chain.push_back(std::move(level));
+
+    for (size_t i = 1; i < levels.size(); ++i) {
+        const LODLevelSettings& lvl = levels[i];
+        const LODChainLevel& previous = chain.back();
+        LODChainLevel next;
+        next.error = previous.error;
+
+        size_t target_index_count = static_cast<size_t>(original_index_count * lvl.target_ratio) / 3 * 3;
+        if (!lvl.enable_simplification || target_index_count >= previous.indices.size()) {
+            next.indices = previous.indices;
+            chain.push_back(std::move(next));
+            continue;
+        }
+
+        SimplificationParams params = lvl.simplify;
+        params.target_error = lvl.target_error;
+        params.mode = lvl.simplify_mode;
+
+        // Errors of successive passes add up at most
+        float result_error = 0.0f;
+        next.indices.resize(previous.indices.size());
+        size_t count = simplify_mesh_indices(vertices, previous.indices.data(), previous.indices.size(),
+                                             target_index_count, params, next.indices.data(), &result_error);
+        next.indices.resize(count);
+        next.error += result_error * error_scale;
+
+        // Simplification leaves the triangle order of its input behind
+        meshopt_optimizeVertexCache(next.indices.data(), next.indices.data(), count, vertices.size());
+        chain.push_back(std::move(next));
+    }
+
+    return true;
+}
+
+void compact_lod_level(
+    const std::vector<VertexData>& vertices,
+    const LODChainLevel& level,
+    std::vector<VertexData>& out_vertices,
+    std::vector<unsigned int>& out_indices) {
+
+    out_indices = level.indices;
+    if (out_indices.empty()) {
+        out_vertices.clear();
+        return;
+    }
+    out_vertices.resize(vertices.size());
+    size_t vertex_count = meshopt_optimizeVertexFetch(
+        out_vertices.data(), out_indices.data(), out_indices.size(),
+        vertices.data(), vertices.size(), sizeof(VertexData));
+    out_vertices.resize(vertex_count);
+}
@@ -11,6 +11,7 @@ struct LODLevelSettings {
     float target_error = 0.01f;             // Simplification error budget (matches SimplificationParams)
     bool enable_simplification = false;     // Whether to run mesh simplification for this LOD
     bool enable_draco = false;              // Whether to apply Draco on this LOD output
+    int simplify_mode = SIMPLIFY_TOPOLOGY;  // SimplifyMode used for this LOD (copied to simplify.mode)
 
     SimplificationParams simplify;          // Base simplify params (ratio/error will be overridden)
     DracoCompressionParams draco;           // Base Draco params
@@ -25,11 +26,36 @@ struct LODPipelineSettings {
 // Build levels from ratios and templates; ratios are applied in order to simplify.target_ratio and set enable_simplification=true
 // base_error is used as simplify.target_error for all levels
 // If draco_for_lod0 is false, LOD0 will have enable_draco=false even if draco_template.enable_compression is true
+// Levels with a ratio below sloppy_below_ratio use SIMPLIFY_SLOPPY, the finer ones SIMPLIFY_TOPOLOGY
 std::vector<LODLevelSettings> build_lod_levels(
     const std::vector<float>& ratios,
     float base_error,
     const SimplificationParams& simplify_template,
     const DracoCompressionParams& draco_template,
-    bool draco_for_lod0 = false);
+    bool draco_for_lod0 = false,
+    float sloppy_below_ratio = 0.3f);
+
+// One level of build_lod_chain
+struct LODChainLevel {
+    std::vector<unsigned int> indices;      // Triangles into the shared, welded vertex buffer
+    float error = 0.0f;                     // Accumulated simplification error, in the units of the vertices
+};
+
+// Build every level from one mesh: vertices are welded and optimized once,
+// then each level is simplified from the previous (coarser from finer), so
+// levels must be ordered fine->coarse. Ratios stay relative to the input
+// triangle count. vertices is replaced by the welded buffer all levels index.
+bool build_lod_chain(
+    std::vector<VertexData>& vertices,
+    std::vector<unsigned int>& indices,
+    const std::vector<LODLevelSettings>& levels,
+    std::vector<LODChainLevel>& chain);
+
+// Copy the vertices a chain level uses into a compact buffer, in fetch order
+void compact_lod_level(
+    const std::vector<VertexData>& vertices,
+    const LODChainLevel& level,
+    std::vector<VertexData>& out_vertices,
+    std::vector<unsigned int>& out_indices);
 
 #endif // LOD_PIPELINE_H
@@ -14,6 +14,7 @@ mod common;
 mod fbx;
 pub mod fun_c;
 mod osgb;
+mod serve;
 mod shape;
 
 use chrono::prelude::*;
@@ -161,6 +162,19 @@ fn main() {
                 .help("Enable Draco mesh compression")
                 .action(ArgAction::SetTrue),
         )
+        .arg(
+            Arg::new("mesh-compression")
+                .long("mesh-compression")
+                .value_name("CODEC")
+                .help("Mesh compression: draco (same as --enable-draco), meshopt (EXT_meshopt_compression, faster to decode) or none")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("quantize")
+                .long("quantize")
+                .help("Store positions, normals and texture coordinates as integers (KHR_mesh_quantization)")
+                .action(ArgAction::SetTrue),
+        )
         .arg(
             Arg::new("enable-simplify")
                 .long("enable-simplify")
@@ -185,6 +199,135 @@ fn main() {
                 .help("Enable KHR_materials_unlit extension (useful for baked lighting)")
                 .action(ArgAction::SetTrue),
         )
+        .arg(
+            Arg::new("threads")
+                .long("threads")
+                .value_name("N")
+                .help("Set the number of conversion worker threads (default: all cores)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("incremental")
+                .long("incremental")
+                .help("Skip OSGB tiles unchanged since the previous run into the same output (uses Data/Tile_*/manifest.json)")
+                .action(ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("memory-budget")
+                .long("memory-budget")
+                .value_name("MB")
+                .help("Limit the estimated memory of the OSGB blocks converted at once (default: 3/4 of the available memory)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("group-branching")
+                .long("group-branching")
+                .value_name("N")
+                .help("Group the OSGB blocks under the root into tiles of N x N cells (2: quadtree, default: flat root)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("group-depth")
+                .long("group-depth")
+                .value_name("N")
+                .help("Maximum number of grouping levels above the OSGB blocks (default: 4)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("hlod")
+                .long("hlod")
+                .help("Give the OSGB grouping tiles a simplified proxy of their blocks (needs --group-branching)")
+                .action(ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("hlod-triangles")
+                .long("hlod-triangles")
+                .value_name("N")
+                .help("Triangle budget of each HLOD proxy (default: 200000)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("hlod-atlas-size")
+                .long("hlod-atlas-size")
+                .value_name("PX")
+                .help("Width and height of the texture atlas of each HLOD proxy (default: 2048)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("hlod-max-error")
+                .long("hlod-max-error")
+                .value_name("RATIO")
+                .help("Simplification error bound of the HLOD proxies, relative to the extent of a child (default: 0.05)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("min-tile-size")
+                .long("min-tile-size")
+                .value_name("KB")
+                .help("Merge sibling OSGB leaf tiles smaller than this into one b3dm (default: off)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("max-tile-size")
+                .long("max-tile-size")
+                .value_name("KB")
+                .help("Split OSGB tile contents larger than this into spatial parts (default: off)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("prefetch")
+                .long("prefetch")
+                .value_name("MB")
+                .help("Read-ahead cache for the OSGB source files, 0 disables it (default: 256)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("fast-osgb")
+                .long("fast-osgb")
+                .help("Parse OSGB files with the built-in binary reader, falling back to OSG for unsupported files")
+                .action(ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("optimize-mesh")
+                .long("optimize-mesh")
+                .help("Weld vertices and reorder triangles and vertices for GPU caches, without simplifying")
+                .action(ArgAction::SetTrue),
+        )
+        .arg(
+            Arg::new("normals")
+                .long("normals")
+                .value_name("MODE")
+                .help("OSGB vertex normals: keep, generate (missing ones) or strip (default: strip, OSGB output is unlit)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("geometric-error-scale")
+                .long("geometric-error-scale")
+                .value_name("F")
+                .help("Multiply the measured simplification error that feeds geometricError (default: 1.0)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("draco-encoding-speed")
+                .long("draco-encoding-speed")
+                .value_name("0-10")
+                .help("Draco encoder speed, 0 gives the smallest output, 10 the fastest encoding (default: 5)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("draco-decoding-speed")
+                .long("draco-decoding-speed")
+                .value_name("0-10")
+                .help("Draco decoder speed the encoder targets, 10 decodes fastest (default: 5)")
+                .num_args(1),
+        )
+        .arg(
+            Arg::new("draco-error-fraction")
+                .long("draco-error-fraction")
+                .value_name("F")
+                .help("Draco position error of refined tiles as a fraction of their geometricError, leaves get 5 mm, 0 keeps 11 bits (default: 0.05)")
+                .num_args(1),
+        )
         .arg(
            Arg::new("lon")
             .long("lon")
@@ -203,8 +346,147 @@ fn main() {
             .help("Set the altitude")
             .num_args(1),
         )
+        .subcommand_negates_reqs(true)
+        .args_conflicts_with_subcommands(true)
+        .subcommand(
+            Command::new("serve")
+                .about("Serve an OSGB dataset as 3dtiles over HTTP, converting tiles on first request")
+                .arg(
+                    Arg::new("input")
+                        .short('i')
+                        .long("input")
+                        .value_name("DIR")
+                        .help("Set the OSGB dataset dir")
+                        .required(true)
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("output")
+                        .short('o')
+                        .long("output")
+                        .value_name("DIR")
+                        .help("Keep converted tiles in this dir across runs (default: memory only)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("config")
+                        .short('c')
+                        .long("config")
+                        .help("Set the config json")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("port")
+                        .long("port")
+                        .help("Listen on this localhost port (default: 8000)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("cache-mb")
+                        .long("cache-mb")
+                        .value_name("MB")
+                        .help("Memory cache of converted tiles (default: 512)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("disk-cache-mb")
+                        .long("disk-cache-mb")
+                        .value_name("MB")
+                        .help("Disk cache of converted tiles under -o, 0 is unbounded (default: 0)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("threads")
+                        .long("threads")
+                        .help("Number of tiles converted at once (default: number of CPU cores)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("enable-simplify")
+                        .long("enable-simplify")
+                        .help("Enable mesh simplification")
+                        .action(ArgAction::SetTrue),
+                )
+                .arg(
+                    Arg::new("enable-draco")
+                        .long("enable-draco")
+                        .help("Enable Draco mesh compression")
+                        .action(ArgAction::SetTrue),
+                )
+                .arg(
+                    Arg::new("mesh-compression")
+                        .long("mesh-compression")
+                        .value_name("CODEC")
+                        .help("Mesh compression: draco (same as --enable-draco), meshopt or none")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("quantize")
+                        .long("quantize")
+                        .help("Store vertex attributes as integers (KHR_mesh_quantization)")
+                        .action(ArgAction::SetTrue),
+                )
+                .arg(
+                    Arg::new("enable-texture-compress")
+                        .long("enable-texture-compress")
+                        .help("Enable KTX2 texture compression")
+                        .action(ArgAction::SetTrue),
+                )
+                .arg(
+                    Arg::new("optimize-mesh")
+                        .long("optimize-mesh")
+                        .help("Weld vertices and reorder triangles and vertices for GPU caches")
+                        .action(ArgAction::SetTrue),
+                )
+                .arg(
+                    Arg::new("normals")
+                        .long("normals")
+                        .value_name("MODE")
+                        .help("Vertex normals: keep, generate (missing ones) or strip (default: strip, output is unlit)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("geometric-error-scale")
+                        .long("geometric-error-scale")
+                        .value_name("F")
+                        .help("Multiply the measured simplification error that feeds geometricError (default: 1.0)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("draco-encoding-speed")
+                        .long("draco-encoding-speed")
+                        .value_name("0-10")
+                        .help("Draco encoder speed, 0 gives the smallest output, 10 the fastest encoding (default: 5)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("draco-decoding-speed")
+                        .long("draco-decoding-speed")
+                        .value_name("0-10")
+                        .help("Draco decoder speed the encoder targets, 10 decodes fastest (default: 5)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("draco-error-fraction")
+                        .long("draco-error-fraction")
+                        .value_name("F")
+                        .help("Draco position error of refined tiles over their geometricError, leaves get 5 mm (default: 0.05)")
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("fast-osgb")
+                        .long("fast-osgb")
+                        .help("Parse OSGB files with the built-in binary reader")
+                        .action(ArgAction::SetTrue),
+                ),
+        )
         .get_matches();
 
+    if let Some(sub) = matches.subcommand_matches("serve") {
+        serve_osgb(sub);
+        return;
+    }
+
     let input = matches
         .get_one::<String>("input")
         .expect("input is required")
@@ -235,13 +517,79 @@ fn main() {
     let alt_val = matches
         .get_one::<String>("alt")
         .and_then(|s| s.parse::<f64>().ok());
+    let num_threads = matches
+        .get_one::<String>("threads")
+        .and_then(|s| s.parse::<i32>().ok())
+        .unwrap_or(0);
+    let memory_budget = matches
+        .get_one::<String>("memory-budget")
+        .and_then(|s| s.parse::<u64>().ok())
+        .unwrap_or(0);
+    let group_branching = matches
+        .get_one::<String>("group-branching")
+        .and_then(|s| s.parse::<u32>().ok())
+        .unwrap_or(0);
+    let group_depth = matches
+        .get_one::<String>("group-depth")
+        .and_then(|s| s.parse::<u32>().ok())
+        .unwrap_or(4);
+    let prefetch_mb = matches
+        .get_one::<String>("prefetch")
+        .and_then(|s| s.parse::<i32>().ok())
+        .unwrap_or(256);
+    let geometric_error_scale = matches
+        .get_one::<String>("geometric-error-scale")
+        .and_then(|s| s.parse::<f64>().ok())
+        .unwrap_or(1.0);
+    let draco_error_fraction = parse_draco_error_fraction(&matches);
+    let (draco_encoding_speed, draco_decoding_speed) = match parse_draco_speeds(&matches) {
+        Some(x) => x,
+        None => return,
+    };
 
     // Parse feature flags
-    let enable_draco = matches.get_flag("enable-draco");
+    let (enable_draco, enable_meshopt_compression) = match parse_mesh_compression(&matches) {
+        Some(x) => x,
+        None => return,
+    };
     let enable_simplify = matches.get_flag("enable-simplify");
     let enable_texture_compress = matches.get_flag("enable-texture-compress");
     let enable_lod = matches.get_flag("enable-lod");
     let enable_unlit = matches.get_flag("enable-unlit");
+    let enable_incremental = matches.get_flag("incremental");
+    let hlod = if matches.get_flag("hlod") {
+        Some(osgb::HlodSettings {
+            max_triangles: matches
+                .get_one::<String>("hlod-triangles")
+                .and_then(|s| s.parse::<i32>().ok())
+                .unwrap_or(200_000),
+            atlas_size: matches
+                .get_one::<String>("hlod-atlas-size")
+                .and_then(|s| s.parse::<i32>().ok())
+                .unwrap_or(2048),
+            max_error: matches
+                .get_one::<String>("hlod-max-error")
+                .and_then(|s| s.parse::<f64>().ok())
+                .unwrap_or(0.05),
+        })
+    } else {
+        None
+    };
+    let enable_fast_reader = matches.get_flag("fast-osgb");
+    let enable_optimize_mesh = matches.get_flag("optimize-mesh");
+    let enable_quantize = matches.get_flag("quantize");
+    let normals_mode = match parse_normals_mode(matches.get_one::<String>("normals")) {
+        Some(x) => x,
+        None => return,
+    };
+    let min_tile_kb = matches
+        .get_one::<String>("min-tile-size")
+        .and_then(|s| s.parse::<i32>().ok())
+        .unwrap_or(0);
+    let max_tile_kb = matches
+        .get_one::<String>("max-tile-size")
+        .and_then(|s| s.parse::<i32>().ok())
+        .unwrap_or(0);
 
     if matches.get_flag("verbose") {
         info!("set program versose on");
@@ -249,6 +597,12 @@ fn main() {
     if enable_draco {
         info!("Draco compression enabled");
     }
+    if enable_meshopt_compression {
+        info!("meshopt compression (EXT_meshopt_compression) enabled");
+    }
+    if enable_quantize {
+        info!("Vertex quantization (KHR_mesh_quantization) enabled");
+    }
     if enable_simplify {
         info!("Mesh simplification enabled");
     }
@@ -270,18 +624,56 @@ fn main() {
 
     match format {
         "osgb" => {
-            // osgb默认开启material_unlit
-            convert_osgb(input, output, tile_config, enable_simplify, enable_texture_compress, enable_draco, true);
+            let origin = read_osgb_origin(std::path::Path::new(input), tile_config);
+            let settings = osgb::BatchSettings {
+                tile: osgb::TileSettings {
+                    center_x: origin.center_x,
+                    center_y: origin.center_y,
+                    max_lvl: origin.max_lvl.unwrap_or(100),
+                    normals_mode,
+                    geometric_error_scale,
+                    draco_error_fraction,
+                    draco_encoding_speed,
+                    draco_decoding_speed,
+                    enable_texture_compress,
+                    enable_meshopt: enable_simplify,
+                    enable_draco,
+                    // osgb默认开启material_unlit
+                    enable_unlit: true,
+                    enable_fast_reader,
+                    enable_optimize_mesh,
+                    enable_meshopt_compression,
+                    enable_quantize,
+                },
+                region_offset: origin.trans_region,
+                enu_offset: origin.enu_offset,
+                origin_height: origin.origin_height,
+                num_threads,
+                enable_incremental,
+                memory_budget,
+                group_branching,
+                group_depth,
+                hlod,
+                min_tile_kb,
+                max_tile_kb,
+                prefetch_mb,
+            };
+            convert_osgb(input, output, &settings);
         }
         "shape" => {
-            convert_shapefile(
-                input,
-                output,
-                height_field,
+            let settings = shape::ShapeSettings {
+                geometric_error_scale,
+                draco_error_fraction,
+                draco_encoding_speed,
+                draco_decoding_speed,
                 enable_lod,
                 enable_simplify,
                 enable_draco,
-            );
+                enable_optimize_mesh,
+                enable_meshopt_compression,
+                enable_quantize,
+            };
+            convert_shapefile(input, output, height_field, &settings);
         }
         "gltf" => {
             convert_gltf(input, output);
@@ -290,19 +682,25 @@ fn main() {
             convert_b3dm(input, output);
         }
         "fbx" => {
-            convert_fbx_cmd(
-                input,
-                output,
-                tile_config,
+            let origin = read_fbx_origin(tile_config, lat_val, lon_val, alt_val);
+            let settings = fbx::FbxSettings {
+                max_lvl: origin.max_lvl,
+                longitude: origin.longitude,
+                latitude: origin.latitude,
+                height: origin.height,
+                geometric_error_scale,
+                draco_error_fraction,
+                draco_encoding_speed,
+                draco_decoding_speed,
                 enable_texture_compress,
-                enable_simplify,
+                enable_meshopt: enable_simplify,
                 enable_draco,
                 enable_unlit,
-                enable_lod,
-                lat_val,
-                lon_val,
-                alt_val,
-            );
+                enable_optimize_mesh,
+                enable_meshopt_compression,
+                enable_quantize,
+            };
+            convert_fbx_cmd(input, output, &settings, enable_lod);
         }
         _ => {
             error!("not support now.");
@@ -310,19 +708,17 @@ fn main() {
     }
 }
 
-fn convert_fbx_cmd(
-    input: &str,
-    output: &str,
-    config: &str,
-    enable_texture_compress: bool,
-    enable_simplify: bool,
-    enable_draco: bool,
-    enable_unlit: bool,
-    enable_lod: bool,
-    lat: Option<f64>,
-    lon: Option<f64>,
-    height: Option<f64>,
-) {
+/// Origin and depth of an FBX conversion, see read_fbx_origin()
+struct FbxOrigin {
+    max_lvl: Option<i32>,
+    longitude: f64,
+    latitude: f64,
+    height: f64,
+}
+
+/// Origin of the --lat, --lon and --alt arguments, the config json filling
+/// the ones not given, 0 for the rest
+fn read_fbx_origin(config: &str, lat: Option<f64>, lon: Option<f64>, height: Option<f64>) -> FbxOrigin {
     use serde_json::Value;
 
     let mut max_lvl: Option<i32> = None;
@@ -358,25 +754,22 @@ fn convert_fbx_cmd(
             error!("config is not valid json");
         }
     }
+    FbxOrigin {
+        max_lvl,
+        longitude,
+        latitude,
+        height: height_f,
+    }
+}
 
+fn convert_fbx_cmd(input: &str, output: &str, settings: &fbx::FbxSettings, enable_lod: bool) {
     info!("Starting FBX conversion: {} -> {}", input, output);
-    info!("Origin: lon={}, lat={}, height={}", longitude, latitude, height_f);
+    info!("Origin: lon={}, lat={}, height={}", settings.longitude, settings.latitude, settings.height);
     if enable_lod {
         warn!("LOD is not supported for FBX; flag will be ignored");
     }
 
-    if let Err(e) = fbx::convert_fbx(
-        input,
-        output,
-        max_lvl,
-        enable_texture_compress,
-        enable_simplify,
-        enable_draco,
-        enable_unlit,
-        longitude,
-        latitude,
-        height_f,
-    ) {
+    if let Err(e) = fbx::convert_fbx(input, output, settings) {
         error!("FBX conversion failed: {}", e);
     } else {
         info!("FBX conversion finished successfully.");
@@ -458,14 +851,20 @@ struct ModelMetadata {
     pub SRSOrigin: String,
 }
 
-fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enable_texture_compress: bool, enable_draco: bool, enable_unlit: bool) {
+/// Georeference of an OSGB dataset, from its metadata.xml and the -c config
+struct OsgbOrigin {
+    center_x: f64,
+    center_y: f64,
+    max_lvl: Option<i32>,
+    trans_region: Option<f64>,
+    enu_offset: Option<(f64, f64, f64)>,
+    origin_height: Option<f64>,
+}
+
+fn read_osgb_origin(dir: &std::path::Path, config: &str) -> OsgbOrigin {
     use serde_json::Value;
     use std::fs::File;
     use std::io::prelude::*;
-    use std::time;
-
-    let dir = std::path::Path::new(src);
-    let dir_dest = std::path::Path::new(dest);
 
     let mut center_x = 0f64;
     let mut center_y = 0f64;
@@ -694,12 +1093,24 @@ fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enab
     } else if config.len() > 0 {
         error!("config error --> {}", config);
     }
+    OsgbOrigin {
+        center_x,
+        center_y,
+        max_lvl,
+        trans_region,
+        enu_offset,
+        origin_height,
+    }
+}
+
+fn convert_osgb(src: &str, dest: &str, settings: &osgb::BatchSettings) {
+    use std::time;
+
+    let dir = std::path::Path::new(src);
+    let dir_dest = std::path::Path::new(dest);
+
     let tick = time::SystemTime::now();
-    if let Err(e) = osgb::osgb_batch_convert(
-        &dir, &dir_dest, max_lvl,
-        center_x, center_y, trans_region,
-        enu_offset, origin_height, enable_texture_compress, enable_simplify, enable_draco, enable_unlit)
-    {
+    if let Err(e) = osgb::osgb_batch_convert(&dir, &dir_dest, settings) {
         error!("{}", e);
         return;
     }
@@ -708,28 +1119,137 @@ fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enab
     info!("task over, cost {:.2} s.", tick_num);
 }
 
-fn convert_shapefile(
-    src: &str,
-    dest: &str,
-    height: &str,
-    enable_lod: bool,
-    enable_simplify: bool,
-    enable_draco: bool,
-) {
+/// OsgbNormalsMode of the --normals value, None for an unknown one
+fn parse_normals_mode(value: Option<&String>) -> Option<i32> {
+    match value.map(|s| s.as_str()) {
+        None => Some(0),
+        Some("keep") => Some(1),
+        Some("generate") => Some(2),
+        Some("strip") => Some(3),
+        Some(x) => {
+            error!("unknown --normals mode {}, expected keep, generate or strip", x);
+            None
+        }
+    }
+}
+
+/// --draco-encoding-speed and --draco-decoding-speed, None for a value outside 0-10
+fn parse_draco_speeds(matches: &clap::ArgMatches) -> Option<(i32, i32)> {
+    let parse = |name: &str| match matches.get_one::<String>(name) {
+        None => Some(5),
+        Some(s) => match s.parse::<i32>() {
+            Ok(x) if (0..=10).contains(&x) => Some(x),
+            _ => {
+                error!("invalid --{} {}, expected 0-10", name, s);
+                None
+            }
+        },
+    };
+    Some((parse("draco-encoding-speed")?, parse("draco-decoding-speed")?))
+}
+
+/// --draco-error-fraction, negative values are taken as 0
+fn parse_draco_error_fraction(matches: &clap::ArgMatches) -> f64 {
+    matches
+        .get_one::<String>("draco-error-fraction")
+        .and_then(|s| s.parse::<f64>().ok())
+        .unwrap_or(0.05)
+        .max(0.0)
+}
+
+/// (enable_draco, enable_meshopt_compression) of --mesh-compression, which
+/// overrides --enable-draco; None for an unknown codec
+fn parse_mesh_compression(matches: &clap::ArgMatches) -> Option<(bool, bool)> {
+    match matches.get_one::<String>("mesh-compression").map(|s| s.as_str()) {
+        None => Some((matches.get_flag("enable-draco"), false)),
+        Some("draco") => Some((true, false)),
+        Some("meshopt") => Some((false, true)),
+        Some("none") => Some((false, false)),
+        Some(x) => {
+            error!("unknown --mesh-compression {}, expected draco, meshopt or none", x);
+            None
+        }
+    }
+}
+
+fn serve_osgb(matches: &clap::ArgMatches) {
+    let input = matches.get_one::<String>("input").unwrap();
+    let config = matches
+        .get_one::<String>("config")
+        .map(|s| s.as_str())
+        .unwrap_or("");
+    let normals_mode = match parse_normals_mode(matches.get_one::<String>("normals")) {
+        Some(x) => x,
+        None => return,
+    };
+    let (draco_encoding_speed, draco_decoding_speed) = match parse_draco_speeds(matches) {
+        Some(x) => x,
+        None => return,
+    };
+    let (enable_draco, enable_meshopt_compression) = match parse_mesh_compression(matches) {
+        Some(x) => x,
+        None => return,
+    };
+    let dir = std::path::Path::new(input);
+    let origin = read_osgb_origin(dir, config);
+    let num_threads = matches
+        .get_one::<String>("threads")
+        .and_then(|s| s.parse::<usize>().ok())
+        .unwrap_or_else(|| std::thread::available_parallelism().map_or(4, |x| x.get()));
+    let options = serve::ServeOptions {
+        input: dir.to_path_buf(),
+        cache_dir: matches.get_one::<String>("output").map(std::path::PathBuf::from),
+        port: matches
+            .get_one::<String>("port")
+            .and_then(|s| s.parse::<u16>().ok())
+            .unwrap_or(8000),
+        cache_mb: matches
+            .get_one::<String>("cache-mb")
+            .and_then(|s| s.parse::<u64>().ok())
+            .unwrap_or(512),
+        disk_cache_mb: matches
+            .get_one::<String>("disk-cache-mb")
+            .and_then(|s| s.parse::<u64>().ok())
+            .unwrap_or(0),
+        num_threads,
+        region_offset: origin.trans_region,
+        enu_offset: origin.enu_offset,
+        origin_height: origin.origin_height,
+        settings: osgb::TileSettings {
+            center_x: origin.center_x,
+            center_y: origin.center_y,
+            max_lvl: origin.max_lvl.unwrap_or(100),
+            normals_mode,
+            geometric_error_scale: matches
+                .get_one::<String>("geometric-error-scale")
+                .and_then(|s| s.parse::<f64>().ok())
+                .unwrap_or(1.0),
+            draco_error_fraction: parse_draco_error_fraction(matches),
+            draco_encoding_speed,
+            draco_decoding_speed,
+            enable_texture_compress: matches.get_flag("enable-texture-compress"),
+            enable_meshopt: matches.get_flag("enable-simplify"),
+            enable_draco,
+            enable_unlit: true,
+            enable_fast_reader: matches.get_flag("fast-osgb"),
+            enable_optimize_mesh: matches.get_flag("optimize-mesh"),
+            enable_meshopt_compression,
+            enable_quantize: matches.get_flag("quantize"),
+        },
+    };
+    if let Err(e) = serve::serve(options) {
+        error!("{}", e);
+    }
+}
+
+fn convert_shapefile(src: &str, dest: &str, height: &str, settings: &shape::ShapeSettings) {
     if height.is_empty() {
         error!("you must set the height field by --height xxx");
         return;
     }
     let tick = std::time::SystemTime::now();
 
-    let ret = shape::shape_batch_convert(
-        src,
-        dest,
-        height,
-        enable_lod,
-        enable_simplify,
-        enable_draco,
-    );
+    let ret = shape::shape_batch_convert(src, dest, height, settings);
     if !ret {
         error!("convert shapefile failed");
     } else {
@@ -1,11 +1,22 @@
 #include "mesh_processor.h"
 #include <basisu/encoder/basisu_enc.h>
 #include <cstddef>
+#include <cfloat>
+#include <cmath>
 #include <osg/Texture>
 #include <osg/Image>
 #include <osg/Array>
+#include <osg/TriangleIndexFunctor>
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+#include <tiny_gltf.h>
+#include <nlohmann/json.hpp>
 
 // Add Basis Universal includes for KTX2 compression
 #include <basisu/encoder/basisu_comp.h>
@@ -246,18 +257,22 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
     return false;
 }
 
-// Function to optimize and simplify mesh data using meshoptimizer
-bool optimize_and_simplify_mesh(
-    std::vector<VertexData>& vertices,
-    size_t& vertex_count,
-    std::vector<unsigned int>& indices,
-    size_t original_index_count,
-    std::vector<unsigned int>& simplified_indices,
-    size_t& simplified_index_count,
-    const SimplificationParams& params) {
-
-    // Calculate target index count based on ratio
-    size_t target_index_count = static_cast<size_t>(original_index_count * params.target_ratio);
+// Function to simplify an index buffer over a vertex buffer of
+// optimize_and_simplify_mesh towards target_index_count
+size_t simplify_mesh_indices(
+    const std::vector<VertexData>& vertices,
+    const unsigned int* indices,
+    size_t index_count,
+    size_t target_index_count,
+    const SimplificationParams& params,
+    unsigned int* destination,
+    float* result_error) {
+
+    size_t vertex_count = vertices.size();
+    float ignored_error = 0;
+    if (!result_error) {
+        result_error = &ignored_error;
+    }
 
     // Auto-detect if normals are present by checking if any vertex has non-zero normals
     bool hasNormals = false;
@@ -270,6 +285,92 @@ bool optimize_and_simplify_mesh(
         }
     }
 
+    // Same for texture coordinates
+    bool hasTexCoords = false;
+    if (params.preserve_texture_coords && vertex_count > 0) {
+        for (size_t i = 0; i < vertex_count; ++i) {
+            if (vertices[i].u != 0.0f || vertices[i].v != 0.0f) {
+                hasTexCoords = true;
+                break;
+            }
+        }
+    }
+
+    size_t simplified_index_count = 0;
+    if (params.mode == SIMPLIFY_SLOPPY) {
+        // Coarse levels: no error bound, only the triangle budget
+        simplified_index_count = meshopt_simplifySloppy(
+            destination,
+            indices,
+            index_count,
+            &vertices[0].x,
+            vertex_count,
+            sizeof(VertexData),
+#if MESHOPTIMIZER_VERSION >= 240
+            nullptr,                  // No locked vertex
+#endif
+            target_index_count,
+            FLT_MAX,
+            result_error
+        );
+    } else if (hasNormals || hasTexCoords) {
+        // Normals (nx, ny, nz) and texture coordinates (u, v) follow each
+        // other in VertexData, UV seams weigh more than shading
+        float attribute_weights[5] = {0.5f, 0.5f, 0.5f, 1.0f, 1.0f};
+        const float* attributes = hasNormals ? &vertices[0].nx : &vertices[0].u;
+        const float* weights = hasNormals ? attribute_weights : attribute_weights + 3;
+        size_t attribute_count = (hasNormals ? 3 : 0) + (hasTexCoords ? 2 : 0);
+
+        simplified_index_count = meshopt_simplifyWithAttributes(
+            destination,
+            indices,
+            index_count,
+            &vertices[0].x,          // Position data
+            vertex_count,
+            sizeof(VertexData),       // Stride between positions
+            attributes,
+            sizeof(VertexData),       // Stride between attributes
+            weights,
+            attribute_count,
+            nullptr,
+            target_index_count,
+            params.target_error,
+            0,
+            result_error
+        );
+    } else {
+        // No attributes - use standard simplification
+        simplified_index_count = meshopt_simplify(
+            destination,
+            indices,
+            index_count,
+            &vertices[0].x,
+            vertex_count,
+            sizeof(VertexData),
+            target_index_count,
+            params.target_error,
+            0,
+            result_error
+        );
+    }
+
+    return simplified_index_count;
+}
+
+// Function to optimize and simplify mesh data using meshoptimizer
+bool optimize_and_simplify_mesh(
+    std::vector<VertexData>& vertices,
+    size_t& vertex_count,
+    std::vector<unsigned int>& indices,
+    size_t original_index_count,
+    std::vector<unsigned int>& simplified_indices,
+    size_t& simplified_index_count,
+    const SimplificationParams& params,
+    float* result_error) {
+
+    // Calculate target index count based on ratio
+    size_t target_index_count = static_cast<size_t>(original_index_count * params.target_ratio);
+
     // ============================================================================
     // Step 1: Generate vertex remap to remove duplicate vertices
     // ============================================================================
@@ -346,45 +447,9 @@ bool optimize_and_simplify_mesh(
     // Allocate memory for simplified indices (worst case scenario)
     simplified_indices.resize(original_index_count);
 
-    // Use meshopt_simplifyWithAttributes to preserve normals during simplification
-    float result_error = 0;
-
-    if (hasNormals) {
-        // Normal weights for each component (nx, ny, nz)
-        float attribute_weights[3] = {0.5f, 0.5f, 0.5f};
-
-        simplified_index_count = meshopt_simplifyWithAttributes(
-            simplified_indices.data(),
-            indices.data(),
-            original_index_count,
-            &vertices[0].x,          // Position data
-            vertex_count,
-            sizeof(VertexData),       // Stride between positions
-            &vertices[0].nx,          // Normal data
-            sizeof(VertexData),       // Stride between normals
-            attribute_weights,
-            3,                        // 3 normal components
-            nullptr,
-            target_index_count,
-            params.target_error,
-            0,
-            &result_error
-        );
-    } else {
-        // No normals - use standard simplification
-        simplified_index_count = meshopt_simplify(
-            simplified_indices.data(),
-            indices.data(),
-            original_index_count,
-            &vertices[0].x,
-            vertex_count,
-            sizeof(VertexData),
-            target_index_count,
-            params.target_error,
-            0,
-            &result_error
-        );
-    }
+    simplified_index_count = simplify_mesh_indices(
+        vertices, indices.data(), original_index_count, target_index_count, params,
+        simplified_indices.data(), result_error);
 
     // Resize to actual simplified size
     simplified_indices.resize(simplified_index_count);
@@ -392,8 +457,56 @@ bool optimize_and_simplify_mesh(
     return true;
 }
 
+namespace {
+struct TriangleIndexCollector {
+    std::vector<unsigned int>* indices = nullptr;
+    void operator()(unsigned int i1, unsigned int i2, unsigned int i3) {
+        indices->push_back(i1);
+        indices->push_back(i2);
+        indices->push_back(i3);
+    }
+};
+}
+
+// Triangle list of every primitive set of the geometry: triangles, strips,
+// fans, quads and polygons. False when a set holds points or lines, or an
+// index is out of the vertex array.
+static bool gather_triangle_indices(osg::Geometry* geometry, std::vector<unsigned int>& indices) {
+    osg::Array* vertexArray = geometry->getVertexArray();
+    if (!vertexArray || geometry->getNumPrimitiveSets() == 0) {
+        return false;
+    }
+    for (unsigned int k = 0; k < geometry->getNumPrimitiveSets(); ++k) {
+        GLenum mode = geometry->getPrimitiveSet(k)->getMode();
+        if (mode != GL_TRIANGLES && mode != GL_TRIANGLE_STRIP && mode != GL_TRIANGLE_FAN
+            && mode != GL_QUADS && mode != GL_QUAD_STRIP && mode != GL_POLYGON) {
+            return false;
+        }
+    }
+    osg::TriangleIndexFunctor<TriangleIndexCollector> collector;
+    indices.clear();
+    collector.indices = &indices;
+    geometry->accept(collector);
+    for (auto idx : indices) {
+        if (idx >= vertexArray->getNumElements()) {
+            return false;
+        }
+    }
+    return !indices.empty();
+}
+
+// Replaces the primitive sets of the geometry by one GL_TRIANGLES set
+static void set_triangle_indices(osg::Geometry* geometry, const std::vector<unsigned int>& indices) {
+    geometry->removePrimitiveSet(0, geometry->getNumPrimitiveSets());
+    if (geometry->getVertexArray()->getNumElements() <= std::numeric_limits<unsigned short>::max() + 1u) {
+        geometry->addPrimitiveSet(new osg::DrawElementsUShort(GL_TRIANGLES, indices.begin(), indices.end()));
+    } else {
+        geometry->addPrimitiveSet(new osg::DrawElementsUInt(GL_TRIANGLES, indices.begin(), indices.end()));
+    }
+}
+
 // Function to simplify mesh geometry using meshoptimizer
-bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams& params) {
+bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams& params, float* out_error) {
     if (!params.enable_simplification || !geometry) {
         return false;
     }
@@ -404,16 +517,12 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
         return false;
     }
 
-    // Get index array (we need to handle different primitive set types)
-    if (geometry->getNumPrimitiveSets() == 0) {
-        return false;
-    }
-
-    // For now, we'll only handle the first primitive set
-    osg::PrimitiveSet* primitiveSet = geometry->getPrimitiveSet(0);
-    if (!primitiveSet) {
+    // All the triangle-like primitive sets are simplified as one mesh
+    std::vector<unsigned int> indices;
+    if (!gather_triangle_indices(geometry, indices)) {
         return false;
     }
+    size_t original_index_count = indices.size();
 
     // Get vertex attributes
     size_t vertex_count = vertexArray->size();
@@ -459,55 +568,6 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
         }
     }
 
-    // Handle different primitive set types
-    std::vector<unsigned int> indices;
-    size_t original_index_count = 0;
-
-    switch (primitiveSet->getType()) {
-        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType: {
-            const osg::DrawElementsUByte* drawElements = static_cast<const osg::DrawElementsUByte*>(primitiveSet);
-            original_index_count = drawElements->size();
-            indices.resize(original_index_count);
-            for (size_t i = 0; i < original_index_count; ++i) {
-                indices[i] = static_cast<unsigned int>(drawElements->at(i));
-            }
-            break;
-        }
-        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType: {
-            const osg::DrawElementsUShort* drawElements = static_cast<const osg::DrawElementsUShort*>(primitiveSet);
-            original_index_count = drawElements->size();
-            indices.resize(original_index_count);
-            for (size_t i = 0; i < original_index_count; ++i) {
-                indices[i] = static_cast<unsigned int>(drawElements->at(i));
-            }
-            break;
-        }
-        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType: {
-            const osg::DrawElementsUInt* drawElements = static_cast<const osg::DrawElementsUInt*>(primitiveSet);
-            original_index_count = drawElements->size();
-            indices.resize(original_index_count);
-            for (size_t i = 0; i < original_index_count; ++i) {
-                indices[i] = drawElements->at(i);
-            }
-            break;
-        }
-        case osg::PrimitiveSet::DrawArraysPrimitiveType: {
-            // For DrawArrays, we need to create indices
-            osg::DrawArrays* drawArrays = static_cast<osg::DrawArrays*>(primitiveSet);
-            unsigned int first = drawArrays->getFirst();
-            unsigned int count = drawArrays->getCount();
-            original_index_count = count;
-            indices.resize(count);
-            for (unsigned int i = 0; i < count; ++i) {
-                indices[i] = first + i;
-            }
-            break;
-        }
-        default:
-            // Unsupported primitive type
-            return false;
-    }
-
     // Calculate target index count based on ratio
     size_t target_index_count = static_cast<size_t>(original_index_count * params.target_ratio);
 
@@ -515,14 +575,20 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
     std::vector<unsigned int> simplified_indices;
     size_t simplified_index_count = 0;
 
+    float result_error = 0.0f;
     if (!optimize_and_simplify_mesh(
             vertices, vertex_count,
             indices, original_index_count,
             simplified_indices, simplified_index_count,
-            params)) {
+            params, &result_error)) {
         return false;
     }
 
+    // meshoptimizer errors are relative to the mesh extent
+    if (out_error) {
+        *out_error = result_error * meshopt_simplifyScale(&vertices[0].x, vertex_count, sizeof(VertexData));
+    }
+
     osg::ref_ptr<osg::Vec3Array> newVertexArray = new osg::Vec3Array();
     newVertexArray->reserve(vertex_count);
 
@@ -554,46 +620,122 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
         geometry->setTexCoordArray(0, newTexCoordArray);
     }
 
-    // Create new primitive set with simplified indices
-    switch (primitiveSet->getType()) {
-        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType: {
-            osg::DrawElementsUByte* newDrawElements = new osg::DrawElementsUByte(primitiveSet->getMode());
-            for (size_t i = 0; i < simplified_index_count; ++i) {
-                newDrawElements->push_back(static_cast<osg::DrawElementsUByte::value_type>(simplified_indices[i]));
-            }
-            geometry->setPrimitiveSet(0, newDrawElements);
-            break;
-        }
-        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType: {
-            osg::DrawElementsUShort* newDrawElements = new osg::DrawElementsUShort(primitiveSet->getMode());
-            for (size_t i = 0; i < simplified_index_count; ++i) {
-                newDrawElements->push_back(static_cast<osg::DrawElementsUShort::value_type>(simplified_indices[i]));
-            }
-            geometry->setPrimitiveSet(0, newDrawElements);
-            break;
-        }
-        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType: {
-            osg::DrawElementsUInt* newDrawElements = new osg::DrawElementsUInt(primitiveSet->getMode());
-            for (size_t i = 0; i < simplified_index_count; ++i) {
-                newDrawElements->push_back(simplified_indices[i]);
-            }
-            geometry->setPrimitiveSet(0, newDrawElements);
-            break;
-        }
-        case osg::PrimitiveSet::DrawArraysPrimitiveType: {
-            // For DrawArrays, we need to create a new DrawElements
-            osg::DrawElementsUInt* newDrawElements = new osg::DrawElementsUInt(primitiveSet->getMode());
-            for (size_t i = 0; i < simplified_index_count; ++i) {
-                newDrawElements->push_back(simplified_indices[i]);
-            }
-            geometry->setPrimitiveSet(0, newDrawElements);
-            break;
-        }
+    // Create one primitive set with the simplified indices
+    simplified_indices.resize(simplified_index_count);
+    set_triangle_indices(geometry, simplified_indices);
+
+    return true;
+}
+
+size_t optimize_mesh_buffers(std::vector<unsigned int>& indices,
+                             const std::vector<MeshAttributeStream>& streams, size_t vertex_count) {
+    if (indices.empty() || streams.empty() || vertex_count == 0 || indices.size() % 3 != 0) {
+        return 0;
+    }
+
+    // Step 1: weld vertices equal in every stream, drop unreferenced ones
+    std::vector<meshopt_Stream> meshopt_streams;
+    for (const auto& stream : streams) {
+        meshopt_streams.push_back({ stream.data, stream.stride, stream.stride });
+    }
+    std::vector<unsigned int> remap(vertex_count);
+    size_t unique_vertex_count = meshopt_generateVertexRemapMulti(
+        remap.data(), indices.data(), indices.size(), vertex_count,
+        meshopt_streams.data(), meshopt_streams.size());
+    meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+    for (const auto& stream : streams) {
+        meshopt_remapVertexBuffer(stream.data, stream.data, vertex_count, stream.stride, remap.data());
+    }
+
+    // Step 2-3: triangle order for the vertex cache, then overdraw
+    meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), unique_vertex_count);
+    meshopt_optimizeOverdraw(indices.data(), indices.data(), indices.size(),
+                             static_cast<const float*>(streams[0].data), unique_vertex_count,
+                             streams[0].stride, 1.05f);
+
+    // Step 4: vertex order for fetch, applied to every stream
+    size_t fetch_vertex_count = meshopt_optimizeVertexFetchRemap(
+        remap.data(), indices.data(), indices.size(), unique_vertex_count);
+    meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+    for (const auto& stream : streams) {
+        meshopt_remapVertexBuffer(stream.data, stream.data, unique_vertex_count, stream.stride, remap.data());
+    }
+    return fetch_vertex_count;
+}
+
+bool optimize_mesh_geometry(osg::Geometry* geometry) {
+    if (!geometry || geometry->getNumPrimitiveSets() == 0) {
+        return false;
+    }
+    osg::Vec3Array* vertexArray = dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
+    if (!vertexArray || vertexArray->empty()) {
+        return false;
+    }
+    const size_t vertex_count = vertexArray->size();
+
+    // Only positions, normals and the first texture coordinates are carried
+    // along, other per-vertex arrays would be left out of order
+    if ((geometry->getColorArray() && geometry->getColorBinding() == osg::Geometry::BIND_PER_VERTEX)
+        || geometry->getSecondaryColorArray() || geometry->getFogCoordArray()
+        || geometry->getNumTexCoordArrays() > 1 || geometry->getNumVertexAttribArrays() > 0) {
+        return false;
+    }
+    osg::Vec3Array* normalArray = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
+    if (geometry->getNormalArray() && (!normalArray || normalArray->size() != vertex_count
+        || geometry->getNormalBinding() != osg::Geometry::BIND_PER_VERTEX)) {
+        return false;
+    }
+    osg::Vec2Array* texCoordArray = dynamic_cast<osg::Vec2Array*>(geometry->getTexCoordArray(0));
+    if (geometry->getTexCoordArray(0) && (!texCoordArray || texCoordArray->size() != vertex_count)) {
+        return false;
     }
 
+    std::vector<unsigned int> indices;
+    if (!gather_triangle_indices(geometry, indices)) {
+        return false;
+    }
+
+    // Work on copies, the arrays may be shared with other geometries
+    osg::ref_ptr<osg::Vec3Array> newVertexArray = new osg::Vec3Array(vertexArray->begin(), vertexArray->end());
+    osg::ref_ptr<osg::Vec3Array> newNormalArray = normalArray ? new osg::Vec3Array(normalArray->begin(), normalArray->end()) : nullptr;
+    osg::ref_ptr<osg::Vec2Array> newTexCoordArray = texCoordArray ? new osg::Vec2Array(texCoordArray->begin(), texCoordArray->end()) : nullptr;
+    std::vector<MeshAttributeStream> streams = { { &(*newVertexArray)[0], sizeof(osg::Vec3) } };
+    if (newNormalArray) {
+        streams.push_back({ &(*newNormalArray)[0], sizeof(osg::Vec3) });
+    }
+    if (newTexCoordArray) {
+        streams.push_back({ &(*newTexCoordArray)[0], sizeof(osg::Vec2) });
+    }
+    size_t optimized_count = optimize_mesh_buffers(indices, streams, vertex_count);
+    if (optimized_count == 0) {
+        return false;
+    }
+
+    newVertexArray->resize(optimized_count);
+    geometry->setVertexArray(newVertexArray.get());
+    if (newNormalArray) {
+        newNormalArray->resize(optimized_count);
+        geometry->setNormalArray(newNormalArray.get(), osg::Array::BIND_PER_VERTEX);
+    }
+    if (newTexCoordArray) {
+        newTexCoordArray->resize(optimized_count);
+        geometry->setTexCoordArray(0, newTexCoordArray.get());
+    }
+    set_triangle_indices(geometry, indices);
     return true;
 }
 
+// Smallest Draco position quantization keeping the error of a mesh spanning
+// range below max_error: Draco splits the largest extent into 2^bits - 1
+// steps, a position moves by half a step at most
+static int position_bits_for_error(double range, double max_error) {
+    int bits = 8;
+    while (bits < 16 && range / (double)((1u << bits) - 1) > 2.0 * max_error) {
+        bits++;
+    }
+    return bits;
+}
+
 // Function to compress mesh geometry using Draco
 bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParams& params,
                            std::vector<unsigned char>& compressed_data, size_t& compressed_size,
@@ -610,6 +752,12 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
         return false;
     }
 
+    // All the triangle-like primitive sets are encoded as one mesh
+    std::vector<unsigned int> indices;
+    if (!gather_triangle_indices(geometry, indices)) {
+        return false;
+    }
+
     // Create Draco mesh
     std::unique_ptr<draco::Mesh> dracoMesh(new draco::Mesh());
 
@@ -623,12 +771,9 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
     int posAttId = dracoMesh->AddAttribute(posAttr, true, vertexCount);
     if (out_position_att_id) *out_position_att_id = posAttId;
 
-    // Copy vertex positions
-    for (size_t i = 0; i < vertexCount; ++i) {
-        const osg::Vec3& vertex = vertexArray->at(i);
-        const float pos[3] = { static_cast<float>(vertex.x()), static_cast<float>(vertex.y()), static_cast<float>(vertex.z()) };
-        dracoMesh->attribute(posAttId)->SetAttributeValue(draco::AttributeValueIndex(i), &pos[0]);
-    }
+    // Copy vertex positions; the osg arrays are tightly packed floats, so
+    // every attribute is uploaded with one write
+    dracoMesh->attribute(posAttId)->buffer()->Write(0, &vertexArray->front(), vertexCount * sizeof(osg::Vec3));
 
     // Handle normals if present
     osg::Vec3Array* normalArray = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
@@ -639,11 +784,7 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
         if (out_normal_att_id) *out_normal_att_id = normalAttId;
 
         // Copy normals
-        for (size_t i = 0; i < vertexCount; ++i) {
-            const osg::Vec3& normal = normalArray->at(i);
-            const float norm[3] = { static_cast<float>(normal.x()), static_cast<float>(normal.y()), static_cast<float>(normal.z()) };
-            dracoMesh->attribute(normalAttId)->SetAttributeValue(draco::AttributeValueIndex(i), &norm[0]);
-        }
+        dracoMesh->attribute(normalAttId)->buffer()->Write(0, &normalArray->front(), vertexCount * sizeof(osg::Vec3));
     }
 
     // Handle texture coordinates if present
@@ -654,58 +795,55 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
         int uvAttId = dracoMesh->AddAttribute(uvAttr, true, vertexCount);
         if (out_texcoord_att_id) *out_texcoord_att_id = uvAttId;
 
-        for (size_t i = 0; i < vertexCount; ++i) {
-            const osg::Vec2& uv = texCoordArray->at(i);
-            const float tex[2] = { static_cast<float>(uv.x()), static_cast<float>(uv.y()) };
-            dracoMesh->attribute(uvAttId)->SetAttributeValue(draco::AttributeValueIndex(i), &tex[0]);
-        }
+        dracoMesh->attribute(uvAttId)->buffer()->Write(0, &texCoordArray->front(), vertexCount * sizeof(osg::Vec2));
     }
 
     // Handle Batch IDs if present
+    int batchIdBits = 0;
     if (batchIds && batchIds->size() == vertexCount) {
         draco::GeometryAttribute batchIdAttr;
         batchIdAttr.Init(draco::GeometryAttribute::GENERIC, nullptr, 1, draco::DT_FLOAT32, false, sizeof(float), 0);
         int batchIdAttId = dracoMesh->AddAttribute(batchIdAttr, true, vertexCount);
         if (out_batchid_att_id) *out_batchid_att_id = batchIdAttId;
 
-        for (size_t i = 0; i < vertexCount; ++i) {
-            float val = (*batchIds)[i];
-            dracoMesh->attribute(batchIdAttId)->SetAttributeValue(draco::AttributeValueIndex(i), &val);
+        dracoMesh->attribute(batchIdAttId)->buffer()->Write(0, batchIds->data(), vertexCount * sizeof(float));
+
+        // Ids are integers: keep the quantization step at or below half an
+        // id so each one still decodes to within a quarter of itself
+        auto range = std::minmax_element(batchIds->begin(), batchIds->end());
+        double span = (double)*range.second - (double)*range.first;
+        batchIdBits = std::max(params.generic_quantization_bits, 1);
+        while (batchIdBits < 30 && (double)((1u << batchIdBits) - 1) < 2.0 * span) {
+            batchIdBits++;
         }
     }
 
-    // Handle primitive sets (indices)
-    if (geometry->getNumPrimitiveSets() > 0) {
-        osg::PrimitiveSet* primitiveSet = geometry->getPrimitiveSet(0);
-        unsigned int numIndices = primitiveSet->getNumIndices();
-
-        if (numIndices > 0) {
-            // Create faces for the mesh
-            std::vector<uint32_t> indices(numIndices);
-            for (unsigned int i = 0; i < numIndices; ++i) {
-                indices[i] = primitiveSet->index(i);
-            }
-
-            // Convert triangle list to faces
-            const size_t faceCount = numIndices / 3;
-            dracoMesh->SetNumFaces(faceCount);
-
-            for (size_t i = 0; i < faceCount; ++i) {
-                draco::Mesh::Face face;
-                face[0] = indices[i * 3];
-                face[1] = indices[i * 3 + 1];
-                face[2] = indices[i * 3 + 2];
-                dracoMesh->SetFace(draco::FaceIndex(i), face);
-            }
-        }
+    // Convert triangle list to faces
+    const size_t faceCount = indices.size() / 3;
+    dracoMesh->SetNumFaces(faceCount);
+    for (size_t i = 0; i < faceCount; ++i) {
+        draco::Mesh::Face face;
+        face[0] = indices[i * 3];
+        face[1] = indices[i * 3 + 1];
+        face[2] = indices[i * 3 + 2];
+        dracoMesh->SetFace(draco::FaceIndex(i), face);
     }
 
     // Encode the mesh
     draco::Encoder encoder;
 
     // Set encoding options
-    encoder.SetSpeedOptions(5, 5); // Default speed options
-    encoder.SetAttributeQuantization(draco::GeometryAttribute::POSITION, params.position_quantization_bits);
+    encoder.SetSpeedOptions(params.encoding_speed, params.decoding_speed);
+    int positionBits = params.position_quantization_bits;
+    if (params.position_max_error > 0.0) {
+        osg::BoundingBox box;
+        for (const auto& p : *vertexArray) {
+            box.expandBy(p);
+        }
+        double range = std::max({ box.xMax() - box.xMin(), box.yMax() - box.yMin(), box.zMax() - box.zMin() });
+        positionBits = position_bits_for_error(range, params.position_max_error);
+    }
+    encoder.SetAttributeQuantization(draco::GeometryAttribute::POSITION, positionBits);
 
     if (normalArray) {
         encoder.SetAttributeQuantization(draco::GeometryAttribute::NORMAL, params.normal_quantization_bits);
@@ -713,6 +851,9 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
     if (texCoordArray) {
         encoder.SetAttributeQuantization(draco::GeometryAttribute::TEX_COORD, params.tex_coord_quantization_bits);
     }
+    if (batchIdBits > 0) {
+        encoder.SetAttributeQuantization(draco::GeometryAttribute::GENERIC, batchIdBits);
+    }
 
     // Encode the mesh
     draco::EncoderBuffer buffer;
@@ -727,5 +868,547 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
     compressed_data.resize(compressed_size);
     std::memcpy(compressed_data.data(), buffer.data(), compressed_size);
 
+    // The glTF primitive written for the geometry must match the encoded faces
+    if (geometry->getNumPrimitiveSets() != 1 || geometry->getPrimitiveSet(0)->getMode() != GL_TRIANGLES) {
+        set_triangle_indices(geometry, indices);
+    }
+
+    return true;
+}
+
+namespace {
+// How write_meshopt_glb encodes one buffer view
+struct MeshoptView {
+    const char* mode = nullptr;           // "ATTRIBUTES", "TRIANGLES" or "INDICES", nullptr: kept as is
+    int accessor = -1;
+    size_t stride = 0;                    // Decoded element size
+    int index_type = 0;                   // Component type of the source indices
+    const char* filter = nullptr;         // "EXPONENTIAL" or "OCTAHEDRAL", nullptr: no filter
+    int filter_bits = 0;
+    bool shared_component = false;        // One exponent per component instead of per vector
+    bool position = false;
+};
+}
+
+// Number of accessors reading each buffer view of the model
+static std::vector<int> count_view_users(const tinygltf::Model& model) {
+    std::vector<int> users(model.bufferViews.size(), 0);
+    for (const auto& acc : model.accessors) {
+        if (acc.bufferView >= 0 && acc.bufferView < (int)users.size()) {
+            users[acc.bufferView]++;
+        }
+    }
+    return users;
+}
+
+// Exponential filter of float vectors, see meshopt_encodeFilterExp
+static void encode_filter_exp(void* destination, size_t count, size_t stride, int bits, const float* data,
+                              bool shared_component) {
+#if MESHOPTIMIZER_VERSION >= 200
+    meshopt_encodeFilterExp(destination, count, stride, bits, data,
+                            shared_component ? meshopt_EncodeExpSharedComponent : meshopt_EncodeExpSharedVector);
+#else
+    (void)shared_component;
+    meshopt_encodeFilterExp(destination, count, stride, bits, data);
+#endif
+}
+
+// Picks the encoding of the buffer view of an accessor used by a primitive
+static void classify_meshopt_view(tinygltf::Model& model, std::vector<MeshoptView>& views,
+                                  const std::vector<int>& users, int accessor_index,
+                                  const std::string& semantic, int primitive_mode,
+                                  const MeshoptCompressionParams& params) {
+    if (accessor_index < 0 || accessor_index >= (int)model.accessors.size()) {
+        return;
+    }
+    const tinygltf::Accessor& acc = model.accessors[accessor_index];
+    if (acc.bufferView < 0 || acc.bufferView >= (int)views.size() || users[acc.bufferView] != 1
+        || acc.byteOffset != 0 || acc.count == 0 || acc.sparse.isSparse) {
+        return;
+    }
+    const tinygltf::BufferView& bv = model.bufferViews[acc.bufferView];
+    const int component_size = tinygltf::GetComponentSizeInBytes(acc.componentType);
+    const int components = tinygltf::GetNumComponentsInType(acc.type);
+    if (component_size <= 0 || components <= 0) {
+        return;
+    }
+    const size_t element = (size_t)component_size * components;
+    const size_t stride = bv.byteStride != 0 ? bv.byteStride : element;
+    if (stride < element || bv.byteLength < acc.count * stride) {
+        return;
+    }
+
+    MeshoptView& view = views[acc.bufferView];
+    view.accessor = accessor_index;
+    if (semantic.empty()) {
+        if (stride != element) {
+            return;
+        }
+        // TRIANGLES only when every primitive drawing the indices is a triangle list
+        const bool triangles = primitive_mode == TINYGLTF_MODE_TRIANGLES && acc.count % 3 == 0;
+        if (!view.mode || !triangles) {
+            view.mode = triangles ? "TRIANGLES" : "INDICES";
+        }
+        view.index_type = acc.componentType;
+        view.stride = std::max<size_t>(2, element);
+        return;
+    }
+    if (stride % 4 != 0 || stride > 256) {
+        return;
+    }
+    view.mode = "ATTRIBUTES";
+    view.stride = stride;
+    if (semantic == "NORMAL" && acc.componentType == TINYGLTF_COMPONENT_TYPE_BYTE && acc.normalized
+        && components == 3 && stride == 4) {
+        // int8 normals of quantize_model decode from the octahedral filter as they are
+        view.filter = "OCTAHEDRAL";
+        view.filter_bits = 8;
+        return;
+    }
+    if (acc.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || stride != element) {
+        return;
+    }
+    if (semantic == "POSITION") {
+        view.filter_bits = params.position_bits;
+        view.shared_component = true;
+        view.position = true;
+    } else if (semantic == "NORMAL") {
+        view.filter_bits = params.normal_bits;
+    } else if (semantic.rfind("TEXCOORD_", 0) == 0) {
+        view.filter_bits = params.tex_coord_bits;
+        view.shared_component = true;
+    }
+    if (view.filter_bits > 0) {
+        view.filter = "EXPONENTIAL";
+    }
+}
+
+// Re-encodes the buffer views picked by classify_meshopt_view into a new
+// buffers[0]; the views then point into the fallback buffer, whose size is
+// returned (0: nothing encoded, the model is unchanged).
+static size_t meshopt_compress_model(tinygltf::Model& model, const MeshoptCompressionParams& params) {
+    if (model.buffers.size() != 1) {
+        return 0;
+    }
+    const std::vector<int> users = count_view_users(model);
+    std::vector<MeshoptView> views(model.bufferViews.size());
+    for (const auto& mesh : model.meshes) {
+        for (const auto& prim : mesh.primitives) {
+            if (prim.extensions.count("KHR_draco_mesh_compression")) {
+                continue;
+            }
+            for (const auto& attr : prim.attributes) {
+                classify_meshopt_view(model, views, users, attr.second, attr.first, prim.mode, params);
+            }
+            classify_meshopt_view(model, views, users, prim.indices, std::string(), prim.mode, params);
+        }
+    }
+    if (std::none_of(views.begin(), views.end(), [](const MeshoptView& v) { return v.mode != nullptr; })) {
+        return 0;
+    }
+
+    // EXT_meshopt_compression decoders know vertex codec 0 and index codec 1
+    static std::once_flag codec_versions;
+    std::call_once(codec_versions, []() {
+        meshopt_encodeVertexVersion(0);
+        meshopt_encodeIndexVersion(1);
+    });
+
+    const std::vector<unsigned char>& source = model.buffers[0].data;
+    const int fallback_buffer = (int)model.buffers.size();
+    std::vector<unsigned char> data;
+    std::vector<unsigned char> encoded;
+    size_t fallback_length = 0;
+    for (size_t i = 0; i < views.size(); ++i) {
+        tinygltf::BufferView& bv = model.bufferViews[i];
+        const MeshoptView& view = views[i];
+        if (bv.byteOffset + bv.byteLength > source.size()) {
+            continue;
+        }
+        data.resize((data.size() + 3) & ~size_t(3), 0);
+        const unsigned char* raw = source.data() + bv.byteOffset;
+        if (!view.mode) {
+            size_t offset = data.size();
+            data.insert(data.end(), raw, raw + bv.byteLength);
+            bv.byteOffset = offset;
+            continue;
+        }
+
+        tinygltf::Accessor& acc = model.accessors[view.accessor];
+        const size_t count = acc.count;
+        if (std::strcmp(view.mode, "ATTRIBUTES") != 0) {
+            std::vector<unsigned int> indices(count);
+            const int source_size = tinygltf::GetComponentSizeInBytes(view.index_type);
+            unsigned int max_index = 0;
+            for (size_t k = 0; k < count; ++k) {
+                uint32_t idx = 0;
+                if (source_size == 1) {
+                    idx = raw[k];
+                } else if (source_size == 2) {
+                    uint16_t v;
+                    std::memcpy(&v, raw + k * 2, 2);
+                    idx = v;
+                } else {
+                    std::memcpy(&idx, raw + k * 4, 4);
+                }
+                indices[k] = idx;
+                max_index = std::max(max_index, idx);
+            }
+            if (std::strcmp(view.mode, "TRIANGLES") == 0) {
+                encoded.resize(meshopt_encodeIndexBufferBound(count, max_index + 1));
+                encoded.resize(meshopt_encodeIndexBuffer(encoded.data(), encoded.size(), indices.data(), count));
+            } else {
+                encoded.resize(meshopt_encodeIndexSequenceBound(count, max_index + 1));
+                encoded.resize(meshopt_encodeIndexSequence(encoded.data(), encoded.size(), indices.data(), count));
+            }
+            // byte indices decode to the 2 bytes stride the codecs support
+            acc.componentType = view.stride == 2 ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT
+                                                 : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+        } else {
+            std::vector<unsigned char> vertices(raw, raw + count * view.stride);
+            if (view.filter && std::strcmp(view.filter, "OCTAHEDRAL") == 0) {
+                std::vector<float> values(count * 4, 0.0f);
+                for (size_t k = 0; k < count; ++k) {
+                    for (size_t c = 0; c < 3; ++c) {
+                        values[k * 4 + c] = (float)(int8_t)vertices[k * view.stride + c] / 127.0f;
+                    }
+                }
+                meshopt_encodeFilterOct(vertices.data(), count, view.stride, view.filter_bits, values.data());
+            } else if (view.filter) {
+                std::vector<float> values(count * view.stride / sizeof(float));
+                std::memcpy(values.data(), vertices.data(), vertices.size());
+                encode_filter_exp(vertices.data(), count, view.stride, view.filter_bits, values.data(),
+                                  view.shared_component);
+                if (view.position) {
+                    // bounds of the positions as the viewer decodes them
+                    std::memcpy(values.data(), vertices.data(), vertices.size());
+                    meshopt_decodeFilterExp(values.data(), count, view.stride);
+                    const size_t components = view.stride / sizeof(float);
+                    acc.minValues.assign(components, std::numeric_limits<double>::max());
+                    acc.maxValues.assign(components, std::numeric_limits<double>::lowest());
+                    for (size_t k = 0; k < values.size(); ++k) {
+                        acc.minValues[k % components] = std::min(acc.minValues[k % components], (double)values[k]);
+                        acc.maxValues[k % components] = std::max(acc.maxValues[k % components], (double)values[k]);
+                    }
+                }
+            }
+            encoded.resize(meshopt_encodeVertexBufferBound(count, view.stride));
+            encoded.resize(meshopt_encodeVertexBuffer(encoded.data(), encoded.size(), vertices.data(), count,
+                                                      view.stride));
+        }
+
+        size_t offset = data.size();
+        data.insert(data.end(), encoded.begin(), encoded.end());
+
+        tinygltf::Value::Object ext;
+        ext["buffer"] = tinygltf::Value(0);
+        ext["byteOffset"] = tinygltf::Value((int)offset);
+        ext["byteLength"] = tinygltf::Value((int)encoded.size());
+        ext["byteStride"] = tinygltf::Value((int)view.stride);
+        ext["count"] = tinygltf::Value((int)count);
+        ext["mode"] = tinygltf::Value(std::string(view.mode));
+        if (view.filter) {
+            ext["filter"] = tinygltf::Value(std::string(view.filter));
+        }
+        bv.extensions["EXT_meshopt_compression"] = tinygltf::Value(ext);
+
+        fallback_length = (fallback_length + 3) & ~size_t(3);
+        bv.buffer = fallback_buffer;
+        bv.byteOffset = fallback_length;
+        bv.byteLength = count * view.stride;
+        if (std::strcmp(view.mode, "ATTRIBUTES") == 0) {
+            bv.byteStride = view.stride;
+        }
+        fallback_length += bv.byteLength;
+    }
+    data.resize((data.size() + 3) & ~size_t(3), 0);
+    model.buffers[0].data.swap(data);
+
+    for (auto* list : { &model.extensionsUsed, &model.extensionsRequired }) {
+        if (std::find(list->begin(), list->end(), "EXT_meshopt_compression") == list->end()) {
+            list->push_back("EXT_meshopt_compression");
+        }
+    }
+    return fallback_length;
+}
+
+// Appends the fallback buffer of EXT_meshopt_compression to the JSON chunk
+// of a glb; tinygltf always writes buffer data, the fallback has none
+static bool append_glb_fallback_buffer(std::string& glb, size_t byte_length) {
+    if (glb.size() < 20) {
+        return false;
+    }
+    uint32_t json_length = 0;
+    std::memcpy(&json_length, glb.data() + 12, 4);
+    if (20 + (size_t)json_length > glb.size()) {
+        return false;
+    }
+    nlohmann::json gltf = nlohmann::json::parse(glb.begin() + 20, glb.begin() + 20 + json_length, nullptr, false);
+    if (gltf.is_discarded()) {
+        return false;
+    }
+    nlohmann::json fallback;
+    fallback["byteLength"] = byte_length;
+    fallback["extensions"]["EXT_meshopt_compression"]["fallback"] = true;
+    gltf["buffers"].push_back(fallback);
+
+    std::string json = gltf.dump();
+    json.resize((json.size() + 3) & ~size_t(3), ' ');
+    const std::string bin = glb.substr(20 + json_length);
+    const uint32_t chunk_length = (uint32_t)json.size();
+    const uint32_t total_length = (uint32_t)(20 + json.size() + bin.size());
+
+    std::string out;
+    out.reserve(total_length);
+    out.append(glb, 0, 8);
+    out.append(reinterpret_cast<const char*>(&total_length), 4);
+    out.append(reinterpret_cast<const char*>(&chunk_length), 4);
+    out.append("JSON", 4);
+    out.append(json);
+    out.append(bin);
+    glb.swap(out);
+    return true;
+}
+
+bool write_meshopt_glb(tinygltf::Model& model, std::string& glb, const MeshoptCompressionParams& params) {
+    const size_t fallback_length = meshopt_compress_model(model, params);
+
+    tinygltf::TinyGLTF gltf;
+    std::ostringstream ss;
+    if (!gltf.WriteGltfSceneToStream(&model, ss, false, true)) {
+        return false;
+    }
+    glb = ss.str();
+    return fallback_length == 0 || append_glb_fallback_buffer(glb, fallback_length);
+}
+
+// Reads a float accessor that is the only user of its buffer view
+static bool read_float_accessor(const tinygltf::Model& model, const std::vector<int>& users, int accessor_index,
+                                int components, std::vector<float>& values) {
+    if (accessor_index < 0 || accessor_index >= (int)model.accessors.size()) {
+        return false;
+    }
+    const tinygltf::Accessor& acc = model.accessors[accessor_index];
+    if (acc.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || acc.normalized || acc.sparse.isSparse
+        || tinygltf::GetNumComponentsInType(acc.type) != components || acc.count == 0 || acc.byteOffset != 0
+        || acc.bufferView < 0 || acc.bufferView >= (int)model.bufferViews.size() || users[acc.bufferView] != 1) {
+        return false;
+    }
+    const tinygltf::BufferView& bv = model.bufferViews[acc.bufferView];
+    const size_t element = sizeof(float) * components;
+    const size_t stride = bv.byteStride != 0 ? bv.byteStride : element;
+    if (bv.buffer != 0 || stride < element || bv.byteLength < (acc.count - 1) * stride + element
+        || bv.byteOffset + bv.byteLength > model.buffers[0].data.size()) {
+        return false;
+    }
+    const unsigned char* raw = model.buffers[0].data.data() + bv.byteOffset;
+    values.resize(acc.count * components);
+    for (size_t k = 0; k < acc.count; ++k) {
+        std::memcpy(values.data() + k * components, raw + k * stride, element);
+    }
+    return true;
+}
+
+bool quantize_model(tinygltf::Model& model) {
+    if (model.buffers.size() != 1) {
+        return false;
+    }
+    const std::vector<int> users = count_view_users(model);
+    std::vector<std::vector<unsigned char>> replaced(model.bufferViews.size());
+    std::vector<size_t> strides(model.bufferViews.size(), 0);
+    std::vector<char> done(model.accessors.size(), 0);
+    std::vector<float> values;
+
+    // Positions can only move into the node transform when the mesh owns its
+    // accessors and its nodes carry no TRS and no children
+    std::vector<int> accessor_mesh(model.accessors.size(), -1);
+    for (size_t m = 0; m < model.meshes.size(); ++m) {
+        for (const auto& prim : model.meshes[m].primitives) {
+            for (const auto& attr : prim.attributes) {
+                if (attr.second >= 0 && attr.second < (int)accessor_mesh.size()) {
+                    int& owner = accessor_mesh[attr.second];
+                    owner = (owner == -1 || owner == (int)m) ? (int)m : -2;
+                }
+            }
+        }
+    }
+
+    for (size_t m = 0; m < model.meshes.size(); ++m) {
+        const tinygltf::Mesh& mesh = model.meshes[m];
+        std::vector<int> nodes;
+        bool movable = true;
+        for (size_t n = 0; n < model.nodes.size(); ++n) {
+            const tinygltf::Node& node = model.nodes[n];
+            if (node.mesh != (int)m) {
+                continue;
+            }
+            nodes.push_back((int)n);
+            movable = movable && node.children.empty() && node.translation.empty() && node.rotation.empty()
+                      && node.scale.empty();
+        }
+        std::vector<int> positions;
+        for (const auto& prim : mesh.primitives) {
+            if (prim.extensions.count("KHR_draco_mesh_compression") || !prim.targets.empty()) {
+                movable = false;
+                break;
+            }
+            auto it = prim.attributes.find("POSITION");
+            if (it == prim.attributes.end() || it->second < 0 || it->second >= (int)model.accessors.size()
+                || accessor_mesh[it->second] != (int)m) {
+                movable = false;
+                break;
+            }
+            if (std::find(positions.begin(), positions.end(), it->second) == positions.end()) {
+                positions.push_back(it->second);
+            }
+        }
+        if (!movable || nodes.empty() || positions.empty()) {
+            continue;
+        }
+
+        // One uniform box for the mesh, every position accessor shares the node scale
+        double bmin[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+        double bmax[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+        std::vector<std::vector<float>> sources(positions.size());
+        bool readable = true;
+        for (size_t i = 0; i < positions.size() && readable; ++i) {
+            readable = read_float_accessor(model, users, positions[i], 3, sources[i]);
+            for (size_t k = 0; readable && k < sources[i].size(); ++k) {
+                bmin[k % 3] = std::min(bmin[k % 3], (double)sources[i][k]);
+                bmax[k % 3] = std::max(bmax[k % 3], (double)sources[i][k]);
+            }
+        }
+        if (!readable) {
+            continue;
+        }
+        double center[3];
+        double half = 0.0;
+        for (int c = 0; c < 3; ++c) {
+            center[c] = (bmin[c] + bmax[c]) * 0.5;
+            half = std::max(half, (bmax[c] - bmin[c]) * 0.5);
+        }
+        if (half <= 0.0) {
+            half = 1.0;
+        }
+
+        for (size_t i = 0; i < positions.size(); ++i) {
+            tinygltf::Accessor& acc = model.accessors[positions[i]];
+            std::vector<unsigned char>& data = replaced[acc.bufferView];
+            data.assign(acc.count * 8, 0);
+            acc.minValues.assign(3, 32767.0);
+            acc.maxValues.assign(3, -32767.0);
+            for (size_t k = 0; k < acc.count; ++k) {
+                int16_t q[3];
+                for (int c = 0; c < 3; ++c) {
+                    long v = std::lround((sources[i][k * 3 + c] - center[c]) / half * 32767.0);
+                    q[c] = (int16_t)std::max(-32767L, std::min(32767L, v));
+                    acc.minValues[c] = std::min(acc.minValues[c], (double)q[c]);
+                    acc.maxValues[c] = std::max(acc.maxValues[c], (double)q[c]);
+                }
+                std::memcpy(data.data() + k * 8, q, sizeof(q));
+            }
+            acc.componentType = TINYGLTF_COMPONENT_TYPE_SHORT;
+            acc.normalized = true;
+            strides[acc.bufferView] = 8;
+            done[positions[i]] = 1;
+        }
+
+        // node = node * translate(center) * scale(half), column major
+        const double local[16] = { half, 0, 0, 0, 0, half, 0, 0, 0, 0, half, 0, center[0], center[1], center[2], 1 };
+        for (int n : nodes) {
+            tinygltf::Node& node = model.nodes[n];
+            if (node.matrix.size() != 16) {
+                node.translation.assign(center, center + 3);
+                node.scale.assign(3, half);
+                continue;
+            }
+            std::vector<double> matrix(16, 0.0);
+            for (int col = 0; col < 4; ++col) {
+                for (int row = 0; row < 4; ++row) {
+                    for (int k = 0; k < 4; ++k) {
+                        matrix[col * 4 + row] += node.matrix[k * 4 + row] * local[col * 4 + k];
+                    }
+                }
+            }
+            node.matrix.swap(matrix);
+        }
+    }
+
+    // Normals as int8 snorm, texture coordinates in [0, 1] as uint16 unorm;
+    // repeating texture coordinates stay float
+    for (const auto& mesh : model.meshes) {
+        for (const auto& prim : mesh.primitives) {
+            if (prim.extensions.count("KHR_draco_mesh_compression")) {
+                continue;
+            }
+            for (const auto& attr : prim.attributes) {
+                const bool normal = attr.first == "NORMAL";
+                if ((!normal && attr.first.rfind("TEXCOORD_", 0) != 0) || attr.second < 0
+                    || attr.second >= (int)model.accessors.size() || done[attr.second]
+                    || !read_float_accessor(model, users, attr.second, normal ? 3 : 2, values)) {
+                    continue;
+                }
+                tinygltf::Accessor& acc = model.accessors[attr.second];
+                std::vector<unsigned char> data(acc.count * 4, 0);
+                if (normal) {
+                    for (size_t k = 0; k < acc.count; ++k) {
+                        const float* n = values.data() + k * 3;
+                        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                        float scale = length > 0.0f ? 127.0f / length : 0.0f;
+                        for (int c = 0; c < 3; ++c) {
+                            data[k * 4 + c] = (unsigned char)(int8_t)std::lround(n[c] * scale);
+                        }
+                    }
+                    acc.componentType = TINYGLTF_COMPONENT_TYPE_BYTE;
+                } else {
+                    if (std::any_of(values.begin(), values.end(), [](float v) { return !(v >= 0.0f && v <= 1.0f); })) {
+                        continue;
+                    }
+                    for (size_t k = 0; k < values.size(); ++k) {
+                        uint16_t q = (uint16_t)std::lround(values[k] * 65535.0f);
+                        std::memcpy(data.data() + k * 2, &q, 2);
+                    }
+                    acc.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+                }
+                acc.normalized = true;
+                acc.minValues.clear();
+                acc.maxValues.clear();
+                replaced[acc.bufferView].swap(data);
+                strides[acc.bufferView] = 4;
+                done[attr.second] = 1;
+            }
+        }
+    }
+    if (std::find(done.begin(), done.end(), 1) == done.end()) {
+        return false;
+    }
+
+    const std::vector<unsigned char>& source = model.buffers[0].data;
+    std::vector<unsigned char> data;
+    data.reserve(source.size());
+    for (size_t i = 0; i < model.bufferViews.size(); ++i) {
+        tinygltf::BufferView& bv = model.bufferViews[i];
+        if (bv.buffer != 0 || bv.byteOffset + bv.byteLength > source.size()) {
+            continue;
+        }
+        data.resize((data.size() + 3) & ~size_t(3), 0);
+        size_t offset = data.size();
+        if (strides[i] != 0) {
+            data.insert(data.end(), replaced[i].begin(), replaced[i].end());
+            bv.byteLength = replaced[i].size();
+            bv.byteStride = strides[i];
+        } else {
+            data.insert(data.end(), source.begin() + bv.byteOffset, source.begin() + bv.byteOffset + bv.byteLength);
+        }
+        bv.byteOffset = offset;
+    }
+    data.resize((data.size() + 3) & ~size_t(3), 0);
+    model.buffers[0].data.swap(data);
+
+    for (auto* list : { &model.extensionsUsed, &model.extensionsRequired }) {
+        if (std::find(list->begin(), list->end(), "KHR_mesh_quantization") == list->end()) {
+            list->push_back("KHR_mesh_quantization");
+        }
+    }
     return true;
-}
\ No newline at end of file
+}
@@ -10,6 +10,10 @@ namespace draco {
     class Mesh;
 }
 
+namespace tinygltf {
+    class Model;
+}
+
 // Structure to encapsulate vertex data for mesh processing
 struct VertexData {
     float x, y, z;          // Position
@@ -19,6 +23,12 @@ struct VertexData {
     VertexData() : x(0), y(0), z(0), nx(0), ny(0), nz(0), u(0), v(0) {}
 };
 
+// How optimize_and_simplify_mesh removes triangles
+enum SimplifyMode {
+    SIMPLIFY_TOPOLOGY = 0,                // meshopt_simplifyWithAttributes: keeps topology, normal and UV weighted
+    SIMPLIFY_SLOPPY = 1,                  // meshopt_simplifySloppy: ignores topology, fast, reaches target_ratio
+};
+
 // Structure to hold mesh simplification parameters
 struct SimplificationParams {
     float target_error = 0.01f;           // Target error for simplification (0.01 = 1%)
@@ -26,24 +36,42 @@ struct SimplificationParams {
     bool enable_simplification = false;   // Whether to enable mesh simplification
     bool preserve_texture_coords = true;  // Whether to preserve texture coordinates
     bool preserve_normals = true;         // Whether to preserve normals
+    int mode = SIMPLIFY_TOPOLOGY;         // SimplifyMode
 };
 
 // Structure to hold Draco compression parameters
 struct DracoCompressionParams {
     int position_quantization_bits = 11;  // Quantization bits for position (10-16)
+    double position_max_error = 0.0;      // Bound of the position quantization error in model units, picks
+                                          // the position bits per mesh (8-16) when > 0
     int normal_quantization_bits = 10;    // Quantization bits for normals (8-16)
     int tex_coord_quantization_bits = 12; // Quantization bits for texture coordinates (8-16)
-    int generic_quantization_bits = 8;    // Quantization bits for other attributes (8-16)
+    int generic_quantization_bits = 8;    // Quantization bits for other attributes (8-16), raised as needed for batch ids
+    int encoding_speed = 5;               // Draco encoder speed (0: smallest output, 10: fastest)
+    int decoding_speed = 5;               // Draco decoder speed the encoder aims for (0-10)
     bool enable_compression = false;      // Whether to enable Draco compression
 };
 
+// Draco position error bound of tiles that are never refined, in model units
+// (metres for georeferenced output): a leaf is looked at from any distance,
+// so its bound can't come from a geometricError
+constexpr double DRACO_LEAF_POSITION_ERROR = 0.005;
+
+// Structure to hold EXT_meshopt_compression parameters
+struct MeshoptCompressionParams {
+    int position_bits = 14;               // Mantissa bits of the exponential filter for positions (1-24)
+    int normal_bits = 10;                 // Mantissa bits for normals
+    int tex_coord_bits = 12;              // Mantissa bits for texture coordinates
+};
+
 // Function to compress image data to KTX2 using Basis Universal
 bool compress_to_ktx2(const std::vector<unsigned char>& rgba_data, int width, int height,
                       std::vector<unsigned char>& ktx2_data);
 
 // Function to optimize and simplify mesh data using meshoptimizer
 // Input: vertices, indices, and optimization parameters
-// Output: optimized vertices and simplified indices
+// Output: optimized vertices and simplified indices, result_error is the
+// simplification error relative to the mesh extent
 bool optimize_and_simplify_mesh(
     std::vector<VertexData>& vertices,
     size_t& vertex_count,
@@ -51,10 +79,42 @@ bool optimize_and_simplify_mesh(
     size_t original_index_count,
     std::vector<unsigned int>& simplified_indices,
     size_t& simplified_index_count,
-    const SimplificationParams& params);
+    const SimplificationParams& params,
+    float* result_error = nullptr);
+
+// Function to simplify indices over an already optimized vertex buffer
+// with params.mode, without touching the vertices. destination needs room
+// for index_count indices; returns the number written.
+size_t simplify_mesh_indices(
+    const std::vector<VertexData>& vertices,
+    const unsigned int* indices,
+    size_t index_count,
+    size_t target_index_count,
+    const SimplificationParams& params,
+    unsigned int* destination,
+    float* result_error = nullptr);
 
 // Function to simplify mesh geometry using meshoptimizer
-bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams& params);
+// out_error receives the simplification error in the units of the vertices
+bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams& params, float* out_error = nullptr);
+
+// One per-vertex attribute array reordered by optimize_mesh_buffers
+struct MeshAttributeStream {
+    void* data;                           // vertex_count * stride bytes
+    size_t stride;
+};
+
+// Function to optimize a triangle mesh without simplifying it: identical
+// vertices are welded, then triangles and vertices are reordered for the
+// vertex cache, overdraw and vertex fetch. The first stream must be the
+// float xyz positions. Streams are compacted in place, returns the new
+// vertex count (0: nothing done).
+size_t optimize_mesh_buffers(std::vector<unsigned int>& indices,
+                             const std::vector<MeshAttributeStream>& streams, size_t vertex_count);
+
+// Function to optimize mesh geometry in place with optimize_mesh_buffers.
+// The triangle-like primitive sets are replaced by one GL_TRIANGLES set.
+bool optimize_mesh_geometry(osg::Geometry* geometry);
 
 // Function to compress mesh geometry using Draco
 // Optional out parameters allow callers to retrieve Draco attribute ids for glTF extension mapping
@@ -64,6 +124,22 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
                            int* out_texcoord_att_id = nullptr, int* out_batchid_att_id = nullptr,
                            const std::vector<float>* batchIds = nullptr);
 
+// Function to serialize a model to glb with EXT_meshopt_compression. The
+// vertex and index buffer views of buffers[0] are encoded with the meshopt
+// codecs, float positions, normals and texture coordinates through the
+// exponential filter and int8 normals through the octahedral filter; other
+// buffer views (images) are kept as they are.
+// The uncompressed data is described by a fallback buffer without content.
+bool write_meshopt_glb(tinygltf::Model& model, std::string& glb,
+                       const MeshoptCompressionParams& params = MeshoptCompressionParams());
+
+// Function to quantize the vertex attributes of a model for KHR_mesh_quantization:
+// positions become int16 snorm in the box of their mesh, whose center and
+// size move into the node transform, normals int8 snorm and texture
+// coordinates in [0, 1] uint16 unorm. Draco primitives are left alone.
+// Returns false when nothing was quantized.
+bool quantize_model(tinygltf::Model& model);
+
 // Function to process textures (KTX2 compression)
 bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data, std::string& mime_type, bool enable_texture_compress = false);
 
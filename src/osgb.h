@@ -0,0 +1,103 @@
+#pragma once
+
+// What is done with the vertex normals of the osgb geometries
+enum OsgbNormalsMode {
+  OSGB_NORMALS_AUTO = 0,             // Strip for unlit output, generate the missing ones otherwise
+  OSGB_NORMALS_KEEP = 1,             // Write the normals of the file as they are
+  OSGB_NORMALS_GENERATE = 2,         // Compute the normals of geometries without them
+  OSGB_NORMALS_STRIP = 3,            // Write no normal
+};
+
+struct OsgbConversionParams {
+  const char *input_path;            // Data/Tile_xx/Tile_xx.osgb
+  const char *output_path;           // Output directory of the tile pyramid
+  double center_x;                   // Origin longitude (radian)
+  double center_y;                   // Origin latitude (radian)
+  int max_lvl;                       // Skip levels above this _L<n>_ level
+  int num_threads;                   // Workers of the tile pool (0: all cores)
+  int min_tile_kb;                   // Merge sibling leaves smaller than this (0: off)
+  int max_tile_kb;                   // Split contents larger than this (0: off)
+  int prefetch_mb;                   // Read-ahead cache of the source files (0: off)
+  int normals_mode;                  // OsgbNormalsMode
+  int draco_encoding_speed;          // Draco speed options (0-10), see DracoCompressionParams
+  int draco_decoding_speed;
+  double geometric_error_scale;      // Multiplies the measured simplification error added to geometricError
+  double draco_error_fraction;       // Draco position error of refined tiles over their geometricError, leaves use DRACO_LEAF_POSITION_ERROR (0: fixed bits)
+
+  // Feature flags
+  bool enable_texture_compress;
+  bool enable_meshopt;
+  bool enable_draco;
+  bool enable_unlit;
+  bool enable_incremental;           // Skip files unchanged since the last run (manifest.json)
+  bool enable_fast_reader;           // Parse the osgb with osgb_reader, OSG for unsupported files
+  bool enable_optimize_mesh;         // Reorder vertices and triangles for the GPU, see optimize_mesh_geometry
+  bool enable_meshopt_compression;   // EXT_meshopt_compression buffer views instead of Draco
+  bool enable_quantize;              // KHR_mesh_quantization vertex attributes, see quantize_model
+};
+
+// One node of the tile tree returned by osgb23dtile_path. Nodes are stored
+// in pre-order: the sub trees of a node's children follow it.
+struct OsgbTileNode {
+  double box[12];                    // boundingVolume.box
+  double geometric_error;
+  int uri_offset;                    // Content uri in OsgbTileTree::strings (-1: no content)
+  int uri_len;
+  int child_count;
+};
+
+struct OsgbTileTree {
+  OsgbTileNode *nodes;               // malloc'd, released by the caller
+  int node_count;
+  char *strings;                     // malloc'd content uris, not NUL terminated
+  int strings_len;
+  double box[6];                     // Extended block box: max xyz, min xyz
+};
+
+// One osgb converted in memory by osgb2b3dm_buf
+struct OsgbTileBuffer {
+  char *b3dm;                        // malloc'd, released by the caller
+  int b3dm_len;
+  char *children;                    // malloc'd '\n' terminated child file names, relative to the file
+  int children_len;
+  double box[12];                    // boundingVolume.box of the content
+  double bbox[6];                    // max xyz, min xyz
+  double geometric_error;
+};
+
+// Grouping tile of the HLOD hierarchy, its proxy is built from the
+// proxies of its child groups and the root files of its own blocks
+struct OsgbHlodGroup {
+  const int *blocks;                 // Indices into OsgbHlodParams::input_paths of the blocks directly under the group
+  int block_count;
+  const int *groups;                 // Indices into OsgbHlodParams::groups of the child groups
+  int group_count;
+  const char *output_path;           // b3dm file
+  double refined_error;              // Largest geometricError of the blocks under the group, for the Draco position error
+  bool written;                      // out: the proxy was written
+  double simplify_error;             // out: measured simplification error against the children, in meters
+};
+
+// HLOD proxies of the grouping tiles
+struct OsgbHlodParams {
+  const char *const *input_paths;    // Data/Tile_xx/Tile_xx.osgb of every block
+  int input_count;
+  OsgbHlodGroup *groups;
+  int group_count;
+  int max_triangles;                 // Triangle budget of each proxy
+  int atlas_size;                    // Width and height of the texture atlas of each proxy
+  double max_error;                  // Simplification error bound, relative to the extent of a child
+  int prefetch_mb;                   // See OsgbConversionParams
+  int draco_encoding_speed;
+  int draco_decoding_speed;
+  double draco_error_fraction;
+
+  // Feature flags, see OsgbConversionParams
+  bool enable_texture_compress;
+  bool enable_draco;
+  bool enable_unlit;
+  bool enable_fast_reader;
+  bool enable_optimize_mesh;
+  bool enable_meshopt_compression;
+  bool enable_quantize;
+};
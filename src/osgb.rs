@@ -4,6 +4,7 @@ extern crate serde;
 extern crate serde_json;
 
 use std::fs;
+use std::io::{Read, Write};
 
 use rayon::prelude::*;
 
@@ -12,21 +13,119 @@ use std::path::Path;
 
 use crate::common::str_to_vec_c;
 
+#[repr(C)]
+struct OsgbConversionParams {
+    input_path: *const libc::c_char,
+    output_path: *const libc::c_char,
+    center_x: f64,
+    center_y: f64,
+    max_lvl: i32,
+    num_threads: i32,
+    min_tile_kb: i32,
+    max_tile_kb: i32,
+    prefetch_mb: i32,
+    normals_mode: i32,
+    draco_encoding_speed: i32,
+    draco_decoding_speed: i32,
+    geometric_error_scale: f64,
+    draco_error_fraction: f64,
+
+    // Feature flags
+    enable_texture_compress: bool,
+    enable_meshopt: bool,
+    enable_draco: bool,
+    enable_unlit: bool,
+    enable_incremental: bool,
+    enable_fast_reader: bool,
+    enable_optimize_mesh: bool,
+    enable_meshopt_compression: bool,
+    enable_quantize: bool,
+}
+
+/// Pre-order node of the tile tree returned by `osgb23dtile_path`
+#[repr(C)]
+struct OsgbTileNode {
+    box_v: [f64; 12],
+    geometric_error: f64,
+    uri_offset: i32,
+    uri_len: i32,
+    child_count: i32,
+}
+
+#[repr(C)]
+struct OsgbTileTree {
+    nodes: *mut OsgbTileNode,
+    node_count: i32,
+    strings: *mut libc::c_char,
+    strings_len: i32,
+    box_v: [f64; 6],
+}
+
+#[repr(C)]
+struct OsgbHlodGroup {
+    blocks: *const i32,
+    block_count: i32,
+    groups: *const i32,
+    group_count: i32,
+    output_path: *const libc::c_char,
+    refined_error: f64,
+    written: bool,
+    simplify_error: f64,
+}
+
+#[repr(C)]
+struct OsgbHlodParams {
+    input_paths: *const *const libc::c_char,
+    input_count: i32,
+    groups: *mut OsgbHlodGroup,
+    group_count: i32,
+    max_triangles: i32,
+    atlas_size: i32,
+    max_error: f64,
+    prefetch_mb: i32,
+    draco_encoding_speed: i32,
+    draco_decoding_speed: i32,
+    draco_error_fraction: f64,
+
+    // Feature flags
+    enable_texture_compress: bool,
+    enable_draco: bool,
+    enable_unlit: bool,
+    enable_fast_reader: bool,
+    enable_optimize_mesh: bool,
+    enable_meshopt_compression: bool,
+    enable_quantize: bool,
+}
+
+/// Output of `osgb2b3dm_buf`
+#[repr(C)]
+struct OsgbTileBuffer {
+    b3dm: *mut libc::c_char,
+    b3dm_len: i32,
+    children: *mut libc::c_char,
+    children_len: i32,
+    box_v: [f64; 12],
+    bbox: [f64; 6],
+    geometric_error: f64,
+}
+
+/// Proxies of the grouping tiles, see `osgb_hlod_proxies`
+pub struct HlodSettings {
+    pub max_triangles: i32, // Triangle budget of each proxy
+    pub atlas_size: i32,    // Texture atlas width and height of each proxy
+    pub max_error: f64,     // Simplification error bound, relative to the extent of a child
+}
+
 extern "C" {
 
+    fn osgb_hlod_proxies(params: *const OsgbHlodParams) -> bool;
+
+    fn osgb2b3dm_buf(params: *const OsgbConversionParams, result: *mut OsgbTileBuffer) -> bool;
+
     fn osgb23dtile_path(
-        in_path: *const u8,
-        out_path: *const u8,
-        box_ptr: *mut f64,
-        len: *mut i32,
-        x: f64,
-        y: f64,
-        max_lvl: i32,
-        enable_texture_compress: bool,
-        enable_meshopt: bool,
-        enable_draco: bool,
-        enable_unlit: bool,
-    ) -> *mut libc::c_void;
+        params: *const OsgbConversionParams,
+        result: *mut OsgbTileTree,
+    ) -> bool;
 
     pub fn osgb2glb(name_in: *const u8, name_out: *const u8) -> bool;
 
@@ -54,33 +153,287 @@ extern "C" {
 
 #[derive(Debug)]
 struct TileResult {
-    json: String,
+    in_path: String,
     path: String,
     box_v: Vec<f64>,
+    tile_box: Vec<f64>,
+    geometric_error: f64,
 }
 
 struct OsgbInfo {
     in_dir: String,
     out_dir: String,
-    sender: ::std::sync::mpsc::Sender<TileResult>,
+    mem_estimate: u64,
+    sender: ::std::sync::mpsc::Sender<Option<TileResult>>,
 }
 
-pub fn osgb_batch_convert(
-    dir: &Path,
-    dir_dest: &Path,
-    max_lvl: Option<i32>,
-    center_x: f64,
-    center_y: f64,
-    region_offset: Option<f64>,
-    enu_offset: Option<(f64, f64, f64)>,
-    origin_height: Option<f64>,
-    enable_texture_compress: bool,
-    enable_meshopt: bool,
-    enable_draco_compress: bool,
-    enable_unlit: bool,
-) -> Result<(), Box<dyn Error>> {
+const MB: u64 = 1024 * 1024;
+
+/// Hands out the blocks, largest first, while the sum of their estimated
+/// working sets fits in the limit; smaller blocks fill what the larger ones
+/// leave. A block larger than the limit is charged the whole limit, so it
+/// still runs, alone.
+struct BlockQueue {
+    limit: u64,
+    state: ::std::sync::Mutex<BlockQueueState>,
+    cv: ::std::sync::Condvar,
+}
+
+struct BlockQueueState {
+    pending: Vec<OsgbInfo>, // sorted by decreasing estimate
+    in_use: u64,
+    peak: u64,
+}
+
+impl BlockQueue {
+    fn new(limit: u64, mut blocks: Vec<OsgbInfo>) -> Self {
+        blocks.sort_by(|a, b| b.mem_estimate.cmp(&a.mem_estimate));
+        BlockQueue {
+            limit,
+            state: ::std::sync::Mutex::new(BlockQueueState { pending: blocks, in_use: 0, peak: 0 }),
+            cv: ::std::sync::Condvar::new(),
+        }
+    }
+
+    /// Blocks until a pending block fits, returns it with what was charged;
+    /// None once every block was handed out
+    fn next(&self) -> Option<(OsgbInfo, u64)> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.pending.is_empty() {
+                return None;
+            }
+            let in_use = state.in_use;
+            let limit = self.limit;
+            let fit = state
+                .pending
+                .iter()
+                .position(|b| in_use == 0 || in_use + b.mem_estimate.min(limit) <= limit);
+            if let Some(i) = fit {
+                let info = state.pending.remove(i);
+                let cost = info.mem_estimate.min(limit);
+                state.in_use += cost;
+                state.peak = state.peak.max(state.in_use);
+                return Some((info, cost));
+            }
+            state = self.cv.wait(state).unwrap();
+        }
+    }
+
+    fn release(&self, cost: u64) {
+        let mut state = self.state.lock().unwrap();
+        state.in_use -= cost;
+        self.cv.notify_all();
+    }
+
+    fn peak(&self) -> u64 {
+        self.state.lock().unwrap().peak
+    }
+}
+
+fn write_number<W: Write>(w: &mut W, v: f64) -> std::io::Result<()> {
+    if v.is_finite() {
+        write!(w, "{}", v)
+    } else {
+        w.write_all(b"0")
+    }
+}
+
+fn write_box<W: Write>(w: &mut W, box_v: &[f64]) -> std::io::Result<()> {
+    w.write_all(b"{\"box\":[")?;
+    for (i, v) in box_v.iter().enumerate() {
+        if i > 0 {
+            w.write_all(b",")?;
+        }
+        write_number(w, *v)?;
+    }
+    w.write_all(b"]}")
+}
+
+/// Writes the sub tree of `nodes[index]` as a tileset tile, returns the
+/// index of the node following the sub tree.
+fn write_tile_node<W: Write>(
+    w: &mut W,
+    nodes: &[OsgbTileNode],
+    uris: &[u8],
+    index: usize,
+) -> std::io::Result<usize> {
+    let node = &nodes[index];
+    w.write_all(b"{\"geometricError\":")?;
+    write_number(w, node.geometric_error)?;
+    w.write_all(b",\"boundingVolume\":")?;
+    write_box(w, &node.box_v)?;
+    if node.uri_offset >= 0 {
+        let start = node.uri_offset as usize;
+        let uri = String::from_utf8_lossy(&uris[start..start + node.uri_len as usize]);
+        w.write_all(b",\"content\":{\"uri\":")?;
+        serde_json::to_writer(&mut *w, &uri)?;
+        w.write_all(b",\"boundingVolume\":")?;
+        write_box(w, &node.box_v)?;
+        w.write_all(b"}")?;
+    }
+    w.write_all(b",\"children\":[")?;
+    let mut next = index + 1;
+    for i in 0..node.child_count {
+        if i > 0 {
+            w.write_all(b",")?;
+        }
+        next = write_tile_node(w, nodes, uris, next)?;
+    }
+    w.write_all(b"]}")?;
+    Ok(next)
+}
+
+/// Streams the tileset.json of a block, without building it in memory
+fn write_block_tileset(path: &str, nodes: &[OsgbTileNode], uris: &[u8]) -> std::io::Result<()> {
+    let f = fs::File::create(path)?;
+    let mut w = std::io::BufWriter::new(f);
+    w.write_all(b"{\"asset\":{\"version\":\"1.0\",\"gltfUpAxis\":\"Z\"},\"geometricError\":")?;
+    write_number(&mut w, nodes[0].geometric_error)?;
+    w.write_all(b",\"root\":")?;
+    write_tile_node(&mut w, nodes, uris, 0)?;
+    w.write_all(b"}")?;
+    w.flush()
+}
+
+/// `_L<n>_` level of a tile file name
+fn tile_level(name: &str) -> Option<i32> {
+    let pos = name.find("_L")?;
+    let rest = &name[pos + 2..];
+    let end = rest.find('_')?;
+    rest[..end].parse::<i32>().ok()
+}
+
+/// Decoded RGBA bytes of the JPEG and PNG images embedded in `buf`
+fn embedded_image_bytes(buf: &[u8]) -> u64 {
+    let be16 = |i: usize| ((buf[i] as u64) << 8) | buf[i + 1] as u64;
+    let be32 = |i: usize| (be16(i) << 16) | be16(i + 2);
+    let mut total = 0u64;
+    let mut i = 0usize;
+    while i + 24 < buf.len() {
+        if buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF {
+            // walk the JPEG segments up to the frame header
+            let mut j = i + 2;
+            while j + 9 < buf.len() && buf[j] == 0xFF {
+                let marker = buf[j + 1];
+                if (0xC0..=0xCF).contains(&marker) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC {
+                    total += be16(j + 5) * be16(j + 7) * 4;
+                    break;
+                }
+                j += 2 + be16(j + 2) as usize;
+            }
+            i = j.max(i + 3);
+        } else if buf[i..].starts_with(b"\x89PNG\r\n\x1a\n") && &buf[i + 12..i + 16] == b"IHDR" {
+            total += be32(i + 16) * be32(i + 20) * 4;
+            i += 24;
+        } else {
+            i += 1;
+        }
+    }
+    total
+}
+
+/// Bytes of the root file sampled by `estimate_block_memory`
+const ESTIMATE_SAMPLE_BYTES: u64 = 4 * MB;
+
+/// Estimated peak memory of converting the block of `root_osgb`, from the
+/// file sizes of the block and the head of its root file.
+/// The textures of the OSGB files are embedded: how much the sampled bytes
+/// grow once decoded gives the expansion factor of the whole block. At
+/// most `workers` files of a block are loaded at once.
+fn estimate_block_memory(root_osgb: &Path, max_lvl: i32, workers: u64) -> u64 {
+    let mut total = 0u64;
+    let mut largest = 0u64;
+    if let Some(dir) = root_osgb.parent() {
+        if let Ok(entries) = fs::read_dir(dir) {
+            for entry in entries.flatten() {
+                let name = entry.file_name().to_string_lossy().to_string();
+                if !name.ends_with(".osgb") || tile_level(&name).map_or(false, |l| l > max_lvl) {
+                    continue;
+                }
+                let size = entry.metadata().map(|m| m.len()).unwrap_or(0);
+                total += size;
+                largest = largest.max(size);
+            }
+        }
+    }
+    let sample = fs::File::open(root_osgb).and_then(|f| {
+        let mut buf = vec![];
+        f.take(ESTIMATE_SAMPLE_BYTES).read_to_end(&mut buf).map(|_| buf)
+    });
+    let factor = match sample {
+        Ok(buf) if !buf.is_empty() => {
+            let decoded = embedded_image_bytes(&buf);
+            if decoded > 0 {
+                // geometry is copied about three times (osg, glb, b3dm)
+                ((3 * buf.len() as u64 + decoded) as f64 / buf.len() as f64).clamp(2.0, 32.0)
+            } else {
+                6.0
+            }
+        }
+        _ => 6.0,
+    };
+    (total.min(largest * workers) as f64 * factor) as u64
+}
+
+/// MemAvailable of /proc/meminfo
+#[cfg(target_os = "linux")]
+fn available_memory() -> Option<u64> {
+    let info = fs::read_to_string("/proc/meminfo").ok()?;
+    let line = info.lines().find(|l| l.starts_with("MemAvailable:"))?;
+    let kb = line.split_whitespace().nth(1)?.parse::<u64>().ok()?;
+    Some(kb * 1024)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn available_memory() -> Option<u64> {
+    None
+}
+
+/// Peak resident set size of the process
+#[cfg(target_os = "linux")]
+fn peak_memory() -> Option<u64> {
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|l| l.starts_with("VmHWM:"))?;
+    let kb = line.split_whitespace().nth(1)?.parse::<u64>().ok()?;
+    Some(kb * 1024)
+}
+
+#[cfg(target_os = "macos")]
+fn peak_memory() -> Option<u64> {
+    let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+    if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) } != 0 {
+        return None;
+    }
+    // bytes on macOS
+    Some(usage.ru_maxrss as u64)
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "macos")))]
+fn peak_memory() -> Option<u64> {
+    None
+}
+
+/// Settings of `osgb_batch_convert`: the conversion of each file, shared
+/// with `serve`, and what only applies to a whole dataset
+pub struct BatchSettings {
+    pub tile: TileSettings,
+    pub region_offset: Option<f64>,
+    pub enu_offset: Option<(f64, f64, f64)>,
+    pub origin_height: Option<f64>,
+    pub num_threads: i32,   // Tile pool and blocks converted at once, 0: all cores
+    pub enable_incremental: bool,
+    pub memory_budget: u64, // MB, 0: 3/4 of the available memory
+    pub group_branching: u32,
+    pub group_depth: u32,
+    pub hlod: Option<HlodSettings>,
+    pub min_tile_kb: i32,
+    pub max_tile_kb: i32,
+    pub prefetch_mb: i32,
+}
+
+pub fn osgb_batch_convert(dir: &Path, dir_dest: &Path, settings: &BatchSettings) -> Result<(), Box<dyn Error>> {
     use std::fs::File;
-    use std::io::prelude::*;
     use std::sync::mpsc::channel;
 
     let path = dir.join("Data");
@@ -88,6 +441,14 @@ pub fn osgb_batch_convert(
         return Err(From::from(format!("dir {} not exist", path.display())));
     }
 
+    let tile = &settings.tile;
+    let max_lvl = tile.max_lvl;
+    let workers = if settings.num_threads > 0 {
+        settings.num_threads as u64
+    } else {
+        std::thread::available_parallelism().map_or(1, |n| n.get() as u64)
+    };
+
     let (sender, receiver) = channel();
     let mut osgb_dir_pair: Vec<OsgbInfo> = vec![];
     let mut task_count = 0;
@@ -108,6 +469,7 @@ pub fn osgb_batch_convert(
                 osgb_dir_pair.push(OsgbInfo {
                     in_dir: osgb.to_string_lossy().into(),
                     out_dir: out_dir.to_string_lossy().into(),
+                    mem_estimate: 0,
                     sender: sender.clone(),
                 });
             } else {
@@ -116,58 +478,93 @@ pub fn osgb_batch_convert(
         }
     }
 
-    let rad_x = unsafe { degree2rad(center_x) };
-    let rad_y = unsafe { degree2rad(center_y) };
-
-    let max_lvl: i32 = max_lvl.unwrap_or(100);
-    osgb_dir_pair
-        .into_par_iter()
-        .map(|info| unsafe {
-            let mut root_box = vec![0f64; 6];
-            let mut json_buf = vec![];
-            let mut json_len = 0i32;
-            let in_ptr = str_to_vec_c(&info.in_dir);
-            let out_ptr = str_to_vec_c(&info.out_dir);
-            let out_ptr = osgb23dtile_path(
-                in_ptr.as_ptr(),
-                out_ptr.as_ptr(),
-                root_box.as_mut_ptr(),
-                (&mut json_len) as *mut i32,
-                rad_x,
-                rad_y,
-                max_lvl,
-                enable_texture_compress,
-                enable_meshopt,
-                enable_draco_compress,
-                enable_unlit,
-            );
-            if out_ptr.is_null() {
-                error!("failed: {}", info.in_dir);
-            } else {
-                json_buf.resize(json_len as usize, 0);
-                libc::memcpy(
-                    json_buf.as_mut_ptr() as *mut libc::c_void,
-                    out_ptr,
-                    json_len as usize,
-                );
-                libc::free(out_ptr);
-            }
-            let t = TileResult {
-                path: info.out_dir.into(),
-                json: String::from_utf8(json_buf).unwrap(),
-                box_v: root_box,
-            };
-            info.sender.send(t).unwrap();
-        })
-        .count();
+    // --threads also bounds the blocks converted at once, not only the tile pool
+    let block_pool = rayon::ThreadPoolBuilder::new()
+        .num_threads(workers as usize)
+        .build()?;
+    block_pool.install(|| {
+        osgb_dir_pair
+            .par_iter_mut()
+            .for_each(|info| info.mem_estimate = estimate_block_memory(Path::new(&info.in_dir), max_lvl, workers));
+    });
+
+    let budget_limit = if settings.memory_budget > 0 {
+        settings.memory_budget * MB
+    } else {
+        available_memory().map_or(u64::MAX, |m| m / 4 * 3)
+    };
+    let largest_estimate = osgb_dir_pair.iter().map(|x| x.mem_estimate).max().unwrap_or(0);
+    if budget_limit != u64::MAX {
+        info!(
+            "memory budget {} MB, largest block estimated at {} MB",
+            budget_limit / MB,
+            largest_estimate / MB
+        );
+    }
+
+    // every pool thread takes the next block from the queue, a parallel
+    // iterator would split the blocks up front and lose their order
+    let queue = BlockQueue::new(budget_limit, osgb_dir_pair);
+    block_pool.scope(|scope| {
+        for _ in 0..workers {
+            scope.spawn(|_| {
+                while let Some((info, charged)) = queue.next() {
+                    let result = unsafe {
+                        let in_ptr = str_to_vec_c(&info.in_dir);
+                        let out_ptr = str_to_vec_c(&info.out_dir);
+                        let params = OsgbConversionParams {
+                            min_tile_kb: settings.min_tile_kb,
+                            max_tile_kb: settings.max_tile_kb,
+                            prefetch_mb: settings.prefetch_mb,
+                            enable_incremental: settings.enable_incremental,
+                            ..conversion_params(tile, settings.num_threads, &in_ptr, &out_ptr)
+                        };
+                        let mut tree: OsgbTileTree = std::mem::zeroed();
+                        let mut result = None;
+                        if !osgb23dtile_path(&params, &mut tree) {
+                            error!("failed: {}", info.in_dir);
+                        } else {
+                            let nodes = std::slice::from_raw_parts(tree.nodes, tree.node_count as usize);
+                            let uris = std::slice::from_raw_parts(tree.strings as *const u8, tree.strings_len as usize);
+                            let out_file = info.out_dir.clone() + "/tileset.json";
+                            match write_block_tileset(&out_file, nodes, uris) {
+                                Ok(_) => {
+                                    result = Some(TileResult {
+                                        in_path: info.in_dir.clone(),
+                                        path: info.out_dir.clone(),
+                                        box_v: tree.box_v.to_vec(),
+                                        tile_box: nodes[0].box_v.to_vec(),
+                                        geometric_error: nodes[0].geometric_error,
+                                    })
+                                }
+                                Err(e) => error!("write {} failed: {}", out_file, e),
+                            }
+                            libc::free(tree.nodes as *mut libc::c_void);
+                            libc::free(tree.strings as *mut libc::c_void);
+                        }
+                        result
+                    };
+                    queue.release(charged);
+                    info.sender.send(result).unwrap();
+                }
+            });
+        }
+    });
+
+    match peak_memory() {
+        Some(peak) => info!(
+            "peak memory {} MB, estimated {} MB",
+            peak / MB,
+            queue.peak() / MB
+        ),
+        None => info!("peak memory estimated {} MB", queue.peak() / MB),
+    }
 
     // merge and root
     let mut tile_array = vec![];
     for _ in 0..task_count {
-        if let Ok(t) = receiver.recv() {
-            if !t.json.is_empty() {
-                tile_array.push(t);
-            }
+        if let Ok(Some(t)) = receiver.recv() {
+            tile_array.push(t);
         }
     }
     let mut root_box = vec![-1.0E+38f64, -1.0E+38, -1.0E+38, 1.0E+38, 1.0E+38, 1.0E+38];
@@ -183,35 +580,20 @@ pub fn osgb_batch_convert(
                 root_box[i] = x.box_v[i]
             }
         }
-        let json_val: serde_json::Value = serde_json::from_str(&x.json).unwrap();
-        if let Some(ge) = json_val["geometricError"].as_f64() {
-            if ge > root_geometric_error {
-                root_geometric_error = ge;
-            }
+        if x.geometric_error > root_geometric_error {
+            root_geometric_error = x.geometric_error;
         }
     }
 
     //let root_geometric_error = get_geometric_error(center_y, 10);
-    // Use origin height: priority: origin_height > enu_offset.2 > region_offset calculation
-    let tras_height = if let Some(h) = origin_height {
-        h
-    } else if let Some((_, _, enu_z)) = enu_offset {
-        enu_z
-    } else if let Some(v) = region_offset {
-        v - root_box[5]
-    } else {
-        0f64
-    };
-    let mut trans_vec = vec![0f64; 16];
-    unsafe {
-        if let Some((enu_x, enu_y, enu_z)) = enu_offset {
-            // Use the ENU-aware transform function
-            transform_c_with_enu_offset(center_x, center_y, tras_height, enu_x, enu_y, enu_z, trans_vec.as_mut_ptr());
-        } else {
-            // Use standard transform function
-            transform_c(center_x, center_y, tras_height, trans_vec.as_mut_ptr());
-        }
-    }
+    let trans_vec = root_transform(
+        tile.center_x,
+        tile.center_y,
+        settings.region_offset,
+        settings.enu_offset,
+        settings.origin_height,
+        root_box[5],
+    );
     let mut root_json = json!(
         {
             "asset": {
@@ -231,45 +613,384 @@ pub fn osgb_batch_convert(
     );
 
     let out_dir: String = dir_dest.to_string_lossy().into();
-    for x in tile_array {
-        let path = x.path;
-        let json_val: serde_json::Value = serde_json::from_str(&x.json).unwrap();
-        let tile_box = json_val["boundingVolume"]["box"].as_array().unwrap();
-        let tile_geometric_error = json_val["geometricError"].as_f64().unwrap_or(1000.0);
-        let tile_object = json!(
-            {
-                "boundingVolume": {
-                    "box": &tile_box
-                },
-                "geometricError": tile_geometric_error,
-                "content": {
-                    "uri" : format!("{}/tileset.json", path.replace(&out_dir,"./").replace("\\","/"))
+    let items: Vec<usize> = (0..tile_array.len()).collect();
+    let mut next_id = 0;
+    let root_children = if settings.group_branching >= 2 && settings.group_depth > 0 {
+        group_blocks(&tile_array, items, settings.group_branching as usize, settings.group_depth, &mut next_id)
+    } else {
+        items.into_iter().map(RootChild::Block).collect()
+    };
+
+    // HLOD proxies of the grouping tiles, built bottom up in one call so
+    // every block root is read once
+    let mut proxies = std::collections::HashMap::new();
+    if let Some(hlod) = settings.hlod.as_ref() {
+        let mut groups = vec![];
+        collect_groups(&root_children, &mut groups);
+        if !groups.is_empty() {
+            fs::create_dir_all(dir_dest.join("hlod"))?;
+            let index_of: std::collections::HashMap<usize, i32> =
+                groups.iter().enumerate().map(|(k, g)| (g.id, k as i32)).collect();
+            let mut block_lists: Vec<Vec<i32>> = vec![];
+            let mut group_lists: Vec<Vec<i32>> = vec![];
+            for group in groups.iter() {
+                let mut blocks = vec![];
+                let mut children = vec![];
+                for child in group.children.iter() {
+                    match child {
+                        RootChild::Block(i) => blocks.push(*i as i32),
+                        RootChild::Group(g) => children.push(index_of[&g.id]),
+                    }
                 }
+                block_lists.push(blocks);
+                group_lists.push(children);
             }
-        );
+            let inputs: Vec<Vec<u8>> = tile_array.iter().map(|x| str_to_vec_c(&x.in_path)).collect();
+            let input_ptrs: Vec<*const libc::c_char> =
+                inputs.iter().map(|x| x.as_ptr() as *const libc::c_char).collect();
+            let outputs: Vec<Vec<u8>> = groups
+                .iter()
+                .map(|g| str_to_vec_c(&dir_dest.join(hlod_uri(g.id)).to_string_lossy()))
+                .collect();
+            let mut hlod_groups: Vec<OsgbHlodGroup> = (0..groups.len())
+                .map(|k| OsgbHlodGroup {
+                    blocks: block_lists[k].as_ptr(),
+                    block_count: block_lists[k].len() as i32,
+                    groups: group_lists[k].as_ptr(),
+                    group_count: group_lists[k].len() as i32,
+                    output_path: outputs[k].as_ptr() as *const libc::c_char,
+                    refined_error: max_block_error(&groups[k].children, &tile_array),
+                    written: false,
+                    simplify_error: 0.0,
+                })
+                .collect();
+            let params = OsgbHlodParams {
+                input_paths: input_ptrs.as_ptr(),
+                input_count: input_ptrs.len() as i32,
+                groups: hlod_groups.as_mut_ptr(),
+                group_count: hlod_groups.len() as i32,
+                max_triangles: hlod.max_triangles,
+                atlas_size: hlod.atlas_size,
+                max_error: hlod.max_error,
+                prefetch_mb: settings.prefetch_mb,
+                draco_encoding_speed: tile.draco_encoding_speed,
+                draco_decoding_speed: tile.draco_decoding_speed,
+                draco_error_fraction: tile.draco_error_fraction,
+                enable_texture_compress: tile.enable_texture_compress,
+                enable_draco: tile.enable_draco,
+                enable_unlit: tile.enable_unlit,
+                enable_fast_reader: tile.enable_fast_reader,
+                enable_optimize_mesh: tile.enable_optimize_mesh,
+                enable_meshopt_compression: tile.enable_meshopt_compression,
+                enable_quantize: tile.enable_quantize,
+            };
+            unsafe { osgb_hlod_proxies(&params) };
+            for (group, result) in groups.iter().zip(hlod_groups.iter()) {
+                if result.written {
+                    proxies.insert(group.id, result.simplify_error * tile.geometric_error_scale);
+                } else {
+                    error!("hlod failed: {}", dir_dest.join(hlod_uri(group.id)).display());
+                }
+            }
+        }
+    }
+    let children: Vec<_> = root_children
+        .iter()
+        .map(|c| root_child_tile(c, &tile_array, &out_dir, &proxies))
+        .collect();
+    let mut max_child_error = root_geometric_error;
+    for (tile, geometric_error) in children {
+        max_child_error = max_child_error.max(geometric_error);
         root_json["root"]["children"]
             .as_array_mut()
             .unwrap()
-            .push(tile_object);
-        let sub_tile = json!({
-            "asset": {
-                "version": "1.0",
-                "gltfUpAxis":"Z"
-            },
-            "geometricError": tile_geometric_error,
-            "root": json_val
-        }
-        );
-        let out_file = path.clone() + "/tileset.json";
-        let mut f = File::create(out_file)?;
-        f.write_all(serde_json::to_string_pretty(&sub_tile).unwrap().as_bytes())?;
+            .push(tile);
     }
+    root_json["geometricError"] = json!(max_child_error * 2.0);
+    root_json["root"]["geometricError"] = json!(max_child_error * 2.0);
     let path_json = dir_dest.join("tileset.json");
     let mut f = File::create(path_json)?;
     f.write_all(serde_json::to_string_pretty(&root_json).unwrap().as_bytes())?;
     Ok(())
 }
 
+/// Transform of the root tile, `min_z` is the bottom of the root box
+pub fn root_transform(
+    center_x: f64,
+    center_y: f64,
+    region_offset: Option<f64>,
+    enu_offset: Option<(f64, f64, f64)>,
+    origin_height: Option<f64>,
+    min_z: f64,
+) -> Vec<f64> {
+    // Use origin height: priority: origin_height > enu_offset.2 > region_offset calculation
+    let tras_height = if let Some(h) = origin_height {
+        h
+    } else if let Some((_, _, enu_z)) = enu_offset {
+        enu_z
+    } else if let Some(v) = region_offset {
+        v - min_z
+    } else {
+        0f64
+    };
+    let mut trans_vec = vec![0f64; 16];
+    unsafe {
+        if let Some((enu_x, enu_y, enu_z)) = enu_offset {
+            // Use the ENU-aware transform function
+            transform_c_with_enu_offset(center_x, center_y, tras_height, enu_x, enu_y, enu_z, trans_vec.as_mut_ptr());
+        } else {
+            // Use standard transform function
+            transform_c(center_x, center_y, tras_height, trans_vec.as_mut_ptr());
+        }
+    }
+    trans_vec
+}
+
+/// Conversion settings of the files converted one by one by `serve`
+pub struct TileSettings {
+    pub center_x: f64, // degree
+    pub center_y: f64,
+    pub max_lvl: i32,
+    pub normals_mode: i32,
+    pub geometric_error_scale: f64,
+    pub draco_error_fraction: f64,
+    pub draco_encoding_speed: i32,
+    pub draco_decoding_speed: i32,
+    pub enable_texture_compress: bool,
+    pub enable_meshopt: bool,
+    pub enable_draco: bool,
+    pub enable_unlit: bool,
+    pub enable_fast_reader: bool,
+    pub enable_optimize_mesh: bool,
+    pub enable_meshopt_compression: bool,
+    pub enable_quantize: bool,
+}
+
+/// One osgb converted in memory, see `osgb2b3dm_buf`
+pub struct TileBuffer {
+    pub b3dm: Vec<u8>,
+    pub children: Vec<String>,
+    pub box_v: Vec<f64>, // Tileset box, 12 values
+    pub bbox: Vec<f64>,  // Max xyz then min xyz
+    pub geometric_error: f64,
+}
+
+/// Parameters converting one file with `settings` without size
+/// normalization; `num_threads` sizes the process wide encoding pool on
+/// its first use. The paths must outlive the parameters
+fn conversion_params(settings: &TileSettings, num_threads: i32, in_ptr: &[u8], out_ptr: &[u8]) -> OsgbConversionParams {
+    OsgbConversionParams {
+        input_path: in_ptr.as_ptr() as *const libc::c_char,
+        output_path: out_ptr.as_ptr() as *const libc::c_char,
+        center_x: unsafe { degree2rad(settings.center_x) },
+        center_y: unsafe { degree2rad(settings.center_y) },
+        max_lvl: settings.max_lvl,
+        num_threads,
+        min_tile_kb: 0,
+        max_tile_kb: 0,
+        prefetch_mb: 0,
+        normals_mode: settings.normals_mode,
+        draco_encoding_speed: settings.draco_encoding_speed,
+        draco_decoding_speed: settings.draco_decoding_speed,
+        geometric_error_scale: settings.geometric_error_scale,
+        draco_error_fraction: settings.draco_error_fraction,
+        enable_texture_compress: settings.enable_texture_compress,
+        enable_meshopt: settings.enable_meshopt,
+        enable_draco: settings.enable_draco,
+        enable_unlit: settings.enable_unlit,
+        enable_incremental: false,
+        enable_fast_reader: settings.enable_fast_reader,
+        enable_optimize_mesh: settings.enable_optimize_mesh,
+        enable_meshopt_compression: settings.enable_meshopt_compression,
+        enable_quantize: settings.enable_quantize,
+    }
+}
+
+/// Converts one file in memory; the geometries of the conversions running at
+/// once are encoded on one pool of `num_threads` workers (0: all cores)
+pub fn convert_tile_buffer(file: &str, settings: &TileSettings, num_threads: i32) -> Option<TileBuffer> {
+    let in_ptr = str_to_vec_c(file);
+    let out_ptr = str_to_vec_c("");
+    let params = conversion_params(settings, num_threads, &in_ptr, &out_ptr);
+    unsafe {
+        let mut buf: OsgbTileBuffer = std::mem::zeroed();
+        if !osgb2b3dm_buf(&params, &mut buf) {
+            return None;
+        }
+        let b3dm = std::slice::from_raw_parts(buf.b3dm as *const u8, buf.b3dm_len as usize).to_vec();
+        let names = std::slice::from_raw_parts(buf.children as *const u8, buf.children_len as usize);
+        let children = String::from_utf8_lossy(names)
+            .split('\n')
+            .filter(|x| !x.is_empty())
+            .map(|x| x.to_string())
+            .collect();
+        libc::free(buf.b3dm as *mut libc::c_void);
+        libc::free(buf.children as *mut libc::c_void);
+        Some(TileBuffer {
+            b3dm,
+            children,
+            box_v: buf.box_v.to_vec(),
+            bbox: buf.bbox.to_vec(),
+            geometric_error: buf.geometric_error,
+        })
+    }
+}
+
+/// Root child referencing the tileset.json of a block
+fn block_tile(x: &TileResult, out_dir: &str) -> (serde_json::Value, f64) {
+    let tile = json!(
+        {
+            "boundingVolume": {
+                "box": x.tile_box
+            },
+            "geometricError": x.geometric_error,
+            "content": {
+                "uri" : format!("{}/tileset.json", x.path.replace(out_dir,"./").replace("\\","/"))
+            }
+        }
+    );
+    (tile, x.geometric_error)
+}
+
+/// Grouping tile of the root hierarchy, see group_blocks()
+struct BlockGroup {
+    id: usize,
+    box_v: Vec<f64>,
+    children: Vec<RootChild>,
+}
+
+enum RootChild {
+    Block(usize),
+    Group(BlockGroup),
+}
+
+/// Groups the blocks `items` into a quadtree like hierarchy: the xy extent
+/// of their centers is split into branching x branching cells, each cell
+/// holding more than one block becomes a grouping tile, until `depth`
+/// levels were made.
+fn group_blocks(
+    tiles: &[TileResult],
+    items: Vec<usize>,
+    branching: usize,
+    depth: u32,
+    next_id: &mut usize,
+) -> Vec<RootChild> {
+    let center = |i: usize, axis: usize| (tiles[i].box_v[axis] + tiles[i].box_v[axis + 3]) / 2.0;
+    let mut min = [f64::MAX; 2];
+    let mut max = [f64::MIN; 2];
+    for &i in items.iter() {
+        for axis in 0..2 {
+            min[axis] = min[axis].min(center(i, axis));
+            max[axis] = max[axis].max(center(i, axis));
+        }
+    }
+    if depth == 0 || items.len() <= branching * branching || (max[0] <= min[0] && max[1] <= min[1]) {
+        return items.into_iter().map(RootChild::Block).collect();
+    }
+
+    let mut cells: Vec<Vec<usize>> = vec![vec![]; branching * branching];
+    for &i in items.iter() {
+        let mut cell = [0usize; 2];
+        for axis in 0..2 {
+            let extent = max[axis] - min[axis];
+            if extent > 0.0 {
+                let k = ((center(i, axis) - min[axis]) / extent * branching as f64) as usize;
+                cell[axis] = k.min(branching - 1);
+            }
+        }
+        cells[cell[1] * branching + cell[0]].push(i);
+    }
+
+    let mut result = vec![];
+    for cell in cells {
+        if cell.len() <= 1 {
+            result.extend(cell.into_iter().map(RootChild::Block));
+            continue;
+        }
+        let mut box_v = vec![f64::MIN, f64::MIN, f64::MIN, f64::MAX, f64::MAX, f64::MAX];
+        for &i in cell.iter() {
+            for axis in 0..3 {
+                box_v[axis] = box_v[axis].max(tiles[i].box_v[axis]);
+                box_v[axis + 3] = box_v[axis + 3].min(tiles[i].box_v[axis + 3]);
+            }
+        }
+        let id = *next_id;
+        *next_id += 1;
+        let children = group_blocks(tiles, cell, branching, depth - 1, next_id);
+        result.push(RootChild::Group(BlockGroup {
+            id,
+            box_v,
+            children,
+        }));
+    }
+    result
+}
+
+fn collect_groups<'a>(children: &'a [RootChild], groups: &mut Vec<&'a BlockGroup>) {
+    for child in children {
+        if let RootChild::Group(group) = child {
+            groups.push(group);
+            collect_groups(&group.children, groups);
+        }
+    }
+}
+
+/// Largest geometric error of the blocks under `children`, a lower bound of
+/// the error of their grouping tile
+fn max_block_error(children: &[RootChild], tiles: &[TileResult]) -> f64 {
+    children.iter().fold(0.0f64, |e, c| match c {
+        RootChild::Block(i) => e.max(tiles[*i].geometric_error),
+        RootChild::Group(g) => e.max(max_block_error(&g.children, tiles)),
+    })
+}
+
+fn hlod_uri(id: usize) -> String {
+    format!("./hlod/{}.b3dm", id)
+}
+
+/// Tile of a root child and its geometric error. Grouping tiles with an
+/// HLOD proxy show it until they are refined, their error is the largest
+/// error of their children plus the measured error of the proxy (`proxies`
+/// maps the group id to it). Those without one have twice the largest
+/// error of their children.
+fn root_child_tile(
+    child: &RootChild,
+    tiles: &[TileResult],
+    out_dir: &str,
+    proxies: &std::collections::HashMap<usize, f64>,
+) -> (serde_json::Value, f64) {
+    match child {
+        RootChild::Block(i) => block_tile(&tiles[*i], out_dir),
+        RootChild::Group(group) => {
+            let children: Vec<_> = group
+                .children
+                .iter()
+                .map(|c| root_child_tile(c, tiles, out_dir, proxies))
+                .collect();
+            let max_child_error = children.iter().fold(0.0f64, |e, c| e.max(c.1));
+            let proxy_error = proxies.get(&group.id);
+            let geometric_error = match proxy_error {
+                Some(e) => max_child_error + e,
+                None => max_child_error * 2.0,
+            };
+            let mut tile = json!(
+                {
+                    "boundingVolume": {
+                        "box": box_to_tileset_box(&group.box_v)
+                    },
+                    "geometricError": geometric_error,
+                    "children": children.into_iter().map(|c| c.0).collect::<Vec<_>>()
+                }
+            );
+            if proxy_error.is_some() {
+                tile["refine"] = json!("REPLACE");
+                tile["content"] = json!({ "uri": hlod_uri(group.id) });
+            }
+            (tile, geometric_error)
+        }
+    }
+}
+
 #[allow(dead_code)]
 fn get_geometric_error(center_y: f64, lvl: i32) -> f64 {
     use std::f64;
@@ -279,7 +1000,7 @@ fn get_geometric_error(center_y: f64, lvl: i32) -> f64 {
     4.0 * round / (256 * pow) as f64
 }
 
-fn box_to_tileset_box(box_v: &Vec<f64>) -> Vec<f64> {
+pub fn box_to_tileset_box(box_v: &Vec<f64>) -> Vec<f64> {
     let mut box_new = vec![];
     box_new.push((box_v[0] + box_v[3]) / 2.0);
     box_new.push((box_v[1] + box_v[4]) / 2.0);
@@ -300,3 +1021,165 @@ fn box_to_tileset_box(box_v: &Vec<f64>) -> Vec<f64> {
     box_new
 }
 
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn block(name: &str, mem_estimate: u64) -> OsgbInfo {
+        let (sender, _) = ::std::sync::mpsc::channel();
+        OsgbInfo {
+            in_dir: name.to_string(),
+            out_dir: String::new(),
+            mem_estimate,
+            sender,
+        }
+    }
+
+    /// Block whose box is a unit cube around (x, y, 0)
+    fn tile(x: f64, y: f64) -> TileResult {
+        TileResult {
+            in_path: String::new(),
+            path: String::new(),
+            box_v: vec![x + 0.5, y + 0.5, 0.5, x - 0.5, y - 0.5, -0.5],
+            tile_box: vec![],
+            geometric_error: 0.0,
+        }
+    }
+
+    fn block_ids(children: &[RootChild]) -> Vec<usize> {
+        children
+            .iter()
+            .filter_map(|c| match c {
+                RootChild::Block(i) => Some(*i),
+                RootChild::Group(_) => None,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn block_queue_hands_out_largest_first() {
+        let queue = BlockQueue::new(100, vec![block("a", 10), block("b", 60), block("c", 30)]);
+        let (first, cost) = queue.next().unwrap();
+        assert_eq!((first.in_dir.as_str(), cost), ("b", 60));
+        let (second, _) = queue.next().unwrap();
+        assert_eq!(second.in_dir, "c");
+        let (third, _) = queue.next().unwrap();
+        assert_eq!(third.in_dir, "a");
+        assert!(queue.next().is_none());
+        assert_eq!(queue.peak(), 100);
+    }
+
+    #[test]
+    fn block_queue_skips_to_a_block_that_fits() {
+        let queue = BlockQueue::new(100, vec![block("a", 70), block("b", 50), block("c", 20)]);
+        let (first, _) = queue.next().unwrap();
+        assert_eq!(first.in_dir, "a");
+        // b does not fit next to a, c does
+        let (second, _) = queue.next().unwrap();
+        assert_eq!(second.in_dir, "c");
+        queue.release(70);
+        queue.release(20);
+        let (third, _) = queue.next().unwrap();
+        assert_eq!(third.in_dir, "b");
+    }
+
+    #[test]
+    fn block_queue_charges_a_block_over_the_limit_the_whole_limit() {
+        let queue = BlockQueue::new(100, vec![block("a", 500), block("b", 10)]);
+        let (first, cost) = queue.next().unwrap();
+        assert_eq!((first.in_dir.as_str(), cost), ("a", 100));
+        queue.release(cost);
+        let (second, cost) = queue.next().unwrap();
+        assert_eq!((second.in_dir.as_str(), cost), ("b", 10));
+        assert_eq!(queue.peak(), 100);
+    }
+
+    #[test]
+    fn estimate_counts_the_levels_up_to_max_lvl() {
+        let dir = std::env::temp_dir().join(format!("osgb_estimate_{}", std::process::id()));
+        let block_dir = dir.join("Tile_+000_+000");
+        fs::create_dir_all(&block_dir).unwrap();
+        let root = block_dir.join("Tile_+000_+000.osgb");
+        fs::write(&root, vec![0u8; 100]).unwrap();
+        fs::write(block_dir.join("Tile_+000_+000_L15_0.osgb"), vec![0u8; 200]).unwrap();
+        fs::write(block_dir.join("Tile_+000_+000_L21_0.osgb"), vec![0u8; 1000]).unwrap();
+        fs::write(block_dir.join("notes.txt"), vec![0u8; 5000]).unwrap();
+        // no image in the sample: 6 times the file sizes
+        assert_eq!(estimate_block_memory(&root, 20, 4), 300 * 6);
+        // one worker loads at most the largest file
+        assert_eq!(estimate_block_memory(&root, 20, 1), 200 * 6);
+        assert_eq!(estimate_block_memory(&root, 21, 4), 1300 * 6);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn embedded_png_size_is_decoded_rgba() {
+        let mut buf = vec![0u8; 8];
+        buf.extend_from_slice(b"\x89PNG\r\n\x1a\n\0\0\0\x0dIHDR");
+        buf.extend_from_slice(&[0, 0, 0, 16, 0, 0, 0, 8]);
+        buf.extend_from_slice(&[0u8; 16]);
+        assert_eq!(embedded_image_bytes(&buf), 16 * 8 * 4);
+        assert_eq!(embedded_image_bytes(&[0u8; 64]), 0);
+    }
+
+    #[test]
+    fn group_blocks_skips_empty_cells() {
+        // three blocks in the lower left cell, one lower right, one upper
+        // right, none upper left
+        let tiles = vec![tile(0.0, 0.0), tile(1.0, 1.0), tile(0.0, 1.0), tile(10.0, 0.0), tile(10.0, 10.0)];
+        let mut next_id = 0;
+        let children = group_blocks(&tiles, (0..tiles.len()).collect(), 2, 1, &mut next_id);
+        assert_eq!(children.len(), 3);
+        assert_eq!(next_id, 1);
+        match &children[0] {
+            RootChild::Group(group) => {
+                assert_eq!(group.id, 0);
+                assert_eq!(block_ids(&group.children), vec![0, 1, 2]);
+                assert_eq!(group.box_v, vec![1.5, 1.5, 0.5, -0.5, -0.5, -0.5]);
+            }
+            RootChild::Block(_) => panic!("the lower left cell is not grouped"),
+        }
+        assert_eq!(block_ids(&children[1..]), vec![3, 4]);
+    }
+
+    #[test]
+    fn group_blocks_keeps_small_or_coincident_sets_flat() {
+        let tiles: Vec<_> = (0..5).map(|i| tile(i as f64, 0.0)).collect();
+        let mut next_id = 0;
+        // no more blocks than cells
+        let children = group_blocks(&tiles, vec![0, 1, 2, 3], 2, 3, &mut next_id);
+        assert_eq!(block_ids(&children), vec![0, 1, 2, 3]);
+        // depth exhausted
+        let children = group_blocks(&tiles, (0..5).collect(), 2, 0, &mut next_id);
+        assert_eq!(block_ids(&children), vec![0, 1, 2, 3, 4]);
+        // every center at the same place
+        let same: Vec<_> = (0..5).map(|_| tile(3.0, 3.0)).collect();
+        let children = group_blocks(&same, (0..5).collect(), 2, 3, &mut next_id);
+        assert_eq!(block_ids(&children), vec![0, 1, 2, 3, 4]);
+        assert_eq!(next_id, 0);
+    }
+
+    #[test]
+    fn group_blocks_recurses_into_crowded_cells() {
+        // 3x3 blocks in the lower left cell, one in the upper right
+        let mut tiles = vec![];
+        for y in 0..3 {
+            for x in 0..3 {
+                tiles.push(tile(x as f64, y as f64));
+            }
+        }
+        tiles.push(tile(20.0, 20.0));
+        let mut next_id = 0;
+        let children = group_blocks(&tiles, (0..tiles.len()).collect(), 2, 2, &mut next_id);
+        assert_eq!(block_ids(&children), vec![9]);
+        let group = match &children[0] {
+            RootChild::Group(group) => group,
+            RootChild::Block(_) => panic!("the crowded cell is not grouped"),
+        };
+        // 9 blocks over 2x2 cells: the corner block alone, then 2, 2 and 4
+        assert_eq!(next_id, 4);
+        assert_eq!(block_ids(&group.children), vec![0]);
+        assert_eq!(group.children.len(), 4);
+    }
+}
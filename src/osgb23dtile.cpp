@@ -1,7 +1,11 @@
+#include <osg/Geode>
 #include <osg/Material>
 #include <osg/PagedLOD>
+#include <osg/Texture2D>
+#include <osg/TriangleIndexFunctor>
 #include <osgDB/ReadFile>
 #include <osgDB/ConvertUTF>
+#include <osgDB/FileNameUtils>
 #include <osgUtil/Optimizer>
 #include <osgUtil/SmoothingVisitor>
 #include <Eigen/Eigen>
@@ -15,6 +19,12 @@
 #include <algorithm>
 #include <cstdint>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 // Add Basis Universal includes for KTX2 compression
 #include <basisu/encoder/basisu_comp.h>
@@ -30,6 +40,11 @@
 #include <nlohmann/json.hpp>
 #include "extern.h"
 #include "GeoTransform.h"
+#include "osgb.h"
+#include "thread_pool.h"
+#include "file_prefetch.h"
+#include "osgb_reader.h"
+#include "tile_manifest.h"
 
 using namespace std;
 
@@ -95,6 +110,11 @@ void log_osg_plugin_info() {
     printf("=== End of OSG Plugin Information ===\n\n");
 }
 
+void log_osg_plugin_info_once() {
+    static std::once_flag logged;
+    std::call_once(logged, log_osg_plugin_info);
+}
+
 template<class T>
 void put_val(std::vector<unsigned char>& buf, T val) {
     buf.insert(buf.end(), (unsigned char*)&val, (unsigned char*)&val + sizeof(T));
@@ -137,15 +157,138 @@ struct osg_tree {
     std::vector<osg_tree> sub_nodes;
     // When the node contains PagedLOD and Other nodes, create a new group node
     int type; // 0: group, 1: PagedLOD nodes (default), 2: Other nodes;
+    std::string content_uri;    // merged or split content, overrides the name derived from file_name
+    uint64_t content_size = 0;  // b3dm bytes, 0 if unknown
+    double simplify_error = 0;  // measured simplification error of the content, see MeshInfo
+    int merge_count = 0;        // leaves sharing the merged content_uri, 0 if not merged
 };
 
+
+// Min/max of packed xyz floats
+void vertex_bounds(const float* xyz, size_t count, glm::dvec3& Min, glm::dvec3& Max)
+{
+    float min_x = xyz[0], min_y = xyz[1], min_z = xyz[2];
+    float max_x = min_x, max_y = min_y, max_z = min_z;
+    for (size_t i = 1; i < count; i++) {
+        const float* p = xyz + i * 3;
+        min_x = std::min(min_x, p[0]); max_x = std::max(max_x, p[0]);
+        min_y = std::min(min_y, p[1]); max_y = std::max(max_y, p[1]);
+        min_z = std::min(min_z, p[2]); max_z = std::max(max_z, p[2]);
+    }
+    Min = glm::min(Min, glm::dvec3(min_x, min_y, min_z));
+    Max = glm::max(Max, glm::dvec3(max_x, max_y, max_z));
+}
+
+// Applies an affine matrix to packed xyz floats in place. The matrix is
+// unpacked once and the loop has no calls or branches, so it is compiled to
+// SIMD code instead of going through Vec3Array::at() and glm::dvec4 per point.
+void transform_vertices(float* xyz, size_t count, const glm::dmat4& m)
+{
+    const double m00 = m[0][0], m01 = m[1][0], m02 = m[2][0], m03 = m[3][0];
+    const double m10 = m[0][1], m11 = m[1][1], m12 = m[2][1], m13 = m[3][1];
+    const double m20 = m[0][2], m21 = m[1][2], m22 = m[2][2], m23 = m[3][2];
+    for (size_t i = 0; i < count; i++) {
+        float* p = xyz + i * 3;
+        const double x = p[0], y = p[1], z = p[2];
+        p[0] = (float)(m00 * x + m01 * y + m02 * z + m03);
+        p[1] = (float)(m10 * x + m11 * y + m12 * z + m13);
+        p[2] = (float)(m20 * x + m21 * y + m22 * z + m23);
+    }
+}
+
+/**
+ * 2. We correct the eight points of the bounding box.
+ * The point will be transformed from projected coordinate system
+ * which is given by the original osgb tileset to geographic coordinate system,
+ * and then transformed to Cesium ECEF coordinate system,
+ * at last we transform the point from ECEF to the ENU of the origin.
+ * We do this to correct the coordinate offset that
+ * can occur when the tile is located far from the origin.
+ * All points go through PROJ in a single Transform() call.
+ */
+bool correct_points(const GeoReference& geo_ref, const std::vector<glm::dvec4>& points, std::vector<glm::dvec4>& corrected)
+{
+    const glm::dvec3 origin(geo_ref.OriginX, geo_ref.OriginY, geo_ref.OriginZ);
+    corrected.resize(points.size());
+    // Use the explicit IsENU flag set by SetGeographicOrigin()
+    if (geo_ref.IsENU) {
+        for (size_t i = 0; i < points.size(); i++) {
+            // For ENU: Point is already in ENU meters relative to the geographic origin
+            // Add the SRSOrigin offset to get the absolute ENU position
+            glm::dvec3 absoluteENU = glm::dvec3(points[i]) + origin;
+            // Convert ENU meters to ECEF, then back to ENU for the correction matrix
+            glm::dvec3 ecef = geo_ref.EnuToEcefMatrix * glm::dvec4(absoluteENU, 1);
+            corrected[i] = geo_ref.EcefToEnuMatrix * glm::dvec4(ecef, 1);
+        }
+        return true;
+    }
+    // For EPSG: add projected origin and transform
+    std::vector<double> xs(points.size()), ys(points.size()), zs(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        xs[i] = points[i].x + origin.x;
+        ys[i] = points[i].y + origin.y;
+        zs[i] = points[i].z + origin.z;
+    }
+    if (!geo_ref.Transform((int)points.size(), xs.data(), ys.data(), zs.data()))
+        return false;
+    for (size_t i = 0; i < points.size(); i++) {
+        glm::dvec3 ecef = GeoTransform::CartographicToEcef(xs[i], ys[i], zs[i]);
+        corrected[i] = geo_ref.EcefToEnuMatrix * glm::dvec4(ecef, 1);
+    }
+    return true;
+}
+
+bool solve_correction_matrix(const GeoReference& geo_ref, const glm::dvec3& Min, const glm::dvec3& Max, glm::dmat4& Transform)
+{
+    vector<glm::dvec4> OriginalPoints(8);
+    vector<glm::dvec4> CorrectedPoints(8);
+    OriginalPoints[0] = glm::dvec4(Min.x, Min.y, Min.z, 1);
+    OriginalPoints[1] = glm::dvec4(Max.x, Min.y, Min.z, 1);
+    OriginalPoints[2] = glm::dvec4(Min.x, Max.y, Min.z, 1);
+    OriginalPoints[3] = glm::dvec4(Min.x, Min.y, Max.z, 1);
+    OriginalPoints[4] = glm::dvec4(Max.x, Max.y, Min.z, 1);
+    OriginalPoints[5] = glm::dvec4(Min.x, Max.y, Max.z, 1);
+    OriginalPoints[6] = glm::dvec4(Max.x, Min.y, Max.z, 1);
+    OriginalPoints[7] = glm::dvec4(Max.x, Max.y, Max.z, 1);
+    if (!correct_points(geo_ref, OriginalPoints, CorrectedPoints)) {
+        LOG_E("transform of the tile bounding box failed, tile is not corrected");
+        return false;
+    }
+
+    /**
+     * 3. We use the least squares method to calculate the transformation matrix
+     * that transforms the original box to the corrected box.
+    */
+    Eigen::MatrixXd A, B;
+    A.resize(8, 4);
+    B.resize(8, 4);
+    for (int row = 0; row < 8; row++)
+    {
+        A.row(row) << OriginalPoints[row].x, OriginalPoints[row].y, OriginalPoints[row].z, 1;
+    }
+    for (int row = 0; row < 8; row++)
+    {
+        B.row(row) << CorrectedPoints[row].x, CorrectedPoints[row].y, CorrectedPoints[row].z, 1;
+    }
+    Eigen::BDCSVD<Eigen::MatrixXd> SVD(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    Eigen::MatrixXd X = SVD.solve(B);
+
+    Transform = glm::dmat4(
+        X(0, 0), X(0, 1), X(0, 2), X(0, 3),
+        X(1, 0), X(1, 1), X(1, 2), X(1, 3),
+        X(2, 0), X(2, 1), X(2, 2), X(2, 3),
+        X(3, 0), X(3, 1), X(3, 2), X(3, 3));
+    return true;
+}
+
 class InfoVisitor : public osg::NodeVisitor
 {
     std::string path;
 public:
-    InfoVisitor(std::string _path, bool loadAllType = false)
+    InfoVisitor(std::string _path, bool loadAllType = false, const GeoReference* _geo_ref = nullptr)
     :osg::NodeVisitor(TRAVERSE_ALL_CHILDREN)
     , path(_path), is_loadAllType(loadAllType), is_pagedlod(loadAllType)
+    , geo_ref(_geo_ref && _geo_ref->HasTransform() ? _geo_ref : nullptr)
     {}
 
     ~InfoVisitor() {
@@ -162,108 +305,11 @@ public:
         else
             other_geometry_array.push_back(&geometry);
 
-        if (GeoTransform::pOgrCT)
-        {
-            osg::Vec3Array *vertexArr = (osg::Vec3Array *)geometry.getVertexArray();
-            OGRCoordinateTransformation *poCT = GeoTransform::pOgrCT.get();
-
-            /** 1. We obtain the bound of this tile */
-            glm::dvec3 Min = glm::dvec3(DBL_MAX);
-            glm::dvec3 Max = glm::dvec3(-DBL_MAX);
-            for (int VertexIndex = 0; VertexIndex < vertexArr->size(); VertexIndex++)
-            {
-                osg::Vec3d Vertex = vertexArr->at(VertexIndex);
-                glm::dvec3 vertex = glm::dvec3(Vertex.x(), Vertex.y(), Vertex.z());
-                Min = glm::min(vertex, Min);
-                Max = glm::max(vertex, Max);
-            }
-
-            /**
-             * 2. We correct the eight points of the bounding box.
-             * The point will be transformed from projected coordinate system
-             * which is given by the original osgb tileset to geographic coordinate system,
-             * and then transformed to Cesium ECEF coordinate system,
-             * at last we transform the point from ECEF to the ENU of the origin.
-             * We do this to correct the coordinate offset that
-             * can occur when the tile is located far from the origin.
-             */
-            auto Correction = [&](glm::dvec3 Point) {
-                // Use the explicit IsENU flag set by SetGeographicOrigin()
-                if (GeoTransform::IsENU) {
-                    // For ENU: Point is already in ENU meters relative to the geographic origin
-                    // Add the SRSOrigin offset to get the absolute ENU position
-                    glm::dvec3 absoluteENU = Point + glm::dvec3(GeoTransform::OriginX, GeoTransform::OriginY, GeoTransform::OriginZ);
-                    // Convert ENU meters to ECEF, then back to ENU for the correction matrix
-                    glm::dvec3 ecef = GeoTransform::CartographicToEcef(GeoTransform::GeoOriginLon, GeoTransform::GeoOriginLat, GeoTransform::GeoOriginHeight);
-                    // Apply ENU->ECEF rotation at origin
-                    const double pi = std::acos(-1.0);
-                    double lat = GeoTransform::GeoOriginLat * pi / 180.0;
-                    double lon = GeoTransform::GeoOriginLon * pi / 180.0;
-                    double sinLat = std::sin(lat), cosLat = std::cos(lat);
-                    double sinLon = std::sin(lon), cosLon = std::cos(lon);
-                    // ENU to ECEF rotation
-                    double ecef_x = -sinLon * absoluteENU.x - sinLat * cosLon * absoluteENU.y + cosLat * cosLon * absoluteENU.z;
-                    double ecef_y =  cosLon * absoluteENU.x - sinLat * sinLon * absoluteENU.y + cosLat * sinLon * absoluteENU.z;
-                    double ecef_z =  cosLat * absoluteENU.y + sinLat * absoluteENU.z;
-                    ecef = glm::dvec3(ecef.x + ecef_x, ecef.y + ecef_y, ecef.z + ecef_z);
-                    glm::dvec3 enu = GeoTransform::EcefToEnuMatrix * glm::dvec4(ecef, 1);
-                    return enu;
-                } else {
-                    // For EPSG: Original logic - add projected origin and transform
-                    glm::dvec3 cartographic = Point + glm::dvec3(GeoTransform::OriginX, GeoTransform::OriginY, GeoTransform::OriginZ);
-                    poCT->Transform(1, &cartographic.x, &cartographic.y, &cartographic.z);
-                    glm::dvec3 ecef = GeoTransform::CartographicToEcef(cartographic.x, cartographic.y, cartographic.z);
-                    glm::dvec3 enu = GeoTransform::EcefToEnuMatrix * glm::dvec4(ecef, 1);
-                    return enu;
-                }
-            };
-            vector<glm::dvec4> OriginalPoints(8);
-            vector<glm::dvec4> CorrectedPoints(8);
-            OriginalPoints[0] = glm::dvec4(Min.x, Min.y, Min.z, 1);
-            OriginalPoints[1] = glm::dvec4(Max.x, Min.y, Min.z, 1);
-            OriginalPoints[2] = glm::dvec4(Min.x, Max.y, Min.z, 1);
-            OriginalPoints[3] = glm::dvec4(Min.x, Min.y, Max.z, 1);
-            OriginalPoints[4] = glm::dvec4(Max.x, Max.y, Min.z, 1);
-            OriginalPoints[5] = glm::dvec4(Min.x, Max.y, Max.z, 1);
-            OriginalPoints[6] = glm::dvec4(Max.x, Min.y, Max.z, 1);
-            OriginalPoints[7] = glm::dvec4(Max.x, Max.y, Max.z, 1);
-            for (int i = 0; i < 8; i++)
-                CorrectedPoints[i] = glm::dvec4(Correction(OriginalPoints[i]), 1);
-
-            /**
-             * 3. We use the least squares method to calculate the transformation matrix
-             * that transforms the original box to the corrected box.
-            */
-            Eigen::MatrixXd A, B;
-            A.resize(8, 4);
-            B.resize(8, 4);
-            for (int row = 0; row < 8; row++)
-            {
-                A.row(row) << OriginalPoints[row].x, OriginalPoints[row].y, OriginalPoints[row].z, 1;
-            }
-            for (int row = 0; row < 8; row++)
-            {
-                B.row(row) << CorrectedPoints[row].x, CorrectedPoints[row].y, CorrectedPoints[row].z, 1;
-            }
-            Eigen::BDCSVD<Eigen::MatrixXd> SVD(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
-            Eigen::MatrixXd X = SVD.solve(B);
-
-            /*
-             * 4. At last we apply the matrix to all the points of the tile to correct the offset.
-            */
-            glm::dmat4 Transform = glm::dmat4(
-                X(0, 0), X(0, 1), X(0, 2), X(0, 3),
-                X(1, 0), X(1, 1), X(1, 2), X(1, 3),
-                X(2, 0), X(2, 1), X(2, 2), X(2, 3),
-                X(3, 0), X(3, 1), X(3, 2), X(3, 3));
-
-            for (int VertexIndex = 0; VertexIndex < vertexArr->size(); VertexIndex++)
-            {
-                osg::Vec3d Vertex = vertexArr->at(VertexIndex);
-                glm::dvec4 v = Transform * glm::dvec4(Vertex.x(), Vertex.y(), Vertex.z(), 1);
-                Vertex = osg::Vec3d(v.x, v.y, v.z);
-                vertexArr->at(VertexIndex) = Vertex;
-            }
+        // shared arrays are only corrected once, see apply_correction()
+        if (geo_ref) {
+            osg::Vec3Array* vertexArr = dynamic_cast<osg::Vec3Array*>(geometry.getVertexArray());
+            if (vertexArr && vertex_array_set.insert(vertexArr).second)
+                vertex_arrays.push_back(vertexArr);
         }
         if (auto ss = geometry.getStateSet() ) {
             osg::Texture* tex = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
@@ -280,14 +326,55 @@ public:
     void apply(osg::PagedLOD& node) {
         //std::string path = node.getDatabasePath();
         int n = node.getNumFileNames();
+        size_t first_name = sub_node_names.size();
         for (size_t i = 1; i < n; i++)
         {
+            // a child whose range is empty is never displayed, don't load it
+            if (i < node.getNumRanges() && node.getMinRange(i) >= node.getMaxRange(i))
+                continue;
             std::string file_name = path + "/" + node.getFileName(i);
             sub_node_names.push_back(file_name);
         }
+        size_t end_name = sub_node_names.size();
+        size_t first = geometry_array.size();
         if (!is_loadAllType) is_pagedlod = true;
         traverse(node);
         if (!is_loadAllType) is_pagedlod = false;
+        if (end_name > first_name && geometry_array.size() > first)
+            paged_ranges.push_back({ first, geometry_array.size(), first_name, end_name });
+    }
+
+    /**
+     * Corrects the offset between the source projection and the ENU of the
+     * origin for every collected vertex array. The correction is an affine
+     * matrix fitted on the bounding box of the whole file, so it is solved
+     * once per file instead of once per geometry.
+     */
+    void apply_correction() {
+        if (vertex_arrays.empty() || !geo_ref)
+            return;
+
+        /** 1. We obtain the bound of this tile */
+        glm::dvec3 Min = glm::dvec3(DBL_MAX);
+        glm::dvec3 Max = glm::dvec3(-DBL_MAX);
+        for (auto vertexArr : vertex_arrays) {
+            if (!vertexArr->empty())
+                vertex_bounds((const float*)vertexArr->getDataPointer(), vertexArr->size(), Min, Max);
+        }
+        if (Min.x > Max.x)
+            return;
+
+        glm::dmat4 Transform;
+        if (!solve_correction_matrix(*geo_ref, Min, Max, Transform))
+            return;
+
+        /** 4. At last we apply the matrix to all the points of the tile to correct the offset. */
+        for (auto vertexArr : vertex_arrays) {
+            if (vertexArr->empty())
+                continue;
+            transform_vertices((float*)vertexArr->getDataPointer(), vertexArr->size(), Transform);
+            vertexArr->dirty();
+        }
     }
 
 public:
@@ -296,13 +383,68 @@ public:
     std::set<osg::Texture*> texture_array;
     std::map<osg::Geometry*, osg::Texture*> texture_map;
     std::vector<std::string> sub_node_names;
+    // Geometries of a PagedLOD with child files, [first, end) in
+    // geometry_array, and its files, [first_name, end_name) in sub_node_names
+    struct PagedRange {
+        size_t first, end;
+        size_t first_name, end_name;
+    };
+    std::vector<PagedRange> paged_ranges;
     bool is_loadAllType; // true: Store all geometry to geometry_array, false: Store by type
     bool is_pagedlod;
     // Storing Other Geometry
     std::vector<osg::Geometry*> other_geometry_array;
     std::set<osg::Texture*> other_texture_array;
+    // Georeference used by apply_correction(), null: no correction
+    const GeoReference* geo_ref;
+    // Vertex arrays waiting for apply_correction()
+    std::vector<osg::Vec3Array*> vertex_arrays;
+    std::set<osg::Vec3Array*> vertex_array_set;
 };
 
+// OsgbNormalsMode with OSGB_NORMALS_AUTO resolved
+int resolve_normals_mode(int mode, bool enable_unlit) {
+    if (mode != OSGB_NORMALS_AUTO)
+        return mode;
+    return enable_unlit ? OSGB_NORMALS_STRIP : OSGB_NORMALS_GENERATE;
+}
+
+// Applies a resolved OsgbNormalsMode to every geometry. Normals that are not
+// one per vertex can't be written as a glTF attribute: they are dropped, or
+// computed again for OSGB_NORMALS_GENERATE.
+class NormalsVisitor : public osg::NodeVisitor
+{
+public:
+    NormalsVisitor(int _mode)
+    :osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), mode(_mode)
+    {}
+
+    void apply(osg::Geometry& geometry) {
+        osg::Array* vertices = geometry.getVertexArray();
+        osg::Array* normals = geometry.getNormalArray();
+        if (mode == OSGB_NORMALS_STRIP || !vertices || vertices->getNumElements() == 0) {
+            if (normals)
+                geometry.setNormalArray(nullptr);
+            return;
+        }
+        bool per_vertex = normals && geometry.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX
+            && normals->getNumElements() >= vertices->getNumElements();
+        if (per_vertex)
+            return;
+        if (mode == OSGB_NORMALS_GENERATE)
+            osgUtil::SmoothingVisitor::smooth(geometry);
+        else if (normals)
+            geometry.setNormalArray(nullptr);
+    }
+
+    int mode;
+};
+
+void apply_normals_mode(osg::Node* root, int mode, bool enable_unlit) {
+    NormalsVisitor visitor(resolve_normals_mode(mode, enable_unlit));
+    root->accept(visitor);
+}
+
 double get_geometric_error(TileBox& bbox){
     if (bbox.max.empty() || bbox.min.empty())
     {
@@ -417,57 +559,13 @@ int get_lvl_num(std::string file_name){
     return -1;
 }
 
-osg_tree get_all_tree(std::string& file_name) {
-    osg_tree root_tile;
-    vector<string> fileNames = { file_name };
-
-    // Log OSG plugin information on first call
-    static bool logged = false;
-    if (!logged) {
-        log_osg_plugin_info();
-        logged = true;
-    }
-
-    InfoVisitor infoVisitor(get_parent(file_name));
-    {   // add block to release Node
-        osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
-        if (!root) {
-            std::string name = utf8_string(file_name.c_str());
-            LOG_E("read node files [%s] fail!", name.c_str());
-            return root_tile;
-        }
-        root_tile.file_name = file_name;
-        root_tile.type = 1;
-        root->accept(infoVisitor);
-    }
-
-    for (auto& i : infoVisitor.sub_node_names) {
-        osg_tree tree = get_all_tree(i);
-        if (!tree.file_name.empty()) {
-            // When the node type is Group, simply add its child nodes to the current node
-            if (tree.type == 0) {
-                for (auto& node : tree.sub_nodes)
-                    root_tile.sub_nodes.push_back(node);
-            }
-            else {
-                root_tile.sub_nodes.push_back(tree);
-            }
-        }
-    }
-
-    // When the node contains PagedLOD and Other nodes, create a new group node
-    if (!infoVisitor.other_geometry_array.empty() && !infoVisitor.geometry_array.empty()) {
-        osg_tree new_root_tile;
-        new_root_tile.type = 0;
-        new_root_tile.file_name = file_name;
-        osg_tree tile;
-        tile.type = 2;
-        tile.file_name = file_name;
-        new_root_tile.sub_nodes.push_back(root_tile);
-        new_root_tile.sub_nodes.push_back(tile);
-        root_tile = new_root_tile;
-    }
-    return root_tile;
+// Level of a PagedLOD file: the _L<n>_ of its name, or one more than its
+// parent's level when the name carries none. -1 if unknown.
+int get_tile_level(const std::string& file_name, int parent_level) {
+    int lvl = get_lvl_num(file_name);
+    if (lvl < 0 && parent_level >= 0)
+        lvl = parent_level + 1;
+    return lvl;
 }
 
 struct MeshInfo
@@ -475,6 +573,7 @@ struct MeshInfo
     string name;
     std::vector<double> min;
     std::vector<double> max;
+    double simplify_error = 0;  // largest simplify_mesh_geometry error, in meters
 };
 
 template<class T>
@@ -501,6 +600,7 @@ struct OsgBuildState
     osg::Vec3f point_min;
     int draw_array_first;
     int draw_array_count;
+    float simplify_error;
 };
 
 void expand_bbox3d(osg::Vec3f& point_max, osg::Vec3f& point_min, osg::Vec3f point)
@@ -1029,41 +1129,62 @@ void write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps,
   }
 }
 
-void write_osgGeometry(osg::Geometry* g, OsgBuildState* osgState, bool enable_simplify, bool enable_draco)
+// Result of encode_osgGeometry, written to the glb by write_osgGeometry
+struct GeometryEncoding {
+    float simplify_error = 0;
+    bool compressed = false;
+    std::vector<unsigned char> draco_data;
+    int posId = -1;
+    int normId = -1;
+    int texId = -1;
+    int batchId = -1;
+};
+
+// Simplifies, optimizes and Draco compresses one geometry in place. Only g
+// and enc are touched, so the geometries of a tile can be encoded
+// concurrently; g must be a copy, see geometry2glb_buf().
+void encode_osgGeometry(osg::Geometry* g, bool enable_simplify, bool enable_draco, bool enable_optimize,
+                        const DracoCompressionParams& draco_params, GeometryEncoding& enc)
 {
     if (enable_simplify) {
         const SimplificationParams simplication_params = { .enable_simplification = true };
-        ::simplify_mesh_geometry(g, simplication_params);
+        float simplify_error = 0;
+        if (::simplify_mesh_geometry(g, simplication_params, &simplify_error))
+            enc.simplify_error = simplify_error;
+    }
+    if (enable_optimize) {
+        ::optimize_mesh_geometry(g);
     }
-    // Apply Draco compression if enabled
-    DracoState dracoState = {false, -1, -1, -1, -1, -1};
     if (enable_draco) {
-        std::vector<unsigned char> compressed_data;
         size_t compressed_size = 0;
-        const DracoCompressionParams draco_params = { .enable_compression = true };
-        int dracoPosId = -1, dracoNormId = -1, dracoTexId = -1, dracoBatchId = -1;
-        bool ok = ::compress_mesh_geometry(g, draco_params, compressed_data, compressed_size,
-                                         &dracoPosId, &dracoNormId, &dracoTexId, &dracoBatchId, nullptr);
-        if (ok && compressed_size > 0) {
-            unsigned bufOffset = osgState->buffer->data.size();
-            alignment_buffer(osgState->buffer->data);
-            bufOffset = osgState->buffer->data.size();
-            osgState->buffer->data.resize(bufOffset + compressed_size);
-            std::memcpy(osgState->buffer->data.data() + bufOffset, compressed_data.data(), compressed_size);
-            tinygltf::BufferView bv;
-            bv.buffer = 0;
-            bv.byteOffset = bufOffset;
-            bv.byteLength = compressed_size;
-            int bvIdx = (int)osgState->model->bufferViews.size();
-            osgState->model->bufferViews.push_back(bv);
-            dracoState.compressed = true;
-            dracoState.bufferView = bvIdx;
-            dracoState.posId = dracoPosId;
-            dracoState.normId = dracoNormId;
-            dracoState.texId = dracoTexId;
-            dracoState.batchId = dracoBatchId;
-        }
-  }
+        bool ok = ::compress_mesh_geometry(g, draco_params, enc.draco_data, compressed_size,
+                                         &enc.posId, &enc.normId, &enc.texId, &enc.batchId, nullptr);
+        enc.compressed = ok && compressed_size > 0;
+        enc.draco_data.resize(enc.compressed ? compressed_size : 0);
+    }
+}
+
+void write_osgGeometry(osg::Geometry* g, OsgBuildState* osgState, const GeometryEncoding& enc)
+{
+    osgState->simplify_error = std::max(osgState->simplify_error, enc.simplify_error);
+    DracoState dracoState = {false, -1, -1, -1, -1, -1};
+    if (enc.compressed) {
+        alignment_buffer(osgState->buffer->data);
+        unsigned bufOffset = osgState->buffer->data.size();
+        osgState->buffer->data.insert(osgState->buffer->data.end(), enc.draco_data.begin(), enc.draco_data.end());
+        tinygltf::BufferView bv;
+        bv.buffer = 0;
+        bv.byteOffset = bufOffset;
+        bv.byteLength = enc.draco_data.size();
+        int bvIdx = (int)osgState->model->bufferViews.size();
+        osgState->model->bufferViews.push_back(bv);
+        dracoState.compressed = true;
+        dracoState.bufferView = bvIdx;
+        dracoState.posId = enc.posId;
+        dracoState.normId = enc.normId;
+        dracoState.texId = enc.texId;
+        dracoState.batchId = enc.batchId;
+    }
 
   osg::PrimitiveSet::Type t = g->getPrimitiveSet(0)->getType();
   PrimitiveState pmtState = {-1, -1, -1};
@@ -1077,32 +1198,181 @@ void write_osgGeometry(osg::Geometry* g, OsgBuildState* osgState, bool enable_si
   }
 }
 
-bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
-    vector<string> fileNames = { path };
-    std::string parent_path = get_parent(path);
+struct TriangleCollector {
+    std::vector<unsigned int>* indices = nullptr;
+    void operator()(unsigned int i1, unsigned int i2, unsigned int i3) {
+        indices->push_back(i1);
+        indices->push_back(i2);
+        indices->push_back(i3);
+    }
+};
+
+bool is_triangle_mode(GLenum mode) {
+    return mode == GL_TRIANGLES || mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN
+        || mode == GL_QUADS || mode == GL_QUAD_STRIP || mode == GL_POLYGON;
+}
 
-    // Log OSG plugin information on first call
-    static bool logged = false;
-    if (!logged) {
-        log_osg_plugin_info();
-        logged = true;
+// Geometries of one texture whose triangles are written as one primitive
+struct GeometryMerge {
+    osg::Texture* texture;
+    bool normals;
+    bool texcoords;
+    std::vector<osg::Geometry*> members;
+};
+
+/**
+ * Merges the geometries sharing a texture (and the same set of vertex
+ * attributes) into one indexed GL_TRIANGLES geometry, so that a tile is
+ * written with one glTF primitive per texture instead of one per
+ * osg::PrimitiveSet. Strips, fans, quads and polygons are triangulated.
+ * Geometries holding points or lines, or arrays of other types, are kept
+ * as they are. The merged geometries are owned by `owned`.
+ */
+void merge_geometries_by_texture(const std::vector<osg::Geometry*>& geometry_array,
+                                 std::map<osg::Geometry*, osg::Texture*>& texture_map,
+                                 std::vector<osg::ref_ptr<osg::Geometry>>& owned,
+                                 std::vector<osg::Geometry*>& merged_array)
+{
+    std::vector<GeometryMerge> merges;
+    for (auto g : geometry_array) {
+        osg::Vec3Array* v3f = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+        bool mergeable = v3f && !v3f->empty() && g->getNumPrimitiveSets() > 0;
+        for (unsigned int k = 0; mergeable && k < g->getNumPrimitiveSets(); k++)
+            mergeable = is_triangle_mode(g->getPrimitiveSet(k)->getMode());
+        if (!mergeable) {
+            merged_array.push_back(g);
+            continue;
+        }
+        osg::Vec3Array* n3f = dynamic_cast<osg::Vec3Array*>(g->getNormalArray());
+        osg::Vec2Array* v2f = dynamic_cast<osg::Vec2Array*>(g->getTexCoordArray(0));
+        bool normals = n3f && g->getNormalBinding() == osg::Geometry::BIND_PER_VERTEX && n3f->size() >= v3f->size();
+        bool texcoords = v2f && v2f->size() >= v3f->size();
+        auto it = texture_map.find(g);
+        osg::Texture* tex = it != texture_map.end() ? it->second : nullptr;
+        auto merge = std::find_if(merges.begin(), merges.end(), [&](const GeometryMerge& m) {
+            return m.texture == tex && m.normals == normals && m.texcoords == texcoords;
+        });
+        if (merge == merges.end())
+            merge = merges.insert(merges.end(), GeometryMerge{ tex, normals, texcoords, {} });
+        merge->members.push_back(g);
+    }
+
+    for (auto& merge : merges) {
+        // nothing to merge nor to triangulate
+        osg::Geometry* first = merge.members.front();
+        if (merge.members.size() == 1 && first->getNumPrimitiveSets() == 1
+            && first->getPrimitiveSet(0)->getMode() == GL_TRIANGLES) {
+            merged_array.push_back(first);
+            continue;
+        }
+        osg::ref_ptr<osg::Geometry> merged = new osg::Geometry;
+        osg::ref_ptr<osg::Vec3Array> m_v3f = new osg::Vec3Array;
+        osg::ref_ptr<osg::Vec3Array> m_n3f = merge.normals ? new osg::Vec3Array : nullptr;
+        osg::ref_ptr<osg::Vec2Array> m_v2f = merge.texcoords ? new osg::Vec2Array : nullptr;
+        osg::ref_ptr<osg::DrawElementsUInt> elements = new osg::DrawElementsUInt(GL_TRIANGLES);
+        std::vector<unsigned int> triangles;
+        std::vector<int> remap;
+        for (auto g : merge.members) {
+            osg::Vec3Array* v3f = static_cast<osg::Vec3Array*>(g->getVertexArray());
+            osg::Vec3Array* n3f = static_cast<osg::Vec3Array*>(g->getNormalArray());
+            osg::Vec2Array* v2f = static_cast<osg::Vec2Array*>(g->getTexCoordArray(0));
+            osg::TriangleIndexFunctor<TriangleCollector> collector;
+            triangles.clear();
+            collector.indices = &triangles;
+            g->accept(collector);
+            // only the vertices used by the triangles are copied
+            remap.assign(v3f->size(), -1);
+            for (auto idx : triangles) {
+                if (idx >= v3f->size())
+                    continue;
+                if (remap[idx] < 0) {
+                    remap[idx] = (int)m_v3f->size();
+                    m_v3f->push_back((*v3f)[idx]);
+                    if (m_n3f)
+                        m_n3f->push_back((*n3f)[idx]);
+                    if (m_v2f)
+                        m_v2f->push_back((*v2f)[idx]);
+                }
+            }
+            for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+                if (triangles[i] >= v3f->size() || triangles[i + 1] >= v3f->size() || triangles[i + 2] >= v3f->size())
+                    continue;
+                for (size_t j = i; j < i + 3; j++)
+                    elements->push_back((unsigned int)remap[triangles[j]]);
+            }
+        }
+        if (elements->empty())
+            continue;
+        merged->setVertexArray(m_v3f.get());
+        if (m_n3f)
+            merged->setNormalArray(m_n3f.get(), osg::Array::BIND_PER_VERTEX);
+        if (m_v2f)
+            merged->setTexCoordArray(0, m_v2f.get());
+        merged->addPrimitiveSet(elements.get());
+        merged->setStateSet(first->getStateSet());
+        owned.push_back(merged);
+        merged_array.push_back(merged.get());
+        if (merge.texture)
+            texture_map[merged.get()] = merge.texture;
     }
+}
 
-    osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
-    if (!root.valid()) {
+// Builds the glb for an already loaded (and corrected) set of geometries.
+// The scene graph owning the geometries must stay alive for the call.
+bool geometry2glb_buf(std::vector<osg::Geometry*>& geometry_array, std::set<osg::Texture*>& texture_array,
+                      std::map<osg::Geometry*, osg::Texture*>& texture_map,
+                      std::string& glb_buff, MeshInfo& mesh_info,
+                      bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true,
+                      bool enable_optimize = false, int draco_encoding_speed = 5, int draco_decoding_speed = 5,
+                      bool enable_meshopt_compression = false, bool enable_quantize = false,
+                      double draco_position_error = 0.0) {
+    if (geometry_array.empty())
         return false;
+
+    // one primitive per texture, see merge_geometries_by_texture()
+    std::map<osg::Geometry*, osg::Texture*> merged_texture_map = texture_map;
+    std::vector<osg::ref_ptr<osg::Geometry>> merged_owned;
+    std::vector<osg::Geometry*> merged_array;
+    merge_geometries_by_texture(geometry_array, merged_texture_map, merged_owned, merged_array);
+
+    // simplification and optimization replace the arrays of a geometry, so
+    // the ones passed through unmerged are encoded from a copy: a content
+    // encoded again, e.g. split into parts, starts from the same triangles
+    if (enable_meshopt || enable_optimize) {
+        for (auto& g : merged_array) {
+            bool copied = std::any_of(merged_owned.begin(), merged_owned.end(),
+                                      [g](const osg::ref_ptr<osg::Geometry>& m) { return m.get() == g; });
+            if (copied)
+                continue;
+            osg::ref_ptr<osg::Geometry> copy =
+                new osg::Geometry(*g, osg::CopyOp::DEEP_COPY_ARRAYS | osg::CopyOp::DEEP_COPY_PRIMITIVES);
+            auto it = merged_texture_map.find(g);
+            if (it != merged_texture_map.end())
+                merged_texture_map[copy.get()] = it->second;
+            merged_owned.push_back(copy);
+            g = copy.get();
+        }
     }
-    InfoVisitor infoVisitor(parent_path, node_type == -1);
-    root->accept(infoVisitor);
-    if (node_type == 2 || infoVisitor.geometry_array.empty()) {
-        infoVisitor.geometry_array = infoVisitor.other_geometry_array;
-        infoVisitor.texture_array = infoVisitor.other_texture_array;
-    }
-    if (infoVisitor.geometry_array.empty())
-        return false;
 
-    osgUtil::SmoothingVisitor sv;
-    root->accept(sv);
+    // the primitives are encoded in parallel, then written in order
+    const DracoCompressionParams draco_params = {
+        .position_max_error = draco_position_error, .encoding_speed = draco_encoding_speed,
+        .decoding_speed = draco_decoding_speed, .enable_compression = true
+    };
+    std::vector<GeometryEncoding> encodings(merged_array.size());
+    if (enable_meshopt || enable_draco || enable_optimize) {
+        TaskGroup group(WorkStealingPool::instance());
+        for (size_t i = 0; i < merged_array.size(); i++) {
+            osg::Geometry* g = merged_array[i];
+            if (!g->getVertexArray() || g->getVertexArray()->getDataSize() == 0)
+                continue;
+            GeometryEncoding* enc = &encodings[i];
+            group.run([g, enc, &draco_params, enable_meshopt, enable_draco, enable_optimize]() {
+                encode_osgGeometry(g, enable_meshopt, enable_draco, enable_optimize, draco_params, *enc);
+            });
+        }
+        group.wait();
+    }
 
     tinygltf::TinyGLTF gltf;
     tinygltf::Model model;
@@ -1110,27 +1380,28 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
 
     osg::Vec3f point_max, point_min;
     OsgBuildState osgState = {
-        &buffer, &model, osg::Vec3f(-1e38,-1e38,-1e38), osg::Vec3f(1e38,1e38,1e38), -1, -1
+        &buffer, &model, osg::Vec3f(-1e38,-1e38,-1e38), osg::Vec3f(1e38,1e38,1e38), -1, -1, 0
     };
     // mesh
     model.meshes.resize(1);
     int primitive_idx = 0;
-    for (auto g : infoVisitor.geometry_array)
+    for (size_t i = 0; i < merged_array.size(); i++)
     {
+        osg::Geometry* g = merged_array[i];
         if (!g->getVertexArray() || g->getVertexArray()->getDataSize() == 0)
             continue;
 
-        write_osgGeometry(g, &osgState, enable_meshopt, enable_draco);
+        write_osgGeometry(g, &osgState, encodings[i]);
         // update primitive material index
-        if (infoVisitor.texture_array.size())
+        if (texture_array.size())
         {
             for (unsigned int k = 0; k < g->getNumPrimitiveSets(); k++)
             {
-                auto tex = infoVisitor.texture_map[g];
+                auto tex = merged_texture_map[g];
                 // if hava texture
                 if (tex)
                 {
-                    for (auto texture : infoVisitor.texture_array)
+                    for (auto texture : texture_array)
                     {
                         model.meshes[0].primitives[primitive_idx].material++;
                         if (tex == texture)
@@ -1155,9 +1426,10 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
         osgState.point_max.y(),
         osgState.point_max.z()
     };
+    mesh_info.simplify_error = osgState.simplify_error;
     // image
     {
-        for (auto tex : infoVisitor.texture_array)
+        for (auto tex : texture_array)
         {
             unsigned buffer_start = buffer.data.size();
 
@@ -1223,7 +1495,7 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
         model.extensionsUsed.push_back("KHR_draco_mesh_compression");
     }
 
-    for (int i = 0 ; i < infoVisitor.texture_array.size(); i++)
+    for (int i = 0 ; i < texture_array.size(); i++)
     {
         tinygltf::Material mat = make_color_material_osgb(1.0, 1.0, 1.0);
         if (enable_unlit) {
@@ -1238,7 +1510,7 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
     // texture
     {
         int texture_index = 0;
-        for (auto tex : infoVisitor.texture_array)
+        for (auto tex : texture_array)
         {
             tinygltf::Texture texture;
             texture.sampler = 0;
@@ -1262,6 +1534,10 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
     model.asset.version = "2.0";
     model.asset.generator = "fanvanzh";
 
+    if (enable_quantize)
+        ::quantize_model(model);
+    if (enable_meshopt_compression)
+        return ::write_meshopt_glb(model, glb_buff);
     std::ostringstream ss;
     bool res = gltf.WriteGltfSceneToStream(&model, ss, false, true);
     if (res) {
@@ -1270,18 +1546,36 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
     return true;
 }
 
-bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true)
-{
-    using nlohmann::json;
+bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
+    vector<string> fileNames = { path };
+    std::string parent_path = get_parent(path);
 
-    std::string glb_buf;
-    MeshInfo minfo;
-    bool ret = osgb2glb_buf(path, glb_buf, minfo, node_type, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
-    if (!ret)
+    log_osg_plugin_info_once();
+
+    osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
+    if (!root.valid()) {
         return false;
+    }
+    std::shared_ptr<const GeoReference> geo_ref = GeoTransform::GetReference();
+    InfoVisitor infoVisitor(parent_path, node_type == -1, geo_ref.get());
+    root->accept(infoVisitor);
+    infoVisitor.apply_correction();
+    if (node_type == 2 || infoVisitor.geometry_array.empty()) {
+        infoVisitor.geometry_array = infoVisitor.other_geometry_array;
+        infoVisitor.texture_array = infoVisitor.other_texture_array;
+    }
+    if (infoVisitor.geometry_array.empty())
+        return false;
+
+    apply_normals_mode(root.get(), OSGB_NORMALS_AUTO, enable_unlit);
 
-    tile_box.max = minfo.max;
-    tile_box.min = minfo.min;
+    return geometry2glb_buf(infoVisitor.geometry_array, infoVisitor.texture_array, infoVisitor.texture_map,
+                            glb_buff, mesh_info, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+}
+
+void glb2b3dm_buf(const std::string& glb_buf, std::string& b3dm_buf)
+{
+    using nlohmann::json;
 
     int mesh_count = 1;
     std::string feature_json_string;
@@ -1334,7 +1628,6 @@ bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box, i
     b3dm_buf.append(feature_json_string.begin(),feature_json_string.end());
     b3dm_buf.append(batch_json_string.begin(),batch_json_string.end());
     b3dm_buf.append(glb_buf);
-    return true;
 }
 
 std::vector<double> convert_bbox(TileBox tile) {
@@ -1356,31 +1649,936 @@ std::vector<double> convert_bbox(TileBox tile) {
     return v;
 }
 
-void do_tile_job(osg_tree& tree, std::string out_path, int max_lvl, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
-    std::string json_str;
-    if (tree.file_name.empty()) return;
-    int lvl = get_lvl_num(tree.file_name);
-    if (lvl > max_lvl) return;
-    if (tree.type > 0) {
-        std::string b3dm_buf;
-        osgb2b3dm_buf(tree.file_name, b3dm_buf, tree.bbox, tree.type, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
-        std::string out_file = out_path;
-        out_file += "/";
-        out_file += replace(get_file_name(tree.file_name), ".osgb", tree.type != 2 ? ".b3dm" : "o.b3dm");
-        if (!b3dm_buf.empty()) {
-            write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size());
+// "<name>.b3dm", or "<name>o.b3dm" for type 2 tiles
+std::string default_content_uri(const osg_tree& tile) {
+    return replace(get_file_name(tile.file_name), ".osgb", tile.type != 2 ? ".b3dm" : "o.b3dm");
+}
+
+// b3dm file name of a tile, relative to the output directory
+std::string tile_content_uri(const osg_tree& tile) {
+    if (!tile.content_uri.empty())
+        return tile.content_uri;
+    return default_content_uri(tile);
+}
+
+void geometry_bounds(osg::Geometry* g, osg::BoundingBox& bbox) {
+    if (auto v3f = dynamic_cast<osg::Vec3Array*>(g->getVertexArray())) {
+        for (auto& p : *v3f)
+            bbox.expandBy(p);
+    }
+}
+
+// Half the largest extent of geometries, the geometricError of a leaf (see
+// get_geometric_error())
+double geometry_half_extent(const std::vector<osg::Geometry*>& geometry_array)
+{
+    osg::BoundingBox bbox;
+    for (auto g : geometry_array)
+        geometry_bounds(g, bbox);
+    if (!bbox.valid())
+        return 0.0;
+    return std::max({ bbox.xMax() - bbox.xMin(), bbox.yMax() - bbox.yMin(), bbox.zMax() - bbox.zMin() }) / 2.0;
+}
+
+// Estimated geometricError of a tile, 0 if none of its children is
+// converted. calc_geometric_error() only knows it once the children are
+// done: twice the largest error of the children. A child file refines the
+// geometry of one PagedLOD of this file, so twice the half extent of that
+// geometry stands for the child's error.
+double estimate_refined_error(const InfoVisitor& info, const std::vector<osg::Geometry*>& content, int level, int max_lvl)
+{
+    bool refined = false;
+    double error = 0.0;
+    for (auto& range : info.paged_ranges) {
+        bool converted = false;
+        for (size_t i = range.first_name; i < range.end_name; i++)
+            converted = converted || get_tile_level(info.sub_node_names[i], level) <= max_lvl;
+        if (!converted)
+            continue;
+        refined = true;
+        std::vector<osg::Geometry*> geometries(info.geometry_array.begin() + range.first,
+                                               info.geometry_array.begin() + range.end);
+        error = std::max(error, 2.0 * geometry_half_extent(geometries));
+    }
+    if (!refined)
+        return 0.0;
+    return error > 0 ? error : geometry_half_extent(content);
+}
+
+// Draco position error bound of a tile content. A refined tile is drawn
+// until its geometricError reaches the SSE threshold on screen, so the bound
+// is a fraction of it; a leaf is looked at from any distance and gets the
+// absolute DRACO_LEAF_POSITION_ERROR. 0 keeps the fixed quantization.
+// refined_error: geometricError of the tile if it has children, else 0.
+double tile_draco_position_error(const OsgbConversionParams& params, double refined_error)
+{
+    if (!params.enable_draco || params.draco_error_fraction <= 0)
+        return 0.0;
+    if (refined_error <= 0)
+        return DRACO_LEAF_POSITION_ERROR;
+    return params.draco_error_fraction * refined_error;
+}
+
+// b3dm of geometries, with the textures they use. refined_error: see
+// tile_draco_position_error()
+bool encode_tile_b3dm(const OsgbConversionParams& params, std::vector<osg::Geometry*>& geometry_array,
+                      std::map<osg::Geometry*, osg::Texture*>& texture_map, std::string& b3dm_buf, MeshInfo& minfo,
+                      double refined_error = 0)
+{
+    // only the textures of these geometries
+    std::set<osg::Texture*> texture_array;
+    for (auto g : geometry_array) {
+        auto it = texture_map.find(g);
+        if (it != texture_map.end() && it->second)
+            texture_array.insert(it->second);
+    }
+    std::string glb_buf;
+    if (!geometry2glb_buf(geometry_array, texture_array, texture_map, glb_buf, minfo,
+                          params.enable_texture_compress, params.enable_meshopt, params.enable_draco, params.enable_unlit,
+                          params.enable_optimize_mesh, params.draco_encoding_speed, params.draco_decoding_speed,
+                          params.enable_meshopt_compression, params.enable_quantize,
+                          tile_draco_position_error(params, refined_error)))
+        return false;
+    glb2b3dm_buf(glb_buf, b3dm_buf);
+    return true;
+}
+
+// Copy of the given triangles of g with compact vertex, normal and texture
+// coordinate arrays
+osg::ref_ptr<osg::Geometry> sub_geometry(osg::Geometry* g, const std::vector<unsigned int>& triangles)
+{
+    osg::Vec3Array* v3f = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+    osg::Vec3Array* n3f = g->getNormalBinding() == osg::Geometry::BIND_PER_VERTEX
+        ? dynamic_cast<osg::Vec3Array*>(g->getNormalArray()) : nullptr;
+    osg::Vec2Array* v2f = dynamic_cast<osg::Vec2Array*>(g->getTexCoordArray(0));
+
+    osg::ref_ptr<osg::Geometry> sub = new osg::Geometry;
+    osg::ref_ptr<osg::Vec3Array> sub_v3f = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> sub_n3f = n3f ? new osg::Vec3Array : nullptr;
+    osg::ref_ptr<osg::Vec2Array> sub_v2f = v2f ? new osg::Vec2Array : nullptr;
+    osg::ref_ptr<osg::DrawElementsUInt> elements = new osg::DrawElementsUInt(GL_TRIANGLES);
+    std::vector<int> remap(v3f->size(), -1);
+    for (auto idx : triangles) {
+        if (remap[idx] < 0) {
+            remap[idx] = (int)sub_v3f->size();
+            sub_v3f->push_back((*v3f)[idx]);
+            if (sub_n3f)
+                sub_n3f->push_back(idx < n3f->size() ? (*n3f)[idx] : osg::Vec3(0, 0, 1));
+            if (sub_v2f)
+                sub_v2f->push_back(idx < v2f->size() ? (*v2f)[idx] : osg::Vec2(0, 0));
+        }
+        elements->push_back((unsigned int)remap[idx]);
+    }
+    sub->setVertexArray(sub_v3f.get());
+    if (sub_n3f)
+        sub->setNormalArray(sub_n3f.get(), osg::Array::BIND_PER_VERTEX);
+    if (sub_v2f)
+        sub->setTexCoordArray(0, sub_v2f.get());
+    sub->addPrimitiveSet(elements.get());
+    sub->setStateSet(g->getStateSet());
+    return sub;
+}
+
+// Splits geometries in two halves along the longest axis of their bounds:
+// whole geometries when there are several, the triangles of a single one.
+bool split_geometries(std::vector<osg::Geometry*>& geometry_array, std::map<osg::Geometry*, osg::Texture*>& texture_map,
+                      std::vector<osg::ref_ptr<osg::Geometry>>& owned,
+                      std::vector<osg::Geometry*>& lower, std::vector<osg::Geometry*>& upper)
+{
+    osg::BoundingBox bbox;
+    for (auto g : geometry_array)
+        geometry_bounds(g, bbox);
+    if (!bbox.valid())
+        return false;
+    osg::Vec3 size = bbox._max - bbox._min;
+    int axis = size.x() >= size.y() && size.x() >= size.z() ? 0 : (size.y() >= size.z() ? 1 : 2);
+    float middle = bbox.center()[axis];
+
+    if (geometry_array.size() > 1) {
+        for (auto g : geometry_array) {
+            osg::BoundingBox gbox;
+            geometry_bounds(g, gbox);
+            (gbox.valid() && gbox.center()[axis] < middle ? lower : upper).push_back(g);
         }
-        // test
-        // std::string glb_buf;
-        // std::vector<mesh_info> v_info;
-        // osgb2glb_buf(tree.file_name, glb_buf, v_info, tree.type);
-        // out_file = replace(out_file, ".b3dm", tree.type != 2 ? ".glb" : "o.glb");
-        // write_file(out_file.c_str(), glb_buf.data(), glb_buf.size());
-        // end test
+        // all centers on one side: split by count
+        if (lower.empty() || upper.empty()) {
+            lower.assign(geometry_array.begin(), geometry_array.begin() + geometry_array.size() / 2);
+            upper.assign(geometry_array.begin() + geometry_array.size() / 2, geometry_array.end());
+        }
+        return true;
     }
-    for (auto& i : tree.sub_nodes) {
-        do_tile_job(i,out_path,max_lvl, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+
+    osg::Geometry* g = geometry_array[0];
+    osg::Vec3Array* v3f = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+    if (!v3f)
+        return false;
+    osg::TriangleIndexFunctor<TriangleCollector> collector;
+    std::vector<unsigned int> triangles;
+    collector.indices = &triangles;
+    g->accept(collector);
+    std::vector<unsigned int> lower_tris, upper_tris;
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        float c = ((*v3f)[triangles[i]][axis] + (*v3f)[triangles[i + 1]][axis] + (*v3f)[triangles[i + 2]][axis]) / 3;
+        auto& side = c < middle ? lower_tris : upper_tris;
+        side.insert(side.end(), triangles.begin() + i, triangles.begin() + i + 3);
+    }
+    if (lower_tris.empty() || upper_tris.empty())
+        return false;
+    for (auto* tris : { &lower_tris, &upper_tris }) {
+        owned.push_back(sub_geometry(g, *tris));
+        texture_map[owned.back().get()] = texture_map[g];
+        (tris == &lower_tris ? lower : upper).push_back(owned.back().get());
+    }
+    return true;
+}
+
+const int MAX_SPLIT_DEPTH = 4;
+
+// Halvings that bring an encoded size under max_bytes, assuming the halves
+// encode to about half the size; at most max_levels.
+int split_levels(uint64_t size, uint64_t max_bytes, int max_levels)
+{
+    int levels = 0;
+    while (levels < max_levels && (size >> levels) > max_bytes)
+        levels++;
+    return levels;
+}
+
+// Writes geometries as parts of at most max_tile_kb. The geometries are
+// first halved levels more times without being encoded; a part that still
+// encodes above the limit is halved again, up to MAX_SPLIT_DEPTH halvings
+// in all. Each part is a tile of its own.
+bool write_tile_parts(const osg_tree& tile, const OsgbConversionParams& params,
+                      std::vector<osg::Geometry*>& geometry_array, std::map<osg::Geometry*, osg::Texture*>& texture_map,
+                      int depth, int levels, std::vector<osg_tree>& parts, double refined_error)
+{
+    std::vector<osg::ref_ptr<osg::Geometry>> owned;
+    std::vector<osg::Geometry*> lower, upper;
+    auto write_halves = [&](int halves_levels) {
+        bool ret = write_tile_parts(tile, params, lower, texture_map, depth + 1, halves_levels, parts, refined_error);
+        ret = write_tile_parts(tile, params, upper, texture_map, depth + 1, halves_levels, parts, refined_error) && ret;
+        for (auto& g : owned)
+            texture_map.erase(g.get());
+        return ret;
+    };
+    if (levels > 0 && depth < MAX_SPLIT_DEPTH && split_geometries(geometry_array, texture_map, owned, lower, upper))
+        return write_halves(levels - 1);
+
+    std::string b3dm_buf;
+    MeshInfo minfo;
+    if (!encode_tile_b3dm(params, geometry_array, texture_map, b3dm_buf, minfo, refined_error))
+        return false;
+
+    const uint64_t max_bytes = (uint64_t)params.max_tile_kb * 1024;
+    if (b3dm_buf.size() > max_bytes && depth < MAX_SPLIT_DEPTH
+        && split_geometries(geometry_array, texture_map, owned, lower, upper))
+        return write_halves(split_levels(b3dm_buf.size(), max_bytes, MAX_SPLIT_DEPTH - depth) - 1);
+
+    osg_tree part;
+    part.type = tile.type;
+    part.file_name = tile.file_name;
+    part.content_uri = replace(default_content_uri(tile), ".b3dm", "_" + std::to_string(parts.size()) + ".b3dm");
+    part.bbox.max = minfo.max;
+    part.bbox.min = minfo.min;
+    part.content_size = b3dm_buf.size();
+    part.simplify_error = minfo.simplify_error;
+    std::string out_file = std::string(params.output_path) + "/" + part.content_uri;
+    if (!write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size()))
+        return false;
+    parts.push_back(part);
+    return true;
+}
+
+// Converts one set of geometries of a loaded osgb into the tile's b3dm and
+// records its bounding box. Type 2 tiles are written as "<name>o.b3dm".
+// A content above max_tile_kb is written as spatial parts instead, returned
+// in parts; the tile then only keeps their union box. refined_error: see
+// tile_draco_position_error().
+bool write_tile_content(osg_tree& tile, const OsgbConversionParams& params,
+                        std::vector<osg::Geometry*>& geometry_array, std::map<osg::Geometry*, osg::Texture*>& texture_map,
+                        ManifestContent* content = nullptr, std::vector<osg_tree>* parts = nullptr,
+                        double refined_error = 0)
+{
+    std::string b3dm_buf;
+    MeshInfo minfo;
+    if (!encode_tile_b3dm(params, geometry_array, texture_map, b3dm_buf, minfo, refined_error))
+        return false;
+
+    tile.bbox.max = minfo.max;
+    tile.bbox.min = minfo.min;
+    tile.simplify_error = minfo.simplify_error;
+
+    // the size of the whole content tells how many halvings are needed; the
+    // geometries are left unsimplified by the encoding, so each written part
+    // is simplified once, from the original triangles
+    const uint64_t max_bytes = (uint64_t)params.max_tile_kb * 1024;
+    std::vector<osg::ref_ptr<osg::Geometry>> owned;
+    std::vector<osg::Geometry*> lower, upper;
+    if (parts && params.max_tile_kb > 0 && b3dm_buf.size() > max_bytes
+        && split_geometries(geometry_array, texture_map, owned, lower, upper)) {
+        int levels = split_levels(b3dm_buf.size(), max_bytes, MAX_SPLIT_DEPTH) - 1;
+        size_t first_part = parts->size();
+        bool ret = write_tile_parts(tile, params, lower, texture_map, 1, levels, *parts, refined_error);
+        ret = write_tile_parts(tile, params, upper, texture_map, 1, levels, *parts, refined_error) && ret;
+        for (auto& g : owned)
+            texture_map.erase(g.get());
+        // the error of what was written, not of the measuring encode
+        tile.simplify_error = 0;
+        for (size_t i = first_part; i < parts->size(); i++)
+            tile.simplify_error = std::max(tile.simplify_error, (*parts)[i].simplify_error);
+        return ret;
+    }
+
+    std::string b3dm_name = tile_content_uri(tile);
+    std::string out_file = params.output_path;
+    out_file += "/";
+    out_file += b3dm_name;
+    if (!write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size()))
+        return false;
+    tile.content_size = b3dm_buf.size();
+    if (content) {
+        content->written = true;
+        content->uri = b3dm_name;
+        content->box_max = minfo.max;
+        content->box_min = minfo.min;
+        content->size = b3dm_buf.size();
+        content->simplify_error = minfo.simplify_error;
+        content->hash = TileManifest::hash_bytes(b3dm_buf.data(), b3dm_buf.size());
     }
+    return true;
+}
+
+// One osgb file of a pyramid. Jobs are converted concurrently on the tile
+// pool; children are created by the parent's job before they are scheduled,
+// so the tree is only read back once the whole group is finished.
+struct TileJob {
+    std::string file_name;
+    int level = -1;                 // see get_tile_level()
+    osg_tree tile;                  // type 1, empty file_name if not converted
+    osg_tree other_tile;            // type 2, only used when has_other_nodes
+    bool has_other_nodes = false;
+    std::vector<osg_tree> parts;    // split contents of tile, see write_tile_content()
+    std::vector<osg_tree> other_parts;
+    std::vector<std::unique_ptr<TileJob>> children;
+};
+
+// Shared by all the jobs of one pyramid
+struct TileJobContext {
+    const OsgbConversionParams* params;
+    const GeoReference* geo_ref;    // null: no offset correction
+    TileManifest* manifest;         // null: not incremental
+    FilePrefetcher* prefetcher;     // null: no read-ahead
+    std::string block_dir;          // directory of the pyramid's root osgb
+    TaskGroup* group;
+};
+
+// Manifest key of a source file: its path relative to the block directory
+std::string manifest_key(const std::string& block_dir, const std::string& file_name)
+{
+    std::string prefix = block_dir + "/";
+    if (file_name.compare(0, prefix.size(), prefix) == 0)
+        return file_name.substr(prefix.size());
+    return file_name;
+}
+
+// Fills the job from the manifest of the previous run, without reading the file
+void restore_tile_job(TileJob* job, const ManifestEntry& entry)
+{
+    job->tile.file_name = job->file_name;
+    job->tile.type = 1;
+    if (entry.content.written) {
+        job->tile.bbox.max = entry.content.box_max;
+        job->tile.bbox.min = entry.content.box_min;
+        job->tile.content_uri = entry.content.uri;
+        job->tile.content_size = entry.content.size;
+        job->tile.simplify_error = entry.content.simplify_error;
+        job->tile.merge_count = entry.content.merge_count;
+    }
+    job->has_other_nodes = entry.has_other_nodes;
+    if (entry.has_other_nodes) {
+        job->other_tile.type = 2;
+        job->other_tile.file_name = job->file_name;
+        if (entry.other_content.written) {
+            job->other_tile.bbox.max = entry.other_content.box_max;
+            job->other_tile.bbox.min = entry.other_content.box_min;
+            job->other_tile.content_uri = entry.other_content.uri;
+            job->other_tile.content_size = entry.other_content.size;
+            job->other_tile.simplify_error = entry.other_content.simplify_error;
+            job->other_tile.merge_count = entry.other_content.merge_count;
+        }
+    }
+}
+
+// Decodes the image of a fast-path texture with the ReaderWriter of its
+// extension, as the osg2 plugin does for inline image files
+osg::ref_ptr<osg::Image> read_fast_osgb_image(const OsgbFastTexture& texture, const std::string& parent_path)
+{
+    if (texture.bytes.empty())
+        return osgDB::readImageFile(parent_path + "/" + texture.file_name);
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+        osgDB::getLowerCaseFileExtension(texture.file_name));
+    if (!rw)
+        return nullptr;
+    std::istringstream in(texture.bytes);
+    osgDB::ReaderWriter::ReadResult rr = rw->readImage(in);
+    if (!rr.validImage())
+        return nullptr;
+    osg::ref_ptr<osg::Image> image = rr.getImage();
+    image->setFileName(texture.file_name);
+    return image;
+}
+
+// Scene graph of a fast-path osgb: the geometries of every PagedLOD go to a
+// Geode that is its first child, the others to a Geode of the root, which is
+// all InfoVisitor looks at
+osg::ref_ptr<osg::Node> build_fast_osgb_node(const OsgbFastScene& scene, const std::string& parent_path)
+{
+    std::vector<osg::ref_ptr<osg::Texture2D>> textures;
+    for (auto& texture : scene.textures) {
+        osg::ref_ptr<osg::Image> image = read_fast_osgb_image(texture, parent_path);
+        if (!image)
+            return nullptr;
+        osg::ref_ptr<osg::Texture2D> tex = new osg::Texture2D(image.get());
+        tex->setWrap(osg::Texture::WRAP_S, osg::Texture::REPEAT);
+        tex->setWrap(osg::Texture::WRAP_T, osg::Texture::REPEAT);
+        textures.push_back(tex);
+    }
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    osg::ref_ptr<osg::Geode> other_geode = new osg::Geode;
+    std::vector<osg::ref_ptr<osg::Geode>> lod_geodes(scene.lods.size());
+    for (auto& geode : lod_geodes)
+        geode = new osg::Geode;
+
+    for (auto& fast : scene.geometries) {
+        osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+        size_t vertex_count = fast.positions.size() / 3;
+        osg::ref_ptr<osg::Vec3Array> v3f = new osg::Vec3Array(vertex_count);
+        memcpy(&v3f->front(), fast.positions.data(), fast.positions.size() * sizeof(float));
+        geom->setVertexArray(v3f.get());
+        if (!fast.normals.empty()) {
+            osg::ref_ptr<osg::Vec3Array> n3f = new osg::Vec3Array(vertex_count);
+            memcpy(&n3f->front(), fast.normals.data(), fast.normals.size() * sizeof(float));
+            geom->setNormalArray(n3f.get(), osg::Array::BIND_PER_VERTEX);
+        }
+        if (!fast.texcoords.empty()) {
+            osg::ref_ptr<osg::Vec2Array> v2f = new osg::Vec2Array(vertex_count);
+            memcpy(&v2f->front(), fast.texcoords.data(), fast.texcoords.size() * sizeof(float));
+            geom->setTexCoordArray(0, v2f.get());
+        }
+        geom->addPrimitiveSet(new osg::DrawElementsUInt(GL_TRIANGLES, fast.indices.size(), fast.indices.data()));
+        if (fast.texture >= 0) {
+            osg::StateSet* ss = geom->getOrCreateStateSet();
+            ss->setTextureAttributeAndModes(0, textures[fast.texture].get());
+        }
+        if (fast.lod >= 0)
+            lod_geodes[fast.lod]->addDrawable(geom.get());
+        else
+            other_geode->addDrawable(geom.get());
+    }
+
+    for (size_t i = 0; i < scene.lods.size(); i++) {
+        const OsgbFastLod& fast = scene.lods[i];
+        osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+        lod->addChild(lod_geodes[i].get());
+        for (size_t k = 0; k < fast.file_names.size(); k++)
+            lod->setFileName((unsigned)k, fast.file_names[k]);
+        for (size_t k = 0; k + 1 < fast.ranges.size(); k += 2)
+            lod->setRange((unsigned)(k / 2), fast.ranges[k], fast.ranges[k + 1]);
+        root->addChild(lod.get());
+    }
+    if (other_geode->getNumDrawables() > 0)
+        root->addChild(other_geode.get());
+    return root;
+}
+
+bool read_osgb_bytes(const std::string& file_name, std::string& bytes)
+{
+    std::ifstream in(std::filesystem::path(file_name), std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    bytes = buffer.str();
+    return true;
+}
+
+// Reads an osgb from the prefetched bytes when they are there, through the
+// stream interface of its ReaderWriter, otherwise from the file. With the
+// fast reader, the files it can parse do not go through OSG at all.
+osg::ref_ptr<osg::Node> read_osgb_node(const std::string& file_name, FilePrefetcher* prefetcher, bool fast_reader)
+{
+    std::string bytes;
+    bool cached = prefetcher && prefetcher->take(file_name, bytes);
+    if (fast_reader && (cached || read_osgb_bytes(file_name, bytes))) {
+        cached = true;
+        OsgbFastScene scene;
+        if (read_osgb_fast(bytes, scene)) {
+            osg::ref_ptr<osg::Node> node = build_fast_osgb_node(scene, get_parent(file_name));
+            if (node)
+                return node;
+        }
+    }
+    if (cached) {
+        osgDB::Registry* registry = osgDB::Registry::instance();
+        osgDB::ReaderWriter* rw = registry->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(file_name));
+        if (rw) {
+            osg::ref_ptr<osgDB::Options> options = registry->getOptions()
+                ? registry->getOptions()->cloneOptions() : new osgDB::Options;
+            options->getDatabasePathList().push_front(osgDB::getFilePath(file_name));
+            std::istringstream in(std::move(bytes));
+            osgDB::ReaderWriter::ReadResult rr = rw->readNode(in, options.get());
+            if (rr.validNode())
+                return rr.getNode();
+        }
+    }
+    vector<string> fileNames = { file_name };
+    return osgDB::readNodeFiles(fileNames);
+}
+
+void convert_tile_job(TileJob* job, const TileJobContext* ctx);
+
+// Children above max_lvl are pruned here, before a job is even created for
+// them, so the parent simply becomes a leaf of the tileset.
+void schedule_children(TileJob* job, const std::vector<std::string>& sub_node_names, const TileJobContext* ctx)
+{
+    for (auto& name : sub_node_names) {
+        int level = get_tile_level(name, job->level);
+        if (level > ctx->params->max_lvl)
+            continue;
+        auto child = std::make_unique<TileJob>();
+        child->file_name = name;
+        child->level = level;
+        job->children.push_back(std::move(child));
+    }
+    // the children are pushed to the front of this worker's deque, the last
+    // one runs first; the prefetcher reads the last requested file first too
+    if (ctx->prefetcher) {
+        for (auto& child : job->children)
+            ctx->prefetcher->prefetch(child->file_name);
+    }
+    for (auto& child : job->children) {
+        TileJob* child_job = child.get();
+        ctx->group->run([child_job, ctx]() {
+            convert_tile_job(child_job, ctx);
+        });
+    }
+}
+
+// Every osgb is read once, and the same scene graph is used to discover its
+// children and to write its content. Files above max_lvl are neither read
+// nor converted, and in incremental mode unchanged files are not read either.
+void convert_tile_job(TileJob* job, const TileJobContext* ctx)
+{
+    const OsgbConversionParams* params = ctx->params;
+    if (job->level > params->max_lvl)
+        return;
+
+    std::string parent_path = get_parent(job->file_name);
+    std::string key;
+    ManifestEntry entry;
+    if (ctx->manifest) {
+        key = manifest_key(ctx->block_dir, job->file_name);
+        if (ctx->manifest->find_unchanged(key, job->file_name, entry)) {
+            if (ctx->prefetcher)
+                ctx->prefetcher->discard(job->file_name);
+            restore_tile_job(job, entry);
+            ctx->manifest->update(key, entry);
+            std::vector<std::string> sub_node_names;
+            for (auto& name : entry.children)
+                sub_node_names.push_back(parent_path + "/" + name);
+            schedule_children(job, sub_node_names, ctx);
+            return;
+        }
+    }
+    ManifestContent* content = ctx->manifest ? &entry.content : nullptr;
+    ManifestContent* other_content = ctx->manifest ? &entry.other_content : nullptr;
+
+    log_osg_plugin_info_once();
+
+    std::vector<std::string> sub_node_names;
+    {   // add block to release Node before scheduling the children
+        osg::ref_ptr<osg::Node> root = read_osgb_node(job->file_name, ctx->prefetcher, params->enable_fast_reader);
+        if (!root) {
+            std::string name = utf8_string(job->file_name.c_str());
+            LOG_E("read node files [%s] fail!", name.c_str());
+            return;
+        }
+        job->tile.file_name = job->file_name;
+        job->tile.type = 1;
+
+        InfoVisitor infoVisitor(parent_path, false, ctx->geo_ref);
+        root->accept(infoVisitor);
+        infoVisitor.apply_correction();
+        apply_normals_mode(root.get(), params->normals_mode, params->enable_unlit);
+
+        // the children of the file hang below the PagedLOD tile, the other
+        // nodes get a leaf of their own
+        job->has_other_nodes = !infoVisitor.other_geometry_array.empty() && !infoVisitor.geometry_array.empty();
+        auto& geometries = infoVisitor.geometry_array.empty() ? infoVisitor.other_geometry_array : infoVisitor.geometry_array;
+        const double refined_error = estimate_refined_error(infoVisitor, geometries, job->level, params->max_lvl);
+        write_tile_content(job->tile, *params, geometries, infoVisitor.texture_map, content, &job->parts, refined_error);
+        if (job->has_other_nodes) {
+            job->other_tile.type = 2;
+            job->other_tile.file_name = job->file_name;
+            write_tile_content(job->other_tile, *params,
+                infoVisitor.other_geometry_array, infoVisitor.texture_map, other_content, &job->other_parts);
+        }
+        sub_node_names = std::move(infoVisitor.sub_node_names);
+    }
+
+    // split files are not recorded, they are converted again by the next run
+    if (ctx->manifest && job->parts.empty() && job->other_parts.empty()) {
+        entry.has_other_nodes = job->has_other_nodes;
+        std::string prefix = parent_path + "/";
+        for (auto& name : sub_node_names)
+            entry.children.push_back(name.compare(0, prefix.size(), prefix) == 0 ? name.substr(prefix.size()) : name);
+        ctx->manifest->update(key, entry);
+    }
+    schedule_children(job, sub_node_names, ctx);
+}
+
+// Group of the parts of a split tile. Each child of the tile goes to the
+// part whose box contains its center (the closest part if none does, the
+// one it overlaps most if several do), so a part is replaced by children
+// covering its own area; extend_tile_box() later grows the part to the
+// union of its children's boxes.
+osg_tree split_tile_group(const osg_tree& tile, std::vector<osg_tree> parts)
+{
+    const double MIN_EXTENT = 1e-3;
+    for (auto& child : tile.sub_nodes) {
+        size_t best = 0;
+        if (!child.bbox.max.empty() && !child.bbox.min.empty()) {
+            double best_dist = std::numeric_limits<double>::max();
+            double best_overlap = -1;
+            for (size_t i = 0; i < parts.size(); i++) {
+                const TileBox& box = parts[i].bbox;
+                double dist = 0;
+                double overlap = 1;
+                for (int axis = 0; axis < 3; axis++) {
+                    double c = (child.bbox.max[axis] + child.bbox.min[axis]) / 2;
+                    double d = std::max({ box.min[axis] - c, c - box.max[axis], 0.0 });
+                    dist += d * d;
+                    double lo = std::max(box.min[axis], child.bbox.min[axis]);
+                    double hi = std::min(box.max[axis], child.bbox.max[axis]);
+                    overlap *= std::max(hi - lo, 0.0) + MIN_EXTENT;
+                }
+                if (dist < best_dist || (dist == best_dist && overlap > best_overlap)) {
+                    best_dist = dist;
+                    best_overlap = overlap;
+                    best = i;
+                }
+            }
+        }
+        parts[best].sub_nodes.push_back(child);
+    }
+    osg_tree group;
+    group.type = 0;
+    group.file_name = tile.file_name;
+    group.sub_nodes = std::move(parts);
+    return group;
+}
+
+// Builds the osg_tree of a finished job tree
+osg_tree collect_tile_tree(TileJob& job)
+{
+    osg_tree root_tile = job.tile;
+    if (root_tile.file_name.empty())
+        return root_tile;
+
+    for (auto& child : job.children) {
+        osg_tree tree = collect_tile_tree(*child);
+        if (!tree.file_name.empty()) {
+            // When the node type is Group, simply add its child nodes to the current node
+            if (tree.type == 0) {
+                for (auto& node : tree.sub_nodes)
+                    root_tile.sub_nodes.push_back(node);
+            }
+            else {
+                root_tile.sub_nodes.push_back(tree);
+            }
+        }
+    }
+
+    if (!job.parts.empty())
+        root_tile = split_tile_group(root_tile, job.parts);
+
+    // When the node contains PagedLOD and Other nodes, create a new group node
+    if (job.has_other_nodes) {
+        osg_tree other_tile = job.other_tile;
+        if (!job.other_parts.empty())
+            other_tile = split_tile_group(other_tile, job.other_parts);
+        osg_tree new_root_tile;
+        new_root_tile.type = 0;
+        new_root_tile.file_name = job.file_name;
+        for (auto* tile : { &root_tile, &other_tile }) {
+            if (tile->type == 0)
+                new_root_tile.sub_nodes.insert(new_root_tile.sub_nodes.end(), tile->sub_nodes.begin(), tile->sub_nodes.end());
+            else
+                new_root_tile.sub_nodes.push_back(*tile);
+        }
+        root_tile = new_root_tile;
+    }
+    return root_tile;
+}
+
+// Sibling leaves of one parent whose contents are merged into one b3dm
+struct LeafMerge {
+    osg_tree* parent;
+    std::vector<size_t> members;    // indices in parent->sub_nodes
+    osg_tree merged;
+    std::string hash;               // of the merged b3dm, for the manifest
+    bool done = false;
+};
+
+// Collects runs of sibling leaves smaller than min_bytes, each run adding up
+// to about min_bytes. Split parts and merged leaves are left alone.
+void plan_leaf_merges(osg_tree& tree, uint64_t min_bytes, std::vector<LeafMerge>& merges)
+{
+    LeafMerge merge;
+    merge.parent = &tree;
+    uint64_t merge_size = 0;
+    auto flush = [&]() {
+        if (merge.members.size() > 1)
+            merges.push_back(merge);
+        merge.members.clear();
+        merge_size = 0;
+    };
+    for (size_t i = 0; i < tree.sub_nodes.size(); i++) {
+        osg_tree& node = tree.sub_nodes[i];
+        if (!node.sub_nodes.empty()) {
+            plan_leaf_merges(node, min_bytes, merges);
+            continue;
+        }
+        if (node.type == 0 || tile_content_uri(node) != default_content_uri(node))
+            continue;
+        if (node.content_size == 0 || node.content_size >= min_bytes)
+            continue;
+        merge.members.push_back(i);
+        merge_size += node.content_size;
+        if (merge_size >= min_bytes)
+            flush();
+    }
+    flush();
+}
+
+// Reads the files of the leaves again and writes their geometry as one b3dm,
+// the own b3dm of the leaves are removed.
+bool merge_leaf_contents(LeafMerge& merge, const OsgbConversionParams& params, const GeoReference* geo_ref,
+                         FilePrefetcher* prefetcher)
+{
+    std::vector<osg::ref_ptr<osg::Node>> roots;
+    std::vector<osg::Geometry*> geometry_array;
+    std::map<osg::Geometry*, osg::Texture*> texture_map;
+    for (size_t k = 0; k < merge.members.size(); k++) {
+        const osg_tree& leaf = merge.parent->sub_nodes[merge.members[k]];
+        osg::ref_ptr<osg::Node> root = read_osgb_node(leaf.file_name, prefetcher, params.enable_fast_reader);
+        if (!root) {
+            for (size_t j = k + 1; prefetcher && j < merge.members.size(); j++)
+                prefetcher->discard(merge.parent->sub_nodes[merge.members[j]].file_name);
+            return false;
+        }
+        InfoVisitor infoVisitor(get_parent(leaf.file_name), false, geo_ref);
+        root->accept(infoVisitor);
+        infoVisitor.apply_correction();
+        apply_normals_mode(root.get(), params.normals_mode, params.enable_unlit);
+        auto& geometries = leaf.type == 2 || infoVisitor.geometry_array.empty()
+            ? infoVisitor.other_geometry_array : infoVisitor.geometry_array;
+        geometry_array.insert(geometry_array.end(), geometries.begin(), geometries.end());
+        texture_map.insert(infoVisitor.texture_map.begin(), infoVisitor.texture_map.end());
+        roots.push_back(root);
+    }
+
+    std::string b3dm_buf;
+    MeshInfo minfo;
+    if (!encode_tile_b3dm(params, geometry_array, texture_map, b3dm_buf, minfo))
+        return false;
+    const osg_tree& first = merge.parent->sub_nodes[merge.members.front()];
+    osg_tree& merged = merge.merged;
+    merged.type = first.type;
+    merged.file_name = first.file_name;
+    merged.content_uri = replace(default_content_uri(first), ".b3dm", "_m.b3dm");
+    merged.bbox.max = minfo.max;
+    merged.bbox.min = minfo.min;
+    merged.content_size = b3dm_buf.size();
+    merged.simplify_error = minfo.simplify_error;
+    merged.merge_count = (int)merge.members.size();
+    merge.hash = TileManifest::hash_bytes(b3dm_buf.data(), b3dm_buf.size());
+    std::string out_file = std::string(params.output_path) + "/" + merged.content_uri;
+    if (!write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size()))
+        return false;
+    for (auto i : merge.members) {
+        std::string uri = default_content_uri(merge.parent->sub_nodes[i]);
+        if (uri == merged.content_uri)
+            continue;
+        std::error_code ec;
+        std::filesystem::remove(std::string(params.output_path) + "/" + uri, ec);
+    }
+    return true;
+}
+
+// Drops the leaves emptied by merge_small_leaves()
+void prune_merged_leaves(osg_tree& tree)
+{
+    auto& nodes = tree.sub_nodes;
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](const osg_tree& n) { return n.file_name.empty(); }), nodes.end());
+    for (auto& node : nodes)
+        prune_merged_leaves(node);
+}
+
+// Leaves restored from the manifest with a merged content. When every
+// leaf of a merge was restored, only the first one keeps the content; when
+// some of them were converted again the merged b3dm is stale and the
+// remaining leaves are merged again.
+void plan_restored_merges(osg_tree& tree, std::vector<LeafMerge>& merges)
+{
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i = 0; i < tree.sub_nodes.size(); i++) {
+        osg_tree& node = tree.sub_nodes[i];
+        if (!node.sub_nodes.empty())
+            plan_restored_merges(node, merges);
+        else if (node.merge_count > 0)
+            groups[node.content_uri].push_back(i);
+    }
+    for (auto& [uri, members] : groups) {
+        if ((int)members.size() == tree.sub_nodes[members.front()].merge_count) {
+            for (size_t k = 1; k < members.size(); k++)
+                tree.sub_nodes[members[k]].file_name.clear();
+            continue;
+        }
+        LeafMerge merge;
+        merge.parent = &tree;
+        merge.members = members;
+        merges.push_back(merge);
+    }
+}
+
+// Records the merged content on the manifest entry of every merged leaf, so
+// the next run restores the merge instead of converting the leaves again
+void record_leaf_merge(const LeafMerge& merge, TileManifest& manifest, const std::string& block_dir)
+{
+    const osg_tree& merged = merge.merged;
+    for (auto i : merge.members) {
+        const osg_tree& leaf = merge.parent->sub_nodes[i];
+        std::string key = manifest_key(block_dir, leaf.file_name);
+        ManifestEntry entry;
+        if (!manifest.find_current(key, entry))
+            continue;
+        ManifestContent& content = leaf.type == 2 ? entry.other_content : entry.content;
+        content.written = true;
+        content.uri = merged.content_uri;
+        content.box_max = merged.bbox.max;
+        content.box_min = merged.bbox.min;
+        content.size = merged.content_size;
+        content.hash = merge.hash;
+        content.simplify_error = merged.simplify_error;
+        content.merge_count = merged.merge_count;
+        manifest.update(key, entry);
+    }
+}
+
+// Coalesces sibling leaves below min_tile_kb on the tile pool
+void merge_small_leaves(osg_tree& root, const OsgbConversionParams& params, const GeoReference* geo_ref,
+                        WorkStealingPool& pool, FilePrefetcher* prefetcher, TileManifest* manifest,
+                        const std::string& block_dir)
+{
+    std::vector<LeafMerge> merges;
+    plan_restored_merges(root, merges);
+    plan_leaf_merges(root, (uint64_t)params.min_tile_kb * 1024, merges);
+    if (!merges.empty()) {
+        // the leaves are read again, the merges about in their order; the
+        // prefetcher reads the last requested file first
+        if (prefetcher) {
+            for (auto merge = merges.rbegin(); merge != merges.rend(); ++merge)
+                for (auto i = merge->members.rbegin(); i != merge->members.rend(); ++i)
+                    prefetcher->prefetch(merge->parent->sub_nodes[*i].file_name);
+        }
+        TaskGroup group(pool);
+        for (auto& merge : merges) {
+            LeafMerge* merge_ptr = &merge;
+            group.run([merge_ptr, &params, geo_ref, prefetcher]() {
+                merge_ptr->done = merge_leaf_contents(*merge_ptr, params, geo_ref, prefetcher);
+            });
+        }
+        group.wait();
+    }
+    // the tree is only changed once every merge is done
+    size_t merged_count = 0;
+    for (auto& merge : merges) {
+        if (!merge.done)
+            continue;
+        if (manifest)
+            record_leaf_merge(merge, *manifest, block_dir);
+        for (auto i : merge.members)
+            merge.parent->sub_nodes[i].file_name.clear();
+        merge.parent->sub_nodes[merge.members.front()] = merge.merged;
+        merged_count += merge.members.size();
+    }
+    prune_merged_leaves(root);
+    if (!merges.empty())
+        LOG_I("[%s] %zu small leaves merged into %zu tiles", params.input_path, merged_count, merges.size());
+}
+
+// Everything besides the source file that changes the b3dm bytes
+std::string manifest_flags(const OsgbConversionParams& params, const GeoReference* geo_ref)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "texture_compress=%d;meshopt=%d;draco=%d;unlit=%d;max_tile_kb=%d;min_tile_kb=%d;normals=%d;optimize=%d;"
+             "draco_speed=%d,%d;meshopt_compression=%d;quantize=%d;draco_error=%g,%g",
+             params.enable_texture_compress, params.enable_meshopt, params.enable_draco, params.enable_unlit,
+             params.max_tile_kb, params.min_tile_kb, resolve_normals_mode(params.normals_mode, params.enable_unlit), params.enable_optimize_mesh,
+             params.draco_encoding_speed, params.draco_decoding_speed, params.enable_meshopt_compression,
+             params.enable_quantize, params.enable_draco ? params.draco_error_fraction : 0.0,
+             params.enable_draco ? DRACO_LEAF_POSITION_ERROR : 0.0);
+    std::string flags = buf;
+    if (geo_ref && geo_ref->HasTransform()) {
+        snprintf(buf, sizeof(buf), ";origin=%.6f,%.6f,%.6f;geo_origin=%.10f,%.10f,%.6f;enu=%d",
+                 geo_ref->OriginX, geo_ref->OriginY, geo_ref->OriginZ,
+                 geo_ref->GeoOriginLon, geo_ref->GeoOriginLat, geo_ref->GeoOriginHeight, geo_ref->IsENU);
+        flags += buf;
+    }
+    return flags;
+}
+
+// Converts a whole pyramid; every file is a task on the shared tile pool.
+// The georeference is taken once here and handed to every task, the tasks
+// never touch GeoTransform themselves.
+osg_tree convert_tile_tree(const std::string& file_name, const OsgbConversionParams& params)
+{
+    std::shared_ptr<const GeoReference> geo_ref = GeoTransform::GetReference();
+    WorkStealingPool& pool = WorkStealingPool::instance((unsigned)std::max(params.num_threads, 0));
+
+    std::unique_ptr<TileManifest> manifest;
+    if (params.enable_incremental) {
+        manifest = std::make_unique<TileManifest>(params.output_path, manifest_flags(params, geo_ref.get()));
+        manifest->load();
+    }
+
+    TileJob root_job;
+    root_job.file_name = file_name;
+    root_job.level = get_lvl_num(file_name);
+    FilePrefetcher* prefetcher = params.prefetch_mb > 0
+        ? &FilePrefetcher::instance((size_t)params.prefetch_mb * 1024 * 1024) : nullptr;
+    {
+        TaskGroup group(pool);
+        TileJobContext ctx = { &params, geo_ref.get(), manifest.get(), prefetcher, get_parent(file_name), &group };
+        TileJobContext* ctx_ptr = &ctx;
+        TileJob* root_ptr = &root_job;
+        group.run([root_ptr, ctx_ptr]() {
+            convert_tile_job(root_ptr, ctx_ptr);
+        });
+        group.wait();
+    }
+    osg_tree root = collect_tile_tree(root_job);
+    if (params.min_tile_kb > 0)
+        merge_small_leaves(root, params, geo_ref.get(), pool, prefetcher, manifest.get(), get_parent(file_name));
+    if (manifest) {
+        if (manifest->skipped_count() > 0)
+            LOG_I("[%s] %zu unchanged files skipped", params.input_path, manifest->skipped_count());
+        if (!manifest->save())
+            LOG_E("write manifest of [%s] fail!", params.output_path);
+    }
+    return root;
 }
 
 void expend_box(TileBox& box, TileBox& box_new) {
@@ -1411,44 +2609,13 @@ TileBox extend_tile_box(osg_tree& tree) {
     return box;
 }
 
-std::string get_boundingBox(TileBox bbox) {
-    std::string box_str = "\"boundingVolume\":{";
-    box_str += "\"box\":[";
-    std::vector<double> v_box = convert_bbox(bbox);
-    for (auto v: v_box) {
-        box_str += std::to_string(v);
-        box_str += ",";
-    }
-    box_str.pop_back();
-    box_str += "]}";
-    return box_str;
-}
-
-std::string get_boundingRegion(TileBox bbox, double x, double y) {
-    std::string box_str = "\"boundingVolume\":{";
-    box_str += "\"region\":[";
-    std::vector<double> v_box(6);
-    v_box[0] = meter_to_longti(bbox.min[0],y) + x;
-    v_box[1] = meter_to_lati(bbox.min[1]) + y;
-    v_box[2] = meter_to_longti(bbox.max[0], y) + x;
-    v_box[3] = meter_to_lati(bbox.max[1]) + y;
-    v_box[4] = bbox.min[2];
-    v_box[5] = bbox.max[2];
-
-    for (auto v : v_box) {
-        box_str += std::to_string(v);
-        box_str += ",";
-    }
-    box_str.pop_back();
-    box_str += "]}";
-    return box_str;
-}
-
-void calc_geometric_error(osg_tree& tree) {
-    const double EPS = 1e-12;
+// The levels of the osgb pyramid come simplified from the producer, so
+// their error stays estimated from the box; what simplify_mesh_geometry
+// removed on top of that is measured, and added times error_scale.
+void calc_geometric_error(osg_tree& tree, double error_scale) {
     // depth first
     for (auto& i : tree.sub_nodes) {
-        calc_geometric_error(i);
+        calc_geometric_error(i, error_scale);
     }
     if (tree.sub_nodes.empty()) {
         tree.geometricError = get_geometric_error(tree.bbox);
@@ -1461,86 +2628,74 @@ void calc_geometric_error(osg_tree& tree) {
 
         tree.geometricError = max_sub_geometric_error * 2.0;
     }
+    tree.geometricError += error_scale * tree.simplify_error;
 }
 
-std::string
-encode_tile_json(osg_tree& tree, double x, double y)
+// Appends the tree to nodes in pre-order, tiles without a bounding box are
+// dropped with their sub tree. Returns false if the tree was dropped.
+bool flatten_tile_tree(osg_tree& tree, std::vector<OsgbTileNode>& nodes, std::string& strings)
 {
     if (tree.bbox.max.empty() || tree.bbox.min.empty())
-        return "";
-
-    std::string file_name = get_file_name(tree.file_name);
-    std::string parent_str = get_parent(tree.file_name);
-    std::string file_path = get_file_name(parent_str);
+        return false;
 
-    char buf[512];
-    sprintf(buf, "{ \"geometricError\":%.2f,", tree.geometricError);
-    std::string tile = buf;
-    TileBox cBox = tree.bbox;
-    //cBox.extend(0.1);
-    std::string content_box = get_boundingBox(cBox);
-    TileBox bbox = tree.bbox;
-    //bbox.extend(0.1);
-    std::string tile_box = get_boundingBox(bbox);
-
-    tile += tile_box;
+    size_t index = nodes.size();
+    nodes.push_back(OsgbTileNode());
+    OsgbTileNode& node = nodes.back();
+    std::vector<double> box = convert_bbox(tree.bbox);
+    std::copy(box.begin(), box.end(), node.box);
+    node.geometric_error = tree.geometricError;
+    node.uri_offset = -1;
+    node.uri_len = 0;
     if (tree.type > 0) {
-        tile += ", \"content\":{ \"uri\":";
         // Data/Tile_0/Tile_0.b3dm
-        std::string uri_path = "./";
-        uri_path += file_name;
-        std::string uri = replace(uri_path, ".osgb", tree.type != 2 ? ".b3dm" : "o.b3dm");
-        tile += "\"";
-        tile += uri;
-        tile += "\",";
-        tile += content_box;
-        tile += "}";
-    }
-    tile += ",\"children\":[";
-    for ( auto& i : tree.sub_nodes ){
-        std::string node_json = encode_tile_json(i,x,y);
-        if (!node_json.empty()) {
-            tile += node_json;
-            tile += ",";
-        }
+        std::string uri = "./" + tile_content_uri(tree);
+        node.uri_offset = (int)strings.size();
+        node.uri_len = (int)uri.size();
+        strings += uri;
+    }
+    int child_count = 0;
+    for (auto& i : tree.sub_nodes) {
+        if (flatten_tile_tree(i, nodes, strings))
+            child_count++;
     }
-    if (tile.back() == ',')
-        tile.pop_back();
-    tile += "]}";
-    return tile;
+    // nodes may have been reallocated
+    nodes[index].child_count = child_count;
+    return true;
 }
 
 /***/
-extern "C" void*
-osgb23dtile_path(const char* in_path, const char* out_path,
-                    double *box, int* len, double x, double y,
-                    int max_lvl,
-                    bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true)
+extern "C" bool
+osgb23dtile_path(const OsgbConversionParams* params, OsgbTileTree* result)
 {
+    const char* in_path = params->input_path;
     std::string path = osg_string(in_path);
-    osg_tree root = get_all_tree(path);
+    osg_tree root = convert_tile_tree(path, *params);
     if (root.file_name.empty())
     {
         LOG_E( "open file [%s] fail!", in_path);
-        return NULL;
+        return false;
     }
-    do_tile_job(root, out_path, max_lvl, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
     extend_tile_box(root);
     if (root.bbox.max.empty() || root.bbox.min.empty())
     {
         LOG_E( "[%s] bbox is empty!", in_path);
-        return NULL;
+        return false;
     }
     // prevent for root node disappear
-    calc_geometric_error(root);
-    std::string json = encode_tile_json(root, x, y);
+    calc_geometric_error(root, params->geometric_error_scale);
+    std::vector<OsgbTileNode> nodes;
+    std::string strings;
+    flatten_tile_tree(root, nodes, strings);
     root.bbox.extend(0.2);
-    memcpy(box, root.bbox.max.data(), 3 * sizeof(double));
-    memcpy(box + 3, root.bbox.min.data(), 3 * sizeof(double));
-    void* str = malloc(json.length());
-    memcpy(str, json.c_str(), json.length());
-    *len = json.length();
-    return str;
+    memcpy(result->box, root.bbox.max.data(), 3 * sizeof(double));
+    memcpy(result->box + 3, root.bbox.min.data(), 3 * sizeof(double));
+    result->nodes = (OsgbTileNode*)malloc(nodes.size() * sizeof(OsgbTileNode));
+    memcpy(result->nodes, nodes.data(), nodes.size() * sizeof(OsgbTileNode));
+    result->node_count = (int)nodes.size();
+    result->strings = (char*)malloc(std::max<size_t>(strings.size(), 1));
+    memcpy(result->strings, strings.data(), strings.size());
+    result->strings_len = (int)strings.size();
+    return true;
 }
 
 extern "C" bool
@@ -1564,3 +2719,348 @@ osgb2glb(const char* in, const char* out)
     }
     return true;
 }
+
+// Converts one osgb into a b3dm in memory, for the tile server: all its
+// geometries go to one content and its children above max_lvl are dropped.
+// The conversions running at once share the pool of num_threads workers.
+extern "C" bool
+osgb2b3dm_buf(const OsgbConversionParams* params, OsgbTileBuffer* result)
+{
+    WorkStealingPool::instance((unsigned)std::max(params->num_threads, 0));
+    std::string path = osg_string(params->input_path);
+    std::shared_ptr<const GeoReference> geo_ref = GeoTransform::GetReference();
+    log_osg_plugin_info_once();
+
+    std::string b3dm_buf;
+    MeshInfo minfo;
+    std::vector<std::string> children;
+    {
+        osg::ref_ptr<osg::Node> root = read_osgb_node(path, nullptr, params->enable_fast_reader);
+        if (!root) {
+            LOG_E("read node files [%s] fail!", params->input_path);
+            return false;
+        }
+        InfoVisitor infoVisitor(get_parent(path), false, geo_ref.get());
+        root->accept(infoVisitor);
+        infoVisitor.apply_correction();
+        apply_normals_mode(root.get(), params->normals_mode, params->enable_unlit);
+
+        std::vector<osg::Geometry*> geometry_array = infoVisitor.geometry_array;
+        geometry_array.insert(geometry_array.end(),
+            infoVisitor.other_geometry_array.begin(), infoVisitor.other_geometry_array.end());
+        int level = get_lvl_num(path);
+        std::string prefix = get_parent(path) + "/";
+        for (auto& name : infoVisitor.sub_node_names) {
+            if (get_tile_level(name, level) <= params->max_lvl)
+                children.push_back(name.compare(0, prefix.size(), prefix) == 0 ? name.substr(prefix.size()) : name);
+        }
+        // the server gives a tile half its extent as geometricError
+        double refined_error = children.empty() ? 0.0 : geometry_half_extent(geometry_array);
+        if (!encode_tile_b3dm(*params, geometry_array, infoVisitor.texture_map, b3dm_buf, minfo, refined_error)) {
+            LOG_E("convert [%s] to b3dm fail!", params->input_path);
+            return false;
+        }
+    }
+
+    TileBox bbox;
+    bbox.max = minfo.max;
+    bbox.min = minfo.min;
+    std::vector<double> box = convert_bbox(bbox);
+    std::copy(box.begin(), box.end(), result->box);
+    memcpy(result->bbox, bbox.max.data(), 3 * sizeof(double));
+    memcpy(result->bbox + 3, bbox.min.data(), 3 * sizeof(double));
+    result->geometric_error = get_geometric_error(bbox) + params->geometric_error_scale * minfo.simplify_error;
+
+    std::string names;
+    for (auto& name : children)
+        names += name + "\n";
+    result->b3dm = (char*)malloc(std::max<size_t>(b3dm_buf.size(), 1));
+    memcpy(result->b3dm, b3dm_buf.data(), b3dm_buf.size());
+    result->b3dm_len = (int)b3dm_buf.size();
+    result->children = (char*)malloc(std::max<size_t>(names.size(), 1));
+    memcpy(result->children, names.data(), names.size());
+    result->children_len = (int)names.size();
+    return true;
+}
+
+// Copies an image into the w * h pixels of the atlas at (x, y), nearest
+// sampled. Without image the cell stays white.
+void blit_atlas_cell(osg::Image* img, osg::Image* atlas, int x, int y, int w, int h)
+{
+    if (!img || img->s() <= 0 || img->t() <= 0)
+        return;
+    for (int row = 0; row < h; row++) {
+        unsigned char* dst = atlas->data(x, y + row);
+        for (int col = 0; col < w; col++) {
+            osg::Vec4 c = img->getColor(osg::Vec2((col + 0.5f) / w, (row + 0.5f) / h));
+            dst[col * 3 + 0] = (unsigned char)osg::clampBetween(c.r() * 255.f, 0.f, 255.f);
+            dst[col * 3 + 1] = (unsigned char)osg::clampBetween(c.g() * 255.f, 0.f, 255.f);
+            dst[col * 3 + 2] = (unsigned char)osg::clampBetween(c.b() * 255.f, 0.f, 255.f);
+        }
+    }
+}
+
+osg::Image* texture_image(osg::Texture* tex)
+{
+    return tex && tex->getNumImages() > 0 ? tex->getImage(0) : nullptr;
+}
+
+// Simplified, single texture mesh of a grouping tile. A parent group is
+// built from the proxies of its child groups, so every block root is read
+// once, by the lowest group holding it.
+struct HlodProxy {
+    std::vector<VertexData> vertices;
+    std::vector<unsigned int> indices;
+    osg::ref_ptr<osg::Image> atlas;
+};
+
+// Appends a mesh whose texture coordinates already point into the atlas,
+// simplified to tri_budget triangles. Returns the simplification error in
+// meters.
+double append_hlod_mesh(std::vector<VertexData>& mesh_vertices, std::vector<unsigned int>& mesh_indices,
+                        size_t tri_budget, const OsgbHlodParams& params, HlodProxy& proxy)
+{
+    SimplificationParams simplify_params;
+    simplify_params.enable_simplification = true;
+    simplify_params.preserve_normals = false;
+    simplify_params.target_error = (float)params.max_error;
+    simplify_params.target_ratio = std::min(1.f, (float)(tri_budget * 3) / mesh_indices.size());
+    size_t vertex_count = mesh_vertices.size();
+    std::vector<unsigned int> simplified_indices;
+    size_t simplified_count = 0;
+    float result_error = 0;
+    optimize_and_simplify_mesh(mesh_vertices, vertex_count, mesh_indices, mesh_indices.size(),
+                               simplified_indices, simplified_count, simplify_params, &result_error);
+
+    // the error is relative to the largest extent of the mesh
+    float min_xyz[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max_xyz[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < vertex_count; i++) {
+        const float* p = &mesh_vertices[i].x;
+        for (int k = 0; k < 3; k++) {
+            min_xyz[k] = std::min(min_xyz[k], p[k]);
+            max_xyz[k] = std::max(max_xyz[k], p[k]);
+        }
+    }
+    float extent = 0;
+    for (int k = 0; k < 3; k++)
+        extent = std::max(extent, max_xyz[k] - min_xyz[k]);
+
+    unsigned int base = (unsigned int)proxy.vertices.size();
+    proxy.vertices.insert(proxy.vertices.end(), mesh_vertices.begin(), mesh_vertices.begin() + vertex_count);
+    for (size_t i = 0; i < simplified_count; i++)
+        proxy.indices.push_back(base + simplified_indices[i]);
+    return (double)result_error * extent;
+}
+
+// Appends the coarsest geometry of a block to the proxy: the textures are
+// copied into the atlas cell of the block and the texture coordinates are
+// moved into it. Returns false if the block has no geometry.
+bool append_hlod_block(const std::string& path, int cell_x, int cell_y, int cell_size, size_t tri_budget,
+                       const OsgbHlodParams& params, FilePrefetcher* prefetcher, HlodProxy& proxy, double& error)
+{
+    osg::ref_ptr<osg::Node> root = read_osgb_node(path, prefetcher, params.enable_fast_reader);
+    if (!root.valid()) {
+        LOG_E("open file [%s] fail!", path.c_str());
+        return false;
+    }
+    std::shared_ptr<const GeoReference> geo_ref = GeoTransform::GetReference();
+    InfoVisitor infoVisitor(get_parent(path), false, geo_ref.get());
+    root->accept(infoVisitor);
+    infoVisitor.apply_correction();
+    std::vector<osg::Geometry*>& geometry_array = infoVisitor.geometry_array.empty()
+        ? infoVisitor.other_geometry_array : infoVisitor.geometry_array;
+    if (geometry_array.empty())
+        return false;
+
+    // one sub cell per texture of the block
+    osg::Image* atlas = proxy.atlas.get();
+    std::map<osg::Texture*, int> sub_cells;
+    for (auto g : geometry_array)
+        sub_cells.emplace(infoVisitor.texture_map[g], (int)sub_cells.size());
+    int grid = (int)std::ceil(std::sqrt((double)sub_cells.size()));
+    int sub_size = std::max(1, cell_size / grid);
+    for (auto& [tex, k] : sub_cells)
+        blit_atlas_cell(texture_image(tex), atlas, cell_x + k % grid * sub_size, cell_y + k / grid * sub_size, sub_size, sub_size);
+
+    std::vector<VertexData> block_vertices;
+    std::vector<unsigned int> block_indices;
+    for (auto g : geometry_array) {
+        osg::Vec3Array* v3f = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+        if (!v3f)
+            continue;
+        osg::Vec2Array* v2f = dynamic_cast<osg::Vec2Array*>(g->getTexCoordArray(0));
+        int k = sub_cells[infoVisitor.texture_map[g]];
+        float u0 = (float)(cell_x + k % grid * sub_size) / atlas->s();
+        float v0 = (float)(cell_y + k / grid * sub_size) / atlas->t();
+        float du = (float)sub_size / atlas->s();
+        float dv = (float)sub_size / atlas->t();
+
+        unsigned int base = (unsigned int)block_vertices.size();
+        for (size_t i = 0; i < v3f->size(); i++) {
+            VertexData v;
+            v.x = (*v3f)[i].x(); v.y = (*v3f)[i].y(); v.z = (*v3f)[i].z();
+            osg::Vec2 uv = v2f && i < v2f->size() ? (*v2f)[i] : osg::Vec2(0.5f, 0.5f);
+            v.u = u0 + osg::clampBetween(uv.x(), 0.f, 1.f) * du;
+            v.v = v0 + osg::clampBetween(uv.y(), 0.f, 1.f) * dv;
+            block_vertices.push_back(v);
+        }
+        osg::TriangleIndexFunctor<TriangleCollector> collector;
+        std::vector<unsigned int> triangles;
+        collector.indices = &triangles;
+        g->accept(collector);
+        for (auto idx : triangles)
+            block_indices.push_back(base + idx);
+    }
+    if (block_indices.empty())
+        return false;
+
+    error = std::max(error, append_hlod_mesh(block_vertices, block_indices, tri_budget, params, proxy));
+    return true;
+}
+
+// Appends the proxy of a child group, its atlas scaled into the cell
+void append_hlod_child(HlodProxy& child, int cell_x, int cell_y, int cell_size, size_t tri_budget,
+                       const OsgbHlodParams& params, HlodProxy& proxy, double& error)
+{
+    osg::Image* atlas = proxy.atlas.get();
+    blit_atlas_cell(child.atlas.get(), atlas, cell_x, cell_y, cell_size, cell_size);
+    float u0 = (float)cell_x / atlas->s();
+    float v0 = (float)cell_y / atlas->t();
+    float du = (float)cell_size / atlas->s();
+    float dv = (float)cell_size / atlas->t();
+    for (auto& v : child.vertices) {
+        v.u = u0 + osg::clampBetween(v.u, 0.f, 1.f) * du;
+        v.v = v0 + osg::clampBetween(v.v, 0.f, 1.f) * dv;
+    }
+    error = std::max(error, append_hlod_mesh(child.vertices, child.indices, tri_budget, params, proxy));
+}
+
+// Writes the proxy with the encoding options of the tiles. refined_error:
+// see tile_draco_position_error()
+bool write_hlod_proxy(HlodProxy& proxy, const OsgbHlodParams& params, const char* output_path, double refined_error)
+{
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+    osg::ref_ptr<osg::Vec3Array> v3f = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> v2f = new osg::Vec2Array;
+    v3f->reserve(proxy.vertices.size());
+    v2f->reserve(proxy.vertices.size());
+    for (auto& v : proxy.vertices) {
+        v3f->push_back(osg::Vec3(v.x, v.y, v.z));
+        v2f->push_back(osg::Vec2(v.u, v.v));
+    }
+    geometry->setVertexArray(v3f.get());
+    geometry->setTexCoordArray(0, v2f.get());
+    geometry->addPrimitiveSet(new osg::DrawElementsUInt(GL_TRIANGLES, proxy.indices.begin(), proxy.indices.end()));
+    if (!params.enable_unlit)
+        osgUtil::SmoothingVisitor::smooth(*geometry);
+
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(proxy.atlas.get());
+    std::vector<osg::Geometry*> geometry_array = { geometry.get() };
+    std::set<osg::Texture*> texture_array = { texture.get() };
+    std::map<osg::Geometry*, osg::Texture*> texture_map = { { geometry.get(), texture.get() } };
+
+    MeshInfo minfo;
+    std::string glb_buf, b3dm_buf;
+    double draco_position_error = params.enable_draco && params.draco_error_fraction > 0
+        ? params.draco_error_fraction * refined_error : 0.0;
+    if (!geometry2glb_buf(geometry_array, texture_array, texture_map, glb_buf, minfo,
+                          params.enable_texture_compress, false, params.enable_draco, params.enable_unlit,
+                          params.enable_optimize_mesh, params.draco_encoding_speed, params.draco_decoding_speed,
+                          params.enable_meshopt_compression, params.enable_quantize, draco_position_error))
+        return false;
+    glb2b3dm_buf(glb_buf, b3dm_buf);
+    return write_file(output_path, b3dm_buf.data(), (unsigned long)b3dm_buf.size());
+}
+
+// Builds and writes the proxy of groups[index] after those of its child
+// groups, which are built in parallel. The proxy stays in memory until the
+// parent group took it.
+bool build_hlod_group(const OsgbHlodParams& params, int index, HlodProxy& proxy)
+{
+    OsgbHlodGroup& group = params.groups[index];
+    group.written = false;
+    group.simplify_error = 0;
+    std::vector<HlodProxy> children(group.group_count);
+    std::vector<char> built(group.group_count, 0);
+    {
+        TaskGroup tasks(WorkStealingPool::instance());
+        for (int i = 0; i < group.group_count; i++) {
+            tasks.run([&params, &group, &children, &built, i]() {
+                built[i] = build_hlod_group(params, group.groups[i], children[i]);
+            });
+        }
+        tasks.wait();
+    }
+
+    int input_count = group.group_count + group.block_count;
+    if (input_count <= 0)
+        return false;
+    int grid = (int)std::ceil(std::sqrt((double)input_count));
+    int cell_size = std::max(1, params.atlas_size / grid);
+    proxy.atlas = new osg::Image;
+    proxy.atlas->allocateImage(params.atlas_size, params.atlas_size, 1, GL_RGB, GL_UNSIGNED_BYTE);
+    memset(proxy.atlas->data(), 255, proxy.atlas->getTotalSizeInBytes());
+
+    // the child groups take the first cells, then the blocks
+    size_t tri_budget = std::max<size_t>(64, params.max_triangles / input_count);
+    double error = 0;
+    for (int i = 0; i < group.group_count; i++) {
+        if (built[i])
+            append_hlod_child(children[i], i % grid * cell_size, i / grid * cell_size, cell_size,
+                              tri_budget, params, proxy, error);
+        children[i] = HlodProxy();
+    }
+    // the prefetcher reads the last requested file first
+    FilePrefetcher* prefetcher = params.prefetch_mb > 0
+        ? &FilePrefetcher::instance((size_t)params.prefetch_mb * 1024 * 1024) : nullptr;
+    for (int j = group.block_count - 1; prefetcher && j >= 0; j--)
+        prefetcher->prefetch(osg_string(params.input_paths[group.blocks[j]]));
+    for (int j = 0; j < group.block_count; j++) {
+        int i = group.group_count + j;
+        std::string path = osg_string(params.input_paths[group.blocks[j]]);
+        append_hlod_block(path, i % grid * cell_size, i / grid * cell_size, cell_size,
+                          tri_budget, params, prefetcher, proxy, error);
+    }
+    if (proxy.indices.empty()) {
+        LOG_E("hlod [%s] has no geometry", group.output_path);
+        return false;
+    }
+    if (!write_hlod_proxy(proxy, params, group.output_path, group.refined_error)) {
+        LOG_E("write hlod [%s] fail!", group.output_path);
+        return false;
+    }
+    group.written = true;
+    group.simplify_error = error;
+    return true;
+}
+
+// Writes the HLOD proxies of all the grouping tiles, bottom up: a group is
+// simplified from the proxies of its child groups and the root files of
+// the blocks directly under it.
+extern "C" bool
+osgb_hlod_proxies(const OsgbHlodParams* params)
+{
+    if (params->group_count <= 0 || params->atlas_size <= 0)
+        return false;
+
+    log_osg_plugin_info_once();
+
+    std::vector<char> is_child(params->group_count, 0);
+    for (int i = 0; i < params->group_count; i++) {
+        const OsgbHlodGroup& group = params->groups[i];
+        for (int k = 0; k < group.group_count; k++)
+            is_child[group.groups[k]] = 1;
+    }
+    TaskGroup tasks(WorkStealingPool::instance());
+    for (int i = 0; i < params->group_count; i++) {
+        if (is_child[i])
+            continue;
+        tasks.run([params, i]() {
+            HlodProxy proxy;
+            build_hlod_group(*params, i, proxy);
+        });
+    }
+    tasks.wait();
+    return true;
+}
@@ -0,0 +1,592 @@
+#include "osgb_reader.h"
+
+#include <cstring>
+#include <map>
+
+namespace {
+
+// osg2 binary header, see osgDB/StreamOperator
+const uint32_t OSG_HEADER_LOW = 0x6C910EA1;
+const uint32_t OSG_HEADER_HIGH = 0x1AFB4545;
+const uint32_t READ_SCENE = 1;
+
+// The serializer layout depends on the version that wrote the file; only
+// the one checked against real files is parsed here.
+const uint32_t SUPPORTED_VERSION = 91;
+
+// Array and primitive set ids of the binary format
+const uint32_t ID_VEC2_ARRAY = 15;
+const uint32_t ID_VEC3_ARRAY = 16;
+const uint32_t ID_DRAWARRAYS = 50;
+const uint32_t ID_DRAWELEMENTS_UBYTE = 52;
+const uint32_t ID_DRAWELEMENTS_USHORT = 53;
+const uint32_t ID_DRAWELEMENTS_UINT = 54;
+
+// Element size of the array ids 0 (ByteArray) to 20 (Vec4dArray)
+const size_t ARRAY_ELEMENT_SIZE[] = { 1, 1, 2, 2, 4, 4, 4, 8, 2, 3, 4, 4, 4, 6, 8, 8, 12, 16, 16, 24, 32 };
+
+const int BIND_PER_VERTEX = 4;
+const int IMAGE_INLINE_FILE = 1;
+const int IMAGE_EXTERNAL = 2;
+
+const int GL_TRIANGLES_MODE = 4;
+const int GL_TRIANGLE_STRIP_MODE = 5;
+const int GL_TRIANGLE_FAN_MODE = 6;
+const int GL_QUADS_MODE = 7;
+
+struct Array {
+    uint32_t type = 0;
+    std::vector<float> values;          // Only kept for Vec2 and Vec3 arrays
+};
+
+struct ArrayData {
+    const Array* array = nullptr;
+    int binding = 0;
+};
+
+class OsgbParser {
+public:
+    OsgbParser(const std::string& bytes, OsgbFastScene& scene)
+        : p((const unsigned char*)bytes.data()), end(p + bytes.size()), scene(scene) {}
+
+    bool parse()
+    {
+        if (u32() != OSG_HEADER_LOW || u32() != OSG_HEADER_HIGH)
+            return false;
+        if (u32() != READ_SCENE || u32() != SUPPORTED_VERSION)
+            return false;
+        // no domain versions, schema or robust format
+        if (u32() != 0)
+            return false;
+        // no compressor
+        if (str() != "0")
+            return false;
+        int texture;
+        if (!object(-1, texture))
+            return false;
+        return ok && p == end;
+    }
+
+private:
+    bool fail() { ok = false; return false; }
+
+    bool need(size_t n)
+    {
+        if (!ok || (size_t)(end - p) < n)
+            return fail();
+        return true;
+    }
+
+    template <typename T>
+    T read()
+    {
+        T v{};
+        if (need(sizeof(T))) {
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+        }
+        return v;
+    }
+
+    uint32_t u32() { return read<uint32_t>(); }
+    int32_t i32() { return read<int32_t>(); }
+    float f32() { return read<float>(); }
+    bool flag() { return read<uint8_t>() != 0; }
+
+    void skip(size_t n)
+    {
+        if (need(n))
+            p += n;
+    }
+
+    std::string str()
+    {
+        uint32_t n = u32();
+        if (!need(n))
+            return std::string();
+        std::string s((const char*)p, n);
+        p += n;
+        return s;
+    }
+
+    // name, data variance, no user data
+    bool object_fields()
+    {
+        str();
+        i32();
+        if (flag())
+            return fail();
+        return ok;
+    }
+
+    // initial bound and callbacks are not supported
+    bool node_fields()
+    {
+        for (int i = 0; i < 5; i++) {
+            if (flag())
+                return fail();
+        }
+        flag();     // CullingActive
+        u32();      // NodeMask
+        if (flag()) {
+            int texture;
+            if (!object(-1, texture))
+                return false;
+        }
+        return ok;
+    }
+
+    bool children(int lod)
+    {
+        if (flag()) {
+            uint32_t n = u32();
+            for (uint32_t i = 0; i < n && ok; i++) {
+                int texture;
+                if (!object(lod, texture))
+                    return false;
+            }
+        }
+        return ok;
+    }
+
+    bool group(int lod) { return node_fields() && children(lod); }
+
+    bool geode(int lod) { return node_fields() && children(lod); }
+
+    bool paged_lod()
+    {
+        if (!node_fields())
+            return false;
+        OsgbFastLod fast_lod;
+        i32();          // CenterMode
+        if (flag())     // UserCenter
+            skip(4 * sizeof(double));
+        i32();          // RangeMode
+        if (flag()) {
+            uint32_t n = u32();
+            for (uint32_t i = 0; i < n && ok; i++) {
+                fast_lod.ranges.push_back(f32());
+                fast_lod.ranges.push_back(f32());
+            }
+        }
+        if (flag() && flag())   // DatabasePath
+            str();
+        u32();          // NumChildrenThatCannotBeExpired
+        flag();         // DisableExternalChildrenPaging
+        if (flag()) {   // RangeDataList
+            uint32_t n = u32();
+            for (uint32_t i = 0; i < n && ok; i++)
+                fast_lod.file_names.push_back(str());
+            n = u32();
+            skip((size_t)n * 2 * sizeof(float));
+        }
+        if (!ok)
+            return false;
+        int index = (int)scene.lods.size();
+        scene.lods.push_back(std::move(fast_lod));
+        return children(index);
+    }
+
+    // Returns the texture of unit 0 in texture
+    bool state_set(int& texture)
+    {
+        texture = -1;
+        if (flag()) {   // ModeList
+            uint32_t n = u32();
+            skip((size_t)n * 2 * sizeof(int32_t));
+        }
+        if (flag()) {   // AttributeList
+            uint32_t n = u32();
+            for (uint32_t i = 0; i < n && ok; i++) {
+                int attribute_texture;
+                if (!object(-1, attribute_texture))
+                    return false;
+                i32();
+            }
+        }
+        if (flag()) {   // TextureModeList
+            uint32_t units = u32();
+            for (uint32_t i = 0; i < units && ok; i++) {
+                uint32_t n = u32();
+                skip((size_t)n * 2 * sizeof(int32_t));
+            }
+        }
+        if (flag()) {   // TextureAttributeList
+            uint32_t units = u32();
+            for (uint32_t unit = 0; unit < units && ok; unit++) {
+                uint32_t n = u32();
+                for (uint32_t i = 0; i < n && ok; i++) {
+                    int attribute_texture;
+                    if (!object(-1, attribute_texture))
+                        return false;
+                    i32();
+                    if (unit == 0 && attribute_texture >= 0)
+                        texture = attribute_texture;
+                }
+            }
+        }
+        if (flag())     // UniformList
+            return fail();
+        i32();          // RenderingHint
+        i32();          // RenderBinMode
+        i32();          // BinNumber
+        str();          // BinName
+        flag();         // NestRenderBins
+        if (flag() || flag())
+            return fail();
+        return ok;
+    }
+
+    bool state_attribute_fields()
+    {
+        if (flag() || flag())
+            return fail();
+        return ok;
+    }
+
+    bool material()
+    {
+        if (!state_attribute_fields())
+            return false;
+        i32();          // ColorMode
+        for (int i = 0; i < 4; i++) {   // Ambient, Diffuse, Specular, Emission
+            if (flag()) {
+                flag();
+                skip(8 * sizeof(float));
+            }
+        }
+        if (flag()) {   // Shininess
+            flag();
+            skip(2 * sizeof(float));
+        }
+        return ok;
+    }
+
+    bool texture2d(int& texture)
+    {
+        texture = -1;
+        if (!state_attribute_fields())
+            return false;
+        for (int i = 0; i < 5; i++) {   // Wrap S/T/R, Min/Mag filter
+            if (flag())
+                i32();
+        }
+        f32();          // MaxAnisotropy
+        skip(4);        // UseHardwareMipMapGeneration .. ResizeNonPowerOfTwoHint
+        skip(4 * sizeof(double));   // BorderColor
+        i32();          // BorderWidth
+        i32();          // InternalFormatMode
+        for (int i = 0; i < 3; i++) {   // InternalFormat, SourceFormat, SourceType
+            if (flag())
+                i32();
+        }
+        flag();         // ShadowComparison
+        i32();          // ShadowCompareFunc
+        i32();          // ShadowTextureMode
+        f32();          // ShadowAmbient
+        if (flag() && !image(texture))
+            return false;
+        i32();          // TextureWidth
+        i32();          // TextureHeight
+        return ok;
+    }
+
+    bool image(int& texture)
+    {
+        uint32_t id = u32();
+        auto it = images.find(id);
+        if (it != images.end()) {
+            texture = it->second;
+            return ok;
+        }
+        OsgbFastTexture fast_texture;
+        fast_texture.file_name = str();
+        i32();          // WriteHint
+        int decision = i32();
+        if (decision == IMAGE_INLINE_FILE) {
+            uint32_t n = u32();
+            if (!need(n))
+                return false;
+            fast_texture.bytes.assign((const char*)p, n);
+            p += n;
+        }
+        else if (decision != IMAGE_EXTERNAL || fast_texture.file_name.empty()) {
+            return fail();
+        }
+        if (!object_fields())
+            return false;
+        texture = (int)scene.textures.size();
+        scene.textures.push_back(std::move(fast_texture));
+        images[id] = texture;
+        return ok;
+    }
+
+    bool array(const Array*& result)
+    {
+        uint32_t id = u32();
+        auto it = arrays.find(id);
+        if (it != arrays.end()) {
+            result = &it->second;
+            return ok;
+        }
+        Array a;
+        a.type = u32();
+        uint32_t n = u32();
+        if (!ok || a.type >= sizeof(ARRAY_ELEMENT_SIZE) / sizeof(ARRAY_ELEMENT_SIZE[0]))
+            return fail();
+        size_t bytes = (size_t)n * ARRAY_ELEMENT_SIZE[a.type];
+        if (!need(bytes))
+            return false;
+        if (a.type == ID_VEC2_ARRAY || a.type == ID_VEC3_ARRAY) {
+            a.values.resize(bytes / sizeof(float));
+            memcpy(a.values.data(), p, bytes);
+        }
+        p += bytes;
+        result = &(arrays[id] = std::move(a));
+        return ok;
+    }
+
+    // indexed arrays (osg::IndexArray) are not supported
+    bool array_data(ArrayData& data)
+    {
+        if (flag() && !array(data.array))
+            return false;
+        if (flag())
+            return fail();
+        data.binding = i32();
+        i32();          // Normalize
+        return ok;
+    }
+
+    // VertexData .. FogCoordData
+    bool optional_array_data(ArrayData& data)
+    {
+        if (flag())
+            return array_data(data);
+        return ok;
+    }
+
+    bool array_data_list(std::vector<ArrayData>& list)
+    {
+        if (flag()) {
+            uint32_t n = u32();
+            for (uint32_t i = 0; i < n && ok; i++) {
+                list.emplace_back();
+                if (!array_data(list.back()))
+                    return false;
+            }
+        }
+        return ok;
+    }
+
+    // Appends the triangles of a primitive set to indices
+    bool triangles(int mode, const std::vector<uint32_t>& elements, std::vector<uint32_t>& indices)
+    {
+        size_t n = elements.size();
+        switch (mode) {
+        case GL_TRIANGLES_MODE:
+            indices.insert(indices.end(), elements.begin(), elements.begin() + n / 3 * 3);
+            break;
+        case GL_TRIANGLE_STRIP_MODE:
+            for (size_t i = 2; i < n; i++) {
+                if (i % 2 == 0)
+                    indices.insert(indices.end(), { elements[i - 2], elements[i - 1], elements[i] });
+                else
+                    indices.insert(indices.end(), { elements[i - 1], elements[i - 2], elements[i] });
+            }
+            break;
+        case GL_TRIANGLE_FAN_MODE:
+            for (size_t i = 2; i < n; i++)
+                indices.insert(indices.end(), { elements[0], elements[i - 1], elements[i] });
+            break;
+        case GL_QUADS_MODE:
+            for (size_t i = 0; i + 3 < n; i += 4) {
+                indices.insert(indices.end(), { elements[i], elements[i + 1], elements[i + 2] });
+                indices.insert(indices.end(), { elements[i], elements[i + 2], elements[i + 3] });
+            }
+            break;
+        default:
+            return fail();
+        }
+        return true;
+    }
+
+    bool primitive_set(std::vector<uint32_t>& indices)
+    {
+        uint32_t type = u32();
+        int mode = i32();
+        std::vector<uint32_t> elements;
+        if (type == ID_DRAWARRAYS) {
+            int first = i32();
+            int count = i32();
+            // every vertex takes more than a byte of the arrays that follow
+            if (first < 0 || count < 0 || (size_t)first + count > (size_t)(end - p))
+                return fail();
+            for (int i = 0; i < count; i++)
+                elements.push_back((uint32_t)(first + i));
+        }
+        else if (type >= ID_DRAWELEMENTS_UBYTE && type <= ID_DRAWELEMENTS_UINT) {
+            uint32_t n = u32();
+            size_t size = type == ID_DRAWELEMENTS_UBYTE ? 1 : type == ID_DRAWELEMENTS_USHORT ? 2 : 4;
+            if (!need((size_t)n * size))
+                return false;
+            elements.resize(n);
+            for (uint32_t i = 0; i < n; i++, p += size) {
+                if (size == 1) {
+                    elements[i] = *p;
+                }
+                else if (size == 2) {
+                    uint16_t v;
+                    memcpy(&v, p, 2);
+                    elements[i] = v;
+                }
+                else {
+                    memcpy(&elements[i], p, 4);
+                }
+            }
+        }
+        else {
+            return fail();
+        }
+        return ok && triangles(mode, elements, indices);
+    }
+
+    bool geometry(int lod)
+    {
+        int texture = -1;
+        if (flag() && !object(-1, texture))     // StateSet
+            return false;
+        for (int i = 0; i < 3; i++) {   // InitialBound, ComputeBoundingBoxCallback, Shape
+            if (flag())
+                return fail();
+        }
+        skip(3);        // SupportsDisplayList, UseDisplayList, UseVertexBufferObjects
+        for (int i = 0; i < 4; i++) {   // Update, Event, Cull and Draw callbacks
+            if (flag())
+                return fail();
+        }
+
+        OsgbFastGeometry geom;
+        geom.lod = lod;
+        geom.texture = texture;
+        uint32_t n = u32();     // PrimitiveSetList
+        for (uint32_t i = 0; i < n && ok; i++) {
+            if (!primitive_set(geom.indices))
+                return false;
+        }
+        ArrayData vertex, normal, color, secondary_color, fog_coord;
+        std::vector<ArrayData> texcoords, attributes;
+        if (!optional_array_data(vertex) || !optional_array_data(normal) || !optional_array_data(color)
+            || !optional_array_data(secondary_color) || !optional_array_data(fog_coord)
+            || !array_data_list(texcoords) || !array_data_list(attributes))
+            return false;
+        flag();         // FastPathHint
+        if (!ok)
+            return false;
+
+        // geometries without vertices or primitives are skipped, as InfoVisitor does
+        if (!vertex.array || vertex.array->values.empty() || geom.indices.empty())
+            return true;
+        if (vertex.array->type != ID_VEC3_ARRAY)
+            return fail();
+        size_t vertex_count = vertex.array->values.size() / 3;
+        for (auto idx : geom.indices) {
+            if (idx >= vertex_count)
+                return fail();
+        }
+        geom.positions = vertex.array->values;
+        if (normal.array && normal.array->type == ID_VEC3_ARRAY && normal.binding == BIND_PER_VERTEX
+            && normal.array->values.size() == vertex_count * 3)
+            geom.normals = normal.array->values;
+        if (!texcoords.empty() && texcoords[0].array && texcoords[0].array->type == ID_VEC2_ARRAY
+            && texcoords[0].array->values.size() == vertex_count * 2)
+            geom.texcoords = texcoords[0].array->values;
+        scene.geometries.push_back(std::move(geom));
+        return true;
+    }
+
+    // Reads one object; texture is the texture of a StateSet or Texture2D.
+    // Shared state sets and attributes are resolved by their unique id,
+    // shared nodes are not supported.
+    bool object(int lod, int& texture)
+    {
+        texture = -1;
+        std::string cls = str();
+        if (!ok)
+            return false;
+        if (cls == "NULL")
+            return true;
+        uint32_t id = u32();
+        auto it = objects.find(id);
+        if (it != objects.end()) {
+            if (it->second.cls != cls || it->second.node)
+                return fail();
+            texture = it->second.texture;
+            return ok;
+        }
+        if (!object_fields())
+            return false;
+
+        Object& obj = objects[id];
+        obj.cls = cls;
+        if (cls == "osg::PagedLOD") {
+            obj.node = true;
+            return paged_lod();
+        }
+        if (cls == "osg::Group") {
+            obj.node = true;
+            return group(lod);
+        }
+        if (cls == "osg::Geode") {
+            obj.node = true;
+            return geode(lod);
+        }
+        if (cls == "osg::Geometry") {
+            obj.node = true;
+            return geometry(lod);
+        }
+        if (cls == "osg::StateSet") {
+            if (!state_set(texture))
+                return false;
+        }
+        else if (cls == "osg::Texture2D") {
+            if (!texture2d(texture))
+                return false;
+        }
+        else if (cls == "osg::Material") {
+            if (!material())
+                return false;
+        }
+        else {
+            return fail();
+        }
+        objects[id].texture = texture;
+        return ok;
+    }
+
+    struct Object {
+        std::string cls;
+        bool node = false;
+        int texture = -1;
+    };
+
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+    OsgbFastScene& scene;
+    std::map<uint32_t, Object> objects;
+    std::map<uint32_t, Array> arrays;
+    std::map<uint32_t, int> images;
+};
+
+} // namespace
+
+bool read_osgb_fast(const std::string& bytes, OsgbFastScene& scene)
+{
+    scene = OsgbFastScene();
+    OsgbParser parser(bytes, scene);
+    if (parser.parse())
+        return true;
+    scene = OsgbFastScene();
+    return false;
+}
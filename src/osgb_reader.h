@@ -0,0 +1,44 @@
+#ifndef OSGB_READER_H
+#define OSGB_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Image of a fast-path osgb texture: the image file embedded in the osgb
+// (jpg, png...) as it is stored, or only its name for an external file
+struct OsgbFastTexture {
+    std::string file_name;
+    std::string bytes;                  // Empty: external image file
+};
+
+// Triangles of one osg::Geometry
+struct OsgbFastGeometry {
+    std::vector<float> positions;       // xyz
+    std::vector<float> normals;         // xyz per vertex, or empty
+    std::vector<float> texcoords;       // uv per vertex of texture unit 0, or empty
+    std::vector<uint32_t> indices;      // GL_TRIANGLES
+    int texture = -1;                   // Index in OsgbFastScene::textures
+    int lod = -1;                       // Innermost PagedLOD, -1: none
+};
+
+struct OsgbFastLod {
+    std::vector<std::string> file_names;    // Per child, as stored in the PagedLOD
+    std::vector<float> ranges;              // min, max per child
+};
+
+struct OsgbFastScene {
+    std::vector<OsgbFastLod> lods;
+    std::vector<OsgbFastGeometry> geometries;
+    std::vector<OsgbFastTexture> textures;
+};
+
+// Parses an osgb (OSG binary, osg2 plugin) without going through the OSG
+// serializers. Only the subset written by photogrammetry tools is handled:
+// PagedLOD/Group/Geode trees of Geometry with a Material and a Texture2D.
+// Returns false for anything else (other versions, classes, callbacks,
+// indexed arrays...), the caller then reads the file with OSG.
+bool read_osgb_fast(const std::string& bytes, OsgbFastScene& scene);
+
+#endif // OSGB_READER_H
@@ -0,0 +1,604 @@
+use std::collections::{BTreeMap, HashMap};
+use std::error::Error;
+use std::fs;
+use std::io::{BufRead, BufReader, Write};
+use std::net::{TcpListener, TcpStream};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex, OnceLock};
+use std::time;
+
+use crate::osgb::{self, TileBuffer, TileSettings};
+
+const MB: u64 = 1024 * 1024;
+
+pub struct ServeOptions {
+    pub input: PathBuf,            // Dataset directory holding Data/
+    pub cache_dir: Option<PathBuf>, // On-disk cache tier, None: memory only
+    pub port: u16,
+    pub cache_mb: u64,
+    pub disk_cache_mb: u64,        // 0: unbounded
+    pub num_threads: usize,        // Conversions running at once
+    pub region_offset: Option<f64>,
+    pub enu_offset: Option<(f64, f64, f64)>,
+    pub origin_height: Option<f64>,
+    pub settings: TileSettings,
+}
+
+/// Least recently used keys and their sizes, bounded by a byte budget
+/// (0: unbounded). The most recently inserted key is never evicted.
+struct Lru {
+    budget: u64,
+    used: u64,
+    tick: u64,
+    entries: HashMap<String, (u64, u64)>, // size, tick
+    order: BTreeMap<u64, String>,
+}
+
+impl Lru {
+    fn new(budget: u64) -> Self {
+        Lru {
+            budget,
+            used: 0,
+            tick: 0,
+            entries: HashMap::new(),
+            order: BTreeMap::new(),
+        }
+    }
+
+    fn touch(&mut self, key: &str) -> bool {
+        let tick = self.tick + 1;
+        match self.entries.get_mut(key) {
+            Some(entry) => {
+                self.order.remove(&entry.1);
+                entry.1 = tick;
+                self.order.insert(tick, key.to_string());
+                self.tick = tick;
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn remove(&mut self, key: &str) {
+        if let Some((size, tick)) = self.entries.remove(key) {
+            self.order.remove(&tick);
+            self.used -= size;
+        }
+    }
+
+    /// Adds a key, returns the keys evicted to make room for it
+    fn insert(&mut self, key: String, size: u64) -> Vec<String> {
+        self.remove(&key);
+        self.tick += 1;
+        self.used += size;
+        self.entries.insert(key.clone(), (size, self.tick));
+        self.order.insert(self.tick, key);
+        let mut evicted = vec![];
+        while self.budget > 0 && self.used > self.budget && self.order.len() > 1 {
+            let (_, oldest) = self.order.pop_first().unwrap();
+            let (size, _) = self.entries.remove(&oldest).unwrap();
+            self.used -= size;
+            evicted.push(oldest);
+        }
+        evicted
+    }
+}
+
+/// Converted files by url path: a memory tier, backed by an optional disk
+/// tier whose files are a partial copy of the converted dataset
+struct TileCache {
+    memory: Mutex<(Lru, HashMap<String, Arc<Vec<u8>>>)>,
+    disk: Option<(PathBuf, Mutex<Lru>)>,
+}
+
+impl TileCache {
+    fn new(memory_budget: u64, disk: Option<(PathBuf, u64)>) -> Self {
+        let disk = disk.map(|(dir, budget)| {
+            // files of previous runs, oldest first
+            let mut files = vec![];
+            collect_cached_files(&dir, &dir.join("Data"), &mut files);
+            files.sort_by_key(|x| x.2);
+            let mut lru = Lru::new(budget);
+            for (key, size, _) in files {
+                for old in lru.insert(key, size) {
+                    let _ = fs::remove_file(dir.join(&old));
+                }
+            }
+            (dir, Mutex::new(lru))
+        });
+        TileCache {
+            memory: Mutex::new((Lru::new(memory_budget), HashMap::new())),
+            disk,
+        }
+    }
+
+    fn get(&self, key: &str) -> Option<Arc<Vec<u8>>> {
+        {
+            let mut memory = self.memory.lock().unwrap();
+            if memory.0.touch(key) {
+                return memory.1.get(key).cloned();
+            }
+        }
+        let (dir, lru) = self.disk.as_ref()?;
+        if !lru.lock().unwrap().touch(key) {
+            return None;
+        }
+        let bytes = Arc::new(fs::read(dir.join(key)).ok()?);
+        self.put_memory(key, bytes.clone());
+        Some(bytes)
+    }
+
+    fn put(&self, key: &str, bytes: Arc<Vec<u8>>) {
+        self.put_memory(key, bytes.clone());
+        if let Some((dir, lru)) = self.disk.as_ref() {
+            let path = dir.join(key);
+            if let Some(parent) = path.parent() {
+                let _ = fs::create_dir_all(parent);
+            }
+            if let Err(e) = fs::write(&path, bytes.as_slice()) {
+                error!("write {} failed: {}", path.display(), e);
+                return;
+            }
+            for old in lru.lock().unwrap().insert(key.to_string(), bytes.len() as u64) {
+                let _ = fs::remove_file(dir.join(&old));
+            }
+        }
+    }
+
+    fn put_memory(&self, key: &str, bytes: Arc<Vec<u8>>) {
+        let mut memory = self.memory.lock().unwrap();
+        let (lru, map) = &mut *memory;
+        for old in lru.insert(key.to_string(), bytes.len() as u64) {
+            map.remove(&old);
+        }
+        map.insert(key.to_string(), bytes);
+    }
+}
+
+/// .json and .b3dm files under `dir`, as (url path, size, mtime)
+fn collect_cached_files(root: &Path, dir: &Path, files: &mut Vec<(String, u64, time::SystemTime)>) {
+    let entries = match fs::read_dir(dir) {
+        Ok(x) => x,
+        Err(_) => return,
+    };
+    for entry in entries.flatten() {
+        let path = entry.path();
+        if path.is_dir() {
+            collect_cached_files(root, &path, files);
+            continue;
+        }
+        let ext = path.extension().and_then(|x| x.to_str()).unwrap_or("");
+        if ext != "json" && ext != "b3dm" {
+            continue;
+        }
+        if let (Ok(meta), Ok(rel)) = (entry.metadata(), path.strip_prefix(root)) {
+            let key = rel.to_string_lossy().replace('\\', "/");
+            files.push((key, meta.len(), meta.modified().unwrap_or(time::UNIX_EPOCH)));
+        }
+    }
+}
+
+/// Bounds the number of conversions running at once
+struct Slots {
+    free: Mutex<usize>,
+    cv: Condvar,
+}
+
+impl Slots {
+    fn run<T>(&self, f: impl FnOnce() -> T) -> T {
+        {
+            let mut free = self.free.lock().unwrap();
+            while *free == 0 {
+                free = self.cv.wait(free).unwrap();
+            }
+            *free -= 1;
+        }
+        let result = f();
+        *self.free.lock().unwrap() += 1;
+        self.cv.notify_one();
+        result
+    }
+}
+
+/// Tileset json and b3dm of one converted osgb
+type Converted = Option<(Arc<Vec<u8>>, Arc<Vec<u8>>)>;
+
+struct Server {
+    options: ServeOptions,
+    cache: TileCache,
+    inflight: Mutex<HashMap<String, Arc<OnceLock<Converted>>>>,
+    slots: Slots,
+    root: OnceLock<Option<Arc<Vec<u8>>>>,
+}
+
+/// External tileset of one osgb: its content, and every child as a tile
+/// referencing the tileset of the child file. The children are not
+/// converted yet, so they take the bounding volume of their parent.
+fn tile_json(name: &str, tile: &TileBuffer) -> Vec<u8> {
+    let children: Vec<_> = tile
+        .children
+        .iter()
+        .map(|child| {
+            let uri = child.strip_suffix(".osgb").unwrap_or(child);
+            json!({
+                "boundingVolume": { "box": tile.box_v },
+                "geometricError": tile.geometric_error / 2.0,
+                "content": { "uri": format!("{}.json", uri) }
+            })
+        })
+        .collect();
+    let tileset = json!({
+        "asset": { "version": "1.0", "gltfUpAxis": "Z" },
+        "geometricError": tile.geometric_error,
+        "root": {
+            "boundingVolume": { "box": tile.box_v },
+            "geometricError": tile.geometric_error,
+            "refine": "REPLACE",
+            "content": { "uri": format!("{}.b3dm", name) },
+            "children": children
+        }
+    });
+    serde_json::to_vec(&tileset).unwrap()
+}
+
+impl Server {
+    /// Converts Data/.../<name>.osgb, once for all the requests that ask
+    /// for it at the same time
+    fn convert(&self, key: &str) -> Converted {
+        let json_key = format!("{}.json", key);
+        let b3dm_key = format!("{}.b3dm", key);
+        let cell = self
+            .inflight
+            .lock()
+            .unwrap()
+            .entry(key.to_string())
+            .or_insert_with(|| Arc::new(OnceLock::new()))
+            .clone();
+        let result = cell
+            .get_or_init(|| {
+                // converted by a request that finished before this one came in
+                if let (Some(json), Some(b3dm)) = (self.cache.get(&json_key), self.cache.get(&b3dm_key)) {
+                    return Some((json, b3dm));
+                }
+                let file = self.options.input.join(format!("{}.osgb", key));
+                let tick = time::Instant::now();
+                let tile = self.slots.run(|| {
+                    osgb::convert_tile_buffer(&file.to_string_lossy(), &self.options.settings, self.options.num_threads as i32)
+                });
+                let tile = match tile {
+                    Some(x) => x,
+                    None => {
+                        error!("convert {} failed", file.display());
+                        return None;
+                    }
+                };
+                let name = Path::new(key).file_name().unwrap().to_string_lossy();
+                let json = Arc::new(tile_json(&name, &tile));
+                let b3dm = Arc::new(tile.b3dm);
+                self.cache.put(&json_key, json.clone());
+                self.cache.put(&b3dm_key, b3dm.clone());
+                info!("{} converted in {:.2} s", key, tick.elapsed().as_secs_f64());
+                Some((json, b3dm))
+            })
+            .clone();
+        let mut inflight = self.inflight.lock().unwrap();
+        if inflight.get(key).map_or(false, |x| Arc::ptr_eq(x, &cell)) {
+            inflight.remove(key);
+        }
+        result
+    }
+
+    /// Root tileset of the blocks, their root files are converted to know
+    /// their bounding boxes
+    fn root_tileset(&self) -> Option<Arc<Vec<u8>>> {
+        self.root
+            .get_or_init(|| {
+                let data = self.options.input.join("Data");
+                let mut blocks = vec![];
+                for entry in fs::read_dir(&data).ok()?.flatten() {
+                    let path = entry.path();
+                    if !path.is_dir() {
+                        continue;
+                    }
+                    let stem = path.file_name().unwrap().to_string_lossy().to_string();
+                    if path.join(format!("{}.osgb", stem)).exists() {
+                        blocks.push(format!("Data/{}/{}", stem, stem));
+                    }
+                }
+                // as many workers as conversion slots, each conversion still
+                // takes a slot so tile requests share the same limit
+                let next = AtomicUsize::new(0);
+                let tiles = Mutex::new(vec![]);
+                std::thread::scope(|scope| {
+                    for _ in 0..self.options.num_threads.max(1).min(blocks.len()) {
+                        scope.spawn(|| {
+                            while let Some(key) = blocks.get(next.fetch_add(1, Ordering::Relaxed)) {
+                                let file = self.options.input.join(format!("{}.osgb", key));
+                                let tile = self.slots.run(|| {
+                                    osgb::convert_tile_buffer(
+                                        &file.to_string_lossy(),
+                                        &self.options.settings,
+                                        self.options.num_threads as i32,
+                                    )
+                                });
+                                let mut tile = match tile {
+                                    Some(x) => x,
+                                    None => {
+                                        error!("convert {} failed", file.display());
+                                        continue;
+                                    }
+                                };
+                                // the block roots are the first tiles a viewer asks for
+                                let name = Path::new(key).file_name().unwrap().to_string_lossy();
+                                self.cache.put(&format!("{}.json", key), Arc::new(tile_json(&name, &tile)));
+                                let b3dm = std::mem::take(&mut tile.b3dm);
+                                self.cache.put(&format!("{}.b3dm", key), Arc::new(b3dm));
+                                tiles.lock().unwrap().push((key.clone(), tile));
+                            }
+                        });
+                    }
+                });
+                let mut tiles: Vec<(String, TileBuffer)> = tiles.into_inner().unwrap();
+                tiles.sort_by(|a, b| a.0.cmp(&b.0));
+                if tiles.is_empty() {
+                    error!("no tile block converted in {}", data.display());
+                    return None;
+                }
+
+                let mut root_box = vec![-1.0E+38f64, -1.0E+38, -1.0E+38, 1.0E+38, 1.0E+38, 1.0E+38];
+                let mut root_geometric_error = 0.0f64;
+                let mut children = vec![];
+                for (key, tile) in tiles.iter() {
+                    for i in 0..3 {
+                        root_box[i] = root_box[i].max(tile.bbox[i]);
+                        root_box[i + 3] = root_box[i + 3].min(tile.bbox[i + 3]);
+                    }
+                    root_geometric_error = root_geometric_error.max(tile.geometric_error);
+                    children.push(json!({
+                        "boundingVolume": { "box": tile.box_v },
+                        "geometricError": tile.geometric_error,
+                        "content": { "uri": format!("{}.json", key) }
+                    }));
+                }
+                let options = &self.options;
+                let trans_vec = osgb::root_transform(
+                    options.settings.center_x,
+                    options.settings.center_y,
+                    options.region_offset,
+                    options.enu_offset,
+                    options.origin_height,
+                    root_box[5],
+                );
+                let tileset = json!({
+                    "asset": { "version": "1.0", "gltfUpAxis": "Z" },
+                    "geometricError": root_geometric_error * 2.0,
+                    "root": {
+                        "transform": trans_vec,
+                        "boundingVolume": { "box": osgb::box_to_tileset_box(&root_box) },
+                        "geometricError": root_geometric_error * 2.0,
+                        "children": children
+                    }
+                });
+                info!("root tileset of {} blocks ready", tiles.len());
+                Some(Arc::new(serde_json::to_vec(&tileset).unwrap()))
+            })
+            .clone()
+    }
+
+    /// Status, content type and body of a GET
+    fn get(&self, url_path: &str) -> (u16, &'static str, Option<Arc<Vec<u8>>>) {
+        let path = percent_decode(url_path.split('?').next().unwrap_or(""));
+        if path == "/" || path == "/tileset.json" {
+            return match self.root_tileset() {
+                Some(body) => (200, "application/json", Some(body)),
+                None => (500, "text/plain", None),
+            };
+        }
+        let key = path.trim_start_matches('/');
+        let (stem, is_json) = if let Some(x) = key.strip_suffix(".json") {
+            (x, true)
+        } else if let Some(x) = key.strip_suffix(".b3dm") {
+            (x, false)
+        } else {
+            return (404, "text/plain", None);
+        };
+        if !stem.starts_with("Data/") || stem.split('/').any(|x| x.is_empty() || x == "..") || stem.contains('\\') {
+            return (404, "text/plain", None);
+        }
+        let content_type = if is_json { "application/json" } else { "application/octet-stream" };
+        if let Some(body) = self.cache.get(key) {
+            return (200, content_type, Some(body));
+        }
+        if !self.options.input.join(format!("{}.osgb", stem)).is_file() {
+            return (404, "text/plain", None);
+        }
+        match self.convert(stem) {
+            Some((json, b3dm)) => (200, content_type, Some(if is_json { json } else { b3dm })),
+            None => (500, "text/plain", None),
+        }
+    }
+}
+
+fn percent_decode(s: &str) -> String {
+    let bytes = s.as_bytes();
+    let mut out = Vec::with_capacity(bytes.len());
+    let mut i = 0;
+    while i < bytes.len() {
+        if bytes[i] == b'%' && i + 2 < bytes.len() {
+            let hex = std::str::from_utf8(&bytes[i + 1..i + 3]).unwrap_or("");
+            if let Ok(v) = u8::from_str_radix(hex, 16) {
+                out.push(v);
+                i += 3;
+                continue;
+            }
+        }
+        out.push(bytes[i]);
+        i += 1;
+    }
+    String::from_utf8_lossy(&out).into_owned()
+}
+
+fn status_text(status: u16) -> &'static str {
+    match status {
+        200 => "OK",
+        404 => "Not Found",
+        405 => "Method Not Allowed",
+        _ => "Internal Server Error",
+    }
+}
+
+/// HTTP/1.1 keep-alive loop of one connection, GET and HEAD only
+fn handle_connection(server: &Server, stream: TcpStream) -> std::io::Result<()> {
+    let mut reader = BufReader::new(stream.try_clone()?);
+    let mut stream = stream;
+    loop {
+        let mut request = String::new();
+        if reader.read_line(&mut request)? == 0 {
+            return Ok(());
+        }
+        let parts: Vec<&str> = request.split_whitespace().collect();
+        if parts.len() < 3 {
+            return Ok(());
+        }
+        let mut keep_alive = parts[2] == "HTTP/1.1";
+        loop {
+            let mut header = String::new();
+            if reader.read_line(&mut header)? == 0 {
+                return Ok(());
+            }
+            let header = header.trim_end();
+            if header.is_empty() {
+                break;
+            }
+            if let Some((name, value)) = header.split_once(':') {
+                if name.trim().eq_ignore_ascii_case("connection") {
+                    keep_alive = value.trim().eq_ignore_ascii_case("keep-alive")
+                        || (keep_alive && !value.trim().eq_ignore_ascii_case("close"));
+                }
+            }
+        }
+
+        let (status, content_type, body) = match parts[0] {
+            "GET" | "HEAD" => server.get(parts[1]),
+            _ => (405, "text/plain", None),
+        };
+        let len = body.as_ref().map_or(0, |x| x.len());
+        write!(
+            stream,
+            "HTTP/1.1 {} {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nAccess-Control-Allow-Origin: *\r\nConnection: {}\r\n\r\n",
+            status,
+            status_text(status),
+            content_type,
+            len,
+            if keep_alive { "keep-alive" } else { "close" }
+        )?;
+        if let (Some(body), "GET") = (body, parts[0]) {
+            stream.write_all(&body)?;
+        }
+        stream.flush()?;
+        if !keep_alive {
+            return Ok(());
+        }
+    }
+}
+
+/// Serves the OSGB dataset as a tileset on localhost, converting every file
+/// on its first request
+pub fn serve(options: ServeOptions) -> Result<(), Box<dyn Error>> {
+    let data = options.input.join("Data");
+    if !data.is_dir() {
+        return Err(From::from(format!("dir {} not exist", data.display())));
+    }
+    if let Some(dir) = options.cache_dir.as_ref() {
+        // tiles cached with other settings are stale
+        let s = &options.settings;
+        let stamp = format!(
+            "{} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+            s.center_x, s.center_y, s.max_lvl, s.normals_mode, s.geometric_error_scale, s.draco_encoding_speed,
+            s.draco_decoding_speed, s.draco_error_fraction, s.enable_texture_compress, s.enable_meshopt, s.enable_draco, s.enable_unlit,
+            s.enable_fast_reader, s.enable_optimize_mesh, s.enable_meshopt_compression, s.enable_quantize
+        );
+        let stamp_file = dir.join("serve.flags");
+        if fs::read_to_string(&stamp_file).ok().as_deref() != Some(stamp.as_str()) {
+            let _ = fs::remove_dir_all(dir.join("Data"));
+            fs::create_dir_all(dir)?;
+            fs::write(&stamp_file, stamp)?;
+        }
+    }
+    let disk = options.cache_dir.clone().map(|dir| (dir, options.disk_cache_mb * MB));
+    let listener = TcpListener::bind(("127.0.0.1", options.port))?;
+    let server = Arc::new(Server {
+        cache: TileCache::new(options.cache_mb * MB, disk),
+        inflight: Mutex::new(HashMap::new()),
+        slots: Slots {
+            free: Mutex::new(options.num_threads.max(1)),
+            cv: Condvar::new(),
+        },
+        root: OnceLock::new(),
+        options,
+    });
+    info!("serving {} at http://127.0.0.1:{}/tileset.json", server.options.input.display(), server.options.port);
+    for stream in listener.incoming() {
+        let stream = match stream {
+            Ok(x) => x,
+            Err(e) => {
+                error!("accept failed: {}", e);
+                continue;
+            }
+        };
+        let server = server.clone();
+        std::thread::spawn(move || {
+            let _ = handle_connection(&server, stream);
+        });
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn lru_evicts_the_least_recently_used() {
+        let mut lru = Lru::new(100);
+        assert!(lru.insert("a".to_string(), 40).is_empty());
+        assert!(lru.insert("b".to_string(), 40).is_empty());
+        assert!(lru.touch("a"));
+        assert_eq!(lru.insert("c".to_string(), 40), vec!["b".to_string()]);
+        assert_eq!(lru.used, 80);
+        assert!(!lru.touch("b"));
+    }
+
+    #[test]
+    fn lru_never_evicts_the_newest_entry() {
+        let mut lru = Lru::new(100);
+        lru.insert("a".to_string(), 40);
+        assert_eq!(lru.insert("big".to_string(), 500), vec!["a".to_string()]);
+        assert!(lru.touch("big"));
+        assert_eq!(lru.used, 500);
+        // the oversized entry goes once another one comes in
+        assert_eq!(lru.insert("c".to_string(), 10), vec!["big".to_string()]);
+        assert_eq!(lru.used, 10);
+    }
+
+    #[test]
+    fn lru_reinsert_replaces_the_size() {
+        let mut lru = Lru::new(100);
+        lru.insert("a".to_string(), 40);
+        lru.insert("a".to_string(), 70);
+        assert_eq!(lru.used, 70);
+        lru.remove("a");
+        assert_eq!(lru.used, 0);
+        assert!(!lru.touch("a"));
+    }
+
+    #[test]
+    fn lru_without_budget_keeps_everything() {
+        let mut lru = Lru::new(0);
+        for i in 0..10 {
+            assert!(lru.insert(i.to_string(), 1000).is_empty());
+        }
+        assert_eq!(lru.used, 10000);
+    }
+}
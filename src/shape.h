@@ -12,6 +12,11 @@ struct ShapeConversionParams {
 
   // Feature flags
   bool enable_lod;                   // Whether to enable LOD (uses default config)
+  bool enable_optimize_mesh;         // Reorder vertices and triangles for the GPU, see optimize_mesh_buffers
+  bool enable_meshopt_compression;   // EXT_meshopt_compression buffer views instead of Draco
+  bool enable_quantize;              // KHR_mesh_quantization vertex attributes, see quantize_model
+  double geometric_error_scale;      // Multiplies the measured simplification error of the LOD levels
+  double draco_error_fraction;       // Draco position error of refined LOD levels over their geometricError, the finest uses DRACO_LEAF_POSITION_ERROR (0: fixed bits)
 
   // Draco and Simplification settings
   DracoCompressionParams draco_compression_params;
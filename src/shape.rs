@@ -3,9 +3,12 @@ use libc::c_char;
 #[repr(C)]
 struct DracoCompressionParams {
     position_quantization_bits: i32,
+    position_max_error: f64,
     normal_quantization_bits: i32,
     tex_coord_quantization_bits: i32,
     generic_quantization_bits: i32,
+    encoding_speed: i32,
+    decoding_speed: i32,
     enable_compression: bool,
 }
 
@@ -16,6 +19,7 @@ struct SimplificationParams {
     enable_simplification: bool,
     preserve_texture_coords: bool,
     preserve_normals: bool,
+    mode: i32,
 }
 
 #[repr(C)]
@@ -27,6 +31,11 @@ struct ShapeConversionParams {
 
     // Feature flags
     enable_lod: bool,
+    enable_optimize_mesh: bool,
+    enable_meshopt_compression: bool,
+    enable_quantize: bool,
+    geometric_error_scale: f64,
+    draco_error_fraction: f64,
 
     // Draco and Simplification settings
     draco_compression_params: DracoCompressionParams,
@@ -124,14 +133,21 @@ fn walk_path(dir: &Path, cb: &mut dyn FnMut(&str)) -> io::Result<()> {
     Ok(())
 }
 
-pub fn shape_batch_convert(
-    from: &str,
-    to: &str,
-    height: &str,
-    enable_lod: bool,
-    enable_simplify: bool,
-    enable_draco: bool,
-) -> bool {
+/// Settings of `shape_batch_convert`
+pub struct ShapeSettings {
+    pub geometric_error_scale: f64,
+    pub draco_error_fraction: f64,
+    pub draco_encoding_speed: i32,
+    pub draco_decoding_speed: i32,
+    pub enable_lod: bool,
+    pub enable_simplify: bool,
+    pub enable_draco: bool,
+    pub enable_optimize_mesh: bool,
+    pub enable_meshopt_compression: bool,
+    pub enable_quantize: bool,
+}
+
+pub fn shape_batch_convert(from: &str, to: &str, height: &str, settings: &ShapeSettings) -> bool {
     unsafe {
         let source_vec = CString::new(from).unwrap();
         let dest_vec = CString::new(to).unwrap();
@@ -145,22 +161,31 @@ pub fn shape_batch_convert(
             layer_id: 0,  // Default to first layer
 
             // Feature flags
-            enable_lod,
+            enable_lod: settings.enable_lod,
+            enable_optimize_mesh: settings.enable_optimize_mesh,
+            enable_meshopt_compression: settings.enable_meshopt_compression,
+            enable_quantize: settings.enable_quantize,
+            geometric_error_scale: settings.geometric_error_scale,
+            draco_error_fraction: settings.draco_error_fraction,
 
             // Draco and Simplification settings
             draco_compression_params: DracoCompressionParams {
                 position_quantization_bits: 11,
+                position_max_error: 0.0,
                 normal_quantization_bits: 10,
                 tex_coord_quantization_bits: 12,
                 generic_quantization_bits: 8,
-                enable_compression: enable_draco,
+                encoding_speed: settings.draco_encoding_speed,
+                decoding_speed: settings.draco_decoding_speed,
+                enable_compression: settings.enable_draco,
             },
             simplify_params: SimplificationParams {
                 target_error: 0.01,
                 target_ratio: 0.5,
-                enable_simplification: enable_simplify,
+                enable_simplification: settings.enable_simplify,
                 preserve_texture_coords: true,
                 preserve_normals: true,
+                mode: 0,
             },
         };
 
@@ -639,6 +639,67 @@ osg::ref_ptr<osg::Geometry> make_triangle_mesh(Polygon_Mesh& mesh) {
     return geometry;
 }
 
+// Per-level copies of the meshes for a fine->coarse LOD configuration.
+// Each building is welded once and simplified along build_lod_chain,
+// buildings the chain rejects are kept as they are on every level.
+// level_errors gets the largest simplification error of each level.
+static std::vector<std::vector<Polygon_Mesh>> make_lod_meshes(const std::vector<Polygon_Mesh>& meshes,
+                                                              const std::vector<LODLevelSettings>& levels,
+                                                              std::vector<double>& level_errors) {
+    std::vector<std::vector<Polygon_Mesh>> level_meshes(levels.size());
+    level_errors.assign(levels.size(), 0.0);
+    for (const auto& mesh : meshes) {
+        const bool has_normals = mesh.normal.size() == mesh.vertex.size();
+        std::vector<VertexData> vertices(mesh.vertex.size());
+        for (size_t i = 0; i < mesh.vertex.size(); i++) {
+            vertices[i].x = mesh.vertex[i][0];
+            vertices[i].y = mesh.vertex[i][1];
+            vertices[i].z = mesh.vertex[i][2];
+            if (has_normals) {
+                vertices[i].nx = mesh.normal[i][0];
+                vertices[i].ny = mesh.normal[i][1];
+                vertices[i].nz = mesh.normal[i][2];
+            }
+        }
+        std::vector<unsigned int> indices;
+        indices.reserve(mesh.index.size() * 3);
+        for (const auto& tri : mesh.index) {
+            indices.insert(indices.end(), { (unsigned int)tri[0], (unsigned int)tri[1], (unsigned int)tri[2] });
+        }
+
+        std::vector<LODChainLevel> chain;
+        if (!build_lod_chain(vertices, indices, levels, chain)) {
+            for (auto& out : level_meshes) {
+                out.push_back(mesh);
+            }
+            continue;
+        }
+
+        for (size_t l = 0; l < levels.size(); l++) {
+            level_errors[l] = std::max(level_errors[l], static_cast<double>(chain[l].error));
+            std::vector<VertexData> level_vertices;
+            std::vector<unsigned int> level_indices;
+            compact_lod_level(vertices, chain[l], level_vertices, level_indices);
+
+            Polygon_Mesh out = mesh;
+            out.vertex.clear();
+            out.normal.clear();
+            out.index.clear();
+            for (const auto& v : level_vertices) {
+                out.vertex.push_back({ v.x, v.y, v.z });
+                if (has_normals) {
+                    out.normal.push_back({ v.nx, v.ny, v.nz });
+                }
+            }
+            for (size_t i = 0; i + 2 < level_indices.size(); i += 3) {
+                out.index.push_back({ (int)level_indices[i], (int)level_indices[i + 1], (int)level_indices[i + 2] });
+            }
+            level_meshes[l].push_back(std::move(out));
+        }
+    }
+    return level_meshes;
+}
+
 void calc_normal(int baseCnt, int ptNum, Polygon_Mesh &mesh)
 {
     // normal stand for one triangle
@@ -784,14 +845,20 @@ std::string make_polymesh(std::vector<Polygon_Mesh>& meshes,
     bool enable_simplify = false,
     std::optional<SimplificationParams> simplification_params = std::nullopt,
     bool enable_draco = false,
-    std::optional<DracoCompressionParams> draco_params = std::nullopt);
+    std::optional<DracoCompressionParams> draco_params = std::nullopt,
+    bool enable_optimize = false,
+    bool enable_meshopt_compression = false,
+    bool enable_quantize = false);
 
 std::string make_b3dm(std::vector<Polygon_Mesh>& meshes,
     bool with_height = false,
     bool enable_simplify = false,
     std::optional<SimplificationParams> simplification_params = std::nullopt,
     bool enable_draco = false,
-    std::optional<DracoCompressionParams> draco_params = std::nullopt);
+    std::optional<DracoCompressionParams> draco_params = std::nullopt,
+    bool enable_optimize = false,
+    bool enable_meshopt_compression = false,
+    bool enable_quantize = false);
 //
 extern "C" bool
 shp23dtile(const ShapeConversionParams* params)
@@ -1094,41 +1161,69 @@ shp23dtile(const ShapeConversionParams* params)
             };
 
             auto push_lod_output = [&](size_t idx,
+                                       std::vector<Polygon_Mesh>& lvl_meshes,
                                        bool lvl_enable_simplify,
                                        std::optional<SimplificationParams> lvl_simplify,
                                        bool lvl_enable_draco,
                                        std::optional<DracoCompressionParams> lvl_draco,
-                                       double lvl_ratio) {
+                                       double lvl_ratio,
+                                       double lvl_error,
+                                       bool lvl_refined) {
                 std::string filename = make_filename(idx);
                 std::filesystem::path b3dm_rel = leaf_dir / filename;
                 std::filesystem::path b3dm_full = std::filesystem::path(dest) / b3dm_rel;
-                std::string b3dm_buf = make_b3dm(meshes, true, lvl_enable_simplify, lvl_simplify, lvl_enable_draco, lvl_draco);
+
+                double ge_level = lvl_error;
+                if (ge_level < 0.0) {
+                    double span_z = std::max(tile_z_m, 5.0); // avoid near-zero vertical span
+                    double base_ge = compute_geometric_error_from_spans(tile_w_m, tile_h_m, span_z);
+                    double ratio = std::clamp(static_cast<double>(lvl_ratio), 0.01, 1.0);
+                    // coarser LOD (smaller ratio) gets larger geometric error
+                    ge_level = base_ge * std::max(1.0, 1.0 / std::sqrt(ratio));
+                }
+                // a refined level is replaced before its geometricError grows
+                // past the SSE threshold, Draco may use that much of it; the
+                // finest level is seen from any distance and gets an absolute bound
+                if (lvl_draco && params->draco_error_fraction > 0.0) {
+                    lvl_draco->position_max_error = lvl_refined && ge_level > 0.0
+                        ? params->draco_error_fraction * ge_level : DRACO_LEAF_POSITION_ERROR;
+                }
+
+                std::string b3dm_buf = make_b3dm(lvl_meshes, true, lvl_enable_simplify, lvl_simplify, lvl_enable_draco, lvl_draco,
+                                                 params->enable_optimize_mesh, params->enable_meshopt_compression,
+                                                 params->enable_quantize);
                 write_file(b3dm_full.string().c_str(), b3dm_buf.data(), b3dm_buf.size());
 
                 lod_names.push_back(filename);
-                double span_z = std::max(tile_z_m, 5.0); // avoid near-zero vertical span
-                double base_ge = compute_geometric_error_from_spans(tile_w_m, tile_h_m, span_z);
-                double ratio = std::clamp(static_cast<double>(lvl_ratio), 0.01, 1.0);
-                // coarser LOD (smaller ratio) gets larger geometric error
-                double ge_level = base_ge * std::max(1.0, 1.0 / std::sqrt(ratio));
                 lod_errors.push_back(ge_level);
             };
 
             if (lod_enabled) {
+                // Levels are simplified once, each from the previous one
+                const bool chain_simplify = std::any_of(lod_cfg.levels.begin(), lod_cfg.levels.end(),
+                    [](const LODLevelSettings& lvl) { return lvl.enable_simplification; });
+                std::vector<std::vector<Polygon_Mesh>> level_meshes;
+                std::vector<double> level_errors;
+                if (chain_simplify) {
+                    level_meshes = make_lod_meshes(meshes, lod_cfg.levels, level_errors);
+                }
+                // every level but the finest one is refined
+                float finest_ratio = 0.0f;
+                for (const auto& lvl : lod_cfg.levels) {
+                    finest_ratio = std::max(finest_ratio, lvl.target_ratio);
+                }
                 for (size_t i = 0; i < lod_cfg.levels.size(); ++i) {
                     const auto& lvl = lod_cfg.levels[i];
-                    std::optional<SimplificationParams> level_simplify = std::nullopt;
-                    if (lvl.enable_simplification) {
-                        level_simplify = lvl.simplify;
-                        level_simplify->target_ratio = lvl.target_ratio;
-                        level_simplify->target_error = lvl.target_error;
-                    }
                     std::optional<DracoCompressionParams> level_draco = std::nullopt;
                     if (lvl.enable_draco) {
                         level_draco = lvl.draco;
                         level_draco->enable_compression = true;
                     }
-                    push_lod_output(i, lvl.enable_simplification, level_simplify, lvl.enable_draco, level_draco, lvl.target_ratio);
+                    // Measured error in meters replaces the ratio heuristic
+                    double level_error = chain_simplify ? level_errors[i] * params->geometric_error_scale : -1.0;
+                    push_lod_output(i, chain_simplify ? level_meshes[i] : meshes, false, std::nullopt,
+                                    lvl.enable_draco, level_draco, lvl.target_ratio, level_error,
+                                    lvl.target_ratio < finest_ratio);
                 }
             } else {
                 // Use simplification params from function params
@@ -1136,10 +1231,10 @@ shp23dtile(const ShapeConversionParams* params)
                 if (simplify_params.enable_simplification) {
                     simplification_params_opt = simplify_params;
                 }
-                push_lod_output(0, simplify_params.enable_simplification, simplification_params_opt,
+                push_lod_output(0, meshes, simplify_params.enable_simplification, simplification_params_opt,
                                draco_params.enable_compression,
                                draco_params.enable_compression ? std::make_optional(draco_params) : std::nullopt,
-                               1.0);
+                               1.0, -1.0, false);
             }
 
             double span_z = std::max(tile_z_m, 0.001);
@@ -1185,7 +1280,10 @@ shp23dtile(const ShapeConversionParams* params)
 
             auto res = build_lod_tree_for_meshes(v_meshes, "");
             leaf_root_node = res.first;
-            leaf_root_ge = res.second > 0 ? res.second : ge;
+            // the measured errors only order the LOD levels inside the tile;
+            // the quadtree nodes above it double this value, so it keeps at
+            // least the span heuristic or they are never refined
+            leaf_root_ge = res.second > 0 ? std::max(res.second, ge) : ge;
 
         nlohmann::json leaf;
         leaf["asset"] = { {"version", "1.0"}, {"gltfUpAxis", "Z"} };
@@ -1261,7 +1359,10 @@ std::string make_polymesh(std::vector<Polygon_Mesh> &meshes,
     bool enable_simplify,
     std::optional<SimplificationParams> simplification_params,
     bool enable_draco,
-    std::optional<DracoCompressionParams> draco_params) {
+    std::optional<DracoCompressionParams> draco_params,
+    bool enable_optimize,
+    bool enable_meshopt_compression,
+    bool enable_quantize) {
         vector<osg::ref_ptr<osg::Geometry>> osg_Geoms;
         osg_Geoms.reserve(meshes.size());
         for (auto& mesh : meshes) {
@@ -1327,6 +1428,23 @@ std::string make_polymesh(std::vector<Polygon_Mesh> &meshes,
                 return {};
         }
 
+        // Batch ids follow their vertices, triangles are only reordered
+        if (enable_optimize) {
+                std::vector<unsigned int> indices(merged_indices->begin(), merged_indices->end());
+                std::vector<MeshAttributeStream> streams = {
+                        { &(*merged_vertices)[0], sizeof(osg::Vec3) },
+                        { &(*merged_normals)[0], sizeof(osg::Vec3) },
+                        { merged_batch_ids.data(), sizeof(uint32_t) },
+                };
+                size_t vertex_count = optimize_mesh_buffers(indices, streams, merged_vertices->size());
+                if (vertex_count > 0) {
+                        merged_vertices->resize(vertex_count);
+                        merged_normals->resize(vertex_count);
+                        merged_batch_ids.resize(vertex_count);
+                        merged_indices->assign(indices.begin(), indices.end());
+                }
+        }
+
         merged_geom->setVertexArray(merged_vertices.get());
         merged_geom->setNormalArray(merged_normals.get());
         merged_geom->addPrimitiveSet(merged_indices.get());
@@ -1587,13 +1705,24 @@ std::string make_polymesh(std::vector<Polygon_Mesh> &meshes,
         ensure_ext(model.extensionsUsed, "KHR_draco_mesh_compression");
     }
 
+    if (enable_quantize) {
+        quantize_model(model);
+    }
+    if (enable_meshopt_compression) {
+        std::string buf;
+        if (!write_meshopt_glb(model, buf)) {
+            LOG_E("write meshopt glb failure");
+            return std::string();
+        }
+        return buf;
+    }
     std::ostringstream ss;
     bool res = gltf.WriteGltfSceneToStream(&model, ss, false, true);
     std::string buf = ss.str();
     return buf;
 }
 
-std::string make_b3dm(std::vector<Polygon_Mesh>& meshes, bool with_height, bool enable_simplify, std::optional<SimplificationParams> simplification_params, bool enable_draco, std::optional<DracoCompressionParams> draco_params) {
+std::string make_b3dm(std::vector<Polygon_Mesh>& meshes, bool with_height, bool enable_simplify, std::optional<SimplificationParams> simplification_params, bool enable_draco, std::optional<DracoCompressionParams> draco_params, bool enable_optimize, bool enable_meshopt_compression, bool enable_quantize) {
     using nlohmann::json;
 
     std::string feature_json_string;
@@ -1654,7 +1783,8 @@ std::string make_b3dm(std::vector<Polygon_Mesh>& meshes, bool with_height, bool
         batch_json_string.push_back(' ');
     }
 
-    std::string glb_buf = make_polymesh(meshes, enable_simplify, simplification_params, enable_draco, draco_params);
+    std::string glb_buf = make_polymesh(meshes, enable_simplify, simplification_params, enable_draco, draco_params, enable_optimize,
+                                        enable_meshopt_compression, enable_quantize);
     if (glb_buf.size() == 0) {
         LOG_E("make glb buffer failure");
         return std::string();
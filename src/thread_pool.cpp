@@ -0,0 +1,191 @@
+#include "thread_pool.h"
+#include "extern.h"
+
+#include <exception>
+
+namespace {
+// worker index of the current thread and the pool it belongs to
+thread_local const WorkStealingPool* tls_pool = nullptr;
+thread_local int tls_index = -1;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned num_workers)
+{
+    if (num_workers == 0) {
+        num_workers = std::thread::hardware_concurrency();
+        if (num_workers == 0)
+            num_workers = 1;
+    }
+    for (unsigned i = 0; i < num_workers; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < num_workers; i++)
+        workers.emplace_back(&WorkStealingPool::worker_loop, this, (int)i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake_cv.notify_all();
+    for (auto& t : workers) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+WorkStealingPool& WorkStealingPool::instance(unsigned num_workers)
+{
+    static WorkStealingPool pool(num_workers);
+    return pool;
+}
+
+bool WorkStealingPool::in_worker() const
+{
+    return tls_pool == this;
+}
+
+void WorkStealingPool::submit(Task task)
+{
+    {
+        // pending is counted in the same critical section as the push, so a
+        // thief can never take the task before it is counted
+        std::lock_guard<std::mutex> wake_lock(wake_mutex);
+        if (in_worker()) {
+            Queue& q = *queues[tls_index];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_front(std::move(task));
+        }
+        else {
+            Queue& q = *queues[next_queue++ % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        pending++;
+    }
+    wake_cv.notify_all();
+}
+
+bool WorkStealingPool::pop_task(int self, Task& task)
+{
+    const size_t n = queues.size();
+    // own deque first (front = newest)
+    if (self >= 0) {
+        Queue& q = *queues[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    // steal the oldest task of another worker
+    size_t start = self >= 0 ? (size_t)self + 1 : 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = (start + i) % n;
+        if ((int)victim == self)
+            continue;
+        Queue& q = *queues[victim];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingPool::run_one()
+{
+    Task task;
+    if (!pop_task(in_worker() ? tls_index : -1, task))
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        pending--;
+    }
+    task();
+    return true;
+}
+
+void WorkStealingPool::worker_loop(int index)
+{
+    tls_pool = this;
+    tls_index = index;
+    while (true) {
+        if (run_one())
+            continue;
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
+
+TaskGroup::TaskGroup(WorkStealingPool& pool)
+    : pool(pool), state(std::make_shared<State>())
+{
+}
+
+void TaskGroup::run(WorkStealingPool::Task task)
+{
+    auto slot = std::make_shared<Slot>();
+    slot->task = std::move(task);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        slot->pos = state->queued.insert(state->queued.end(), slot);
+        state->active++;
+    }
+    // a worker waiting in wait() picks it up
+    state->cv.notify_all();
+    std::shared_ptr<State> shared = state;
+    pool.submit([shared, slot]() { run_slot(*shared, slot); });
+}
+
+void TaskGroup::run_slot(State& state, const std::shared_ptr<Slot>& slot)
+{
+    WorkStealingPool::Task task;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (slot->started)
+            return;
+        slot->started = true;
+        state.queued.erase(slot->pos);
+        task = std::move(slot->task);
+    }
+    try {
+        task();
+    }
+    catch (const std::exception& e) {
+        LOG_E("tile task failed: %s", e.what());
+    }
+    catch (...) {
+        LOG_E("tile task failed with unknown exception");
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (--state.active == 0)
+        state.cv.notify_all();
+}
+
+void TaskGroup::wait()
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!pool.in_worker()) {
+        state->cv.wait(lock, [this] { return state->active == 0; });
+        return;
+    }
+    // keep the worker busy with the group's newest task, sleep while the
+    // remaining ones run on other workers
+    while (state->active > 0) {
+        if (state->queued.empty()) {
+            state->cv.wait(lock);
+            continue;
+        }
+        std::shared_ptr<Slot> slot = state->queued.back();
+        lock.unlock();
+        run_slot(*state, slot);
+        lock.lock();
+    }
+}
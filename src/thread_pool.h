@@ -0,0 +1,103 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker owns a deque: it pops its own tasks LIFO (depth first, so a
+// pyramid is finished branch by branch) and steals FIFO from the others
+// (the oldest task is the biggest remaining sub tree).
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // num_workers == 0 uses std::thread::hardware_concurrency()
+    explicit WorkStealingPool(unsigned num_workers = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Process wide pool shared by all converters; num_workers only takes
+    // effect on the first call.
+    static WorkStealingPool& instance(unsigned num_workers = 0);
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+    // Called from a worker the task goes to the front of its own deque,
+    // otherwise the queues are filled round robin.
+    void submit(Task task);
+
+    // Runs one queued task on the calling thread, returns false if none.
+    bool run_one();
+
+    // True when the calling thread is one of this pool's workers
+    bool in_worker() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_task(int self, Task& task);
+    void worker_loop(int index);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> next_queue{0};
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    size_t pending = 0;     // queued (not yet started) tasks, guarded by wake_mutex
+    bool stopping = false;
+};
+
+// Tracks a dynamic set of tasks, including tasks spawned by tasks of the
+// group, so a caller can wait for a whole recursive job to finish.
+// Every task is queued both on the group and on the pool; whichever
+// reaches it first runs it.
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& pool);
+    ~TaskGroup() { wait(); }
+
+    void run(WorkStealingPool::Task task);
+
+    // Blocks until every task of the group is done. A worker thread keeps
+    // executing the group's own queued tasks while it waits, never other
+    // tasks of the pool, so a wait inside a task does not nest unrelated
+    // work below it.
+    void wait();
+
+private:
+    struct Slot;
+    // shared with the queued tasks, which may outlive the group
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::list<std::shared_ptr<Slot>> queued;    // not started yet, newest last
+        size_t active = 0;                          // not finished yet
+    };
+    struct Slot {
+        WorkStealingPool::Task task;
+        std::list<std::shared_ptr<Slot>>::iterator pos;
+        bool started = false;
+    };
+
+    static void run_slot(State& state, const std::shared_ptr<Slot>& slot);
+
+    WorkStealingPool& pool;
+    std::shared_ptr<State> state;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,218 @@
+#include "tile_manifest.h"
+#include "extern.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using nlohmann::json;
+
+namespace {
+
+const int MANIFEST_VERSION = 1;
+
+// FNV-1a 64
+struct Fnv1a {
+    uint64_t h = 1469598103934665603ULL;
+    void update(const unsigned char* p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+    }
+    std::string hex() const {
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+        return buf;
+    }
+};
+
+bool hash_file(const std::string& path, std::string& hash) {
+    std::ifstream in(fs::path(path), std::ios::binary);
+    if (!in)
+        return false;
+    Fnv1a fnv;
+    std::vector<char> buf(1 << 20);
+    while (in) {
+        in.read(buf.data(), buf.size());
+        fnv.update((const unsigned char*)buf.data(), (size_t)in.gcount());
+    }
+    hash = fnv.hex();
+    return true;
+}
+
+json content_to_json(const ManifestContent& c) {
+    json j;
+    j["written"] = c.written;
+    if (c.written) {
+        j["uri"] = c.uri;
+        j["max"] = c.box_max;
+        j["min"] = c.box_min;
+        j["size"] = c.size;
+        j["hash"] = c.hash;
+        j["error"] = c.simplify_error;
+        if (c.merge_count > 0)
+            j["merged"] = c.merge_count;
+    }
+    return j;
+}
+
+ManifestContent content_from_json(const json& j) {
+    ManifestContent c;
+    c.written = j.value("written", false);
+    if (c.written) {
+        c.uri = j.value("uri", "");
+        c.box_max = j.value("max", std::vector<double>());
+        c.box_min = j.value("min", std::vector<double>());
+        c.size = j.value("size", (uint64_t)0);
+        c.hash = j.value("hash", "");
+        c.simplify_error = j.value("error", 0.0);
+        c.merge_count = j.value("merged", 0);
+    }
+    return c;
+}
+
+// The recorded output must still be there with the recorded size
+bool content_present(const std::string& output_dir, const ManifestContent& c) {
+    if (!c.written)
+        return true;
+    if (c.box_max.size() != 3 || c.box_min.size() != 3)
+        return false;
+    std::error_code ec;
+    auto size = fs::file_size(fs::path(output_dir) / c.uri, ec);
+    return !ec && size == c.size;
+}
+
+}
+
+TileManifest::TileManifest(const std::string& output_dir, const std::string& flags)
+    : output_dir(output_dir), flags(flags)
+{
+    manifest_path = (fs::path(output_dir) / "manifest.json").string();
+}
+
+bool TileManifest::load()
+{
+    std::ifstream in(fs::path(manifest_path), std::ios::binary);
+    if (!in)
+        return false;
+    json j = json::parse(in, nullptr, false);
+    if (j.is_discarded() || !j.is_object()) {
+        LOG_W("ignore broken manifest [%s]", manifest_path.c_str());
+        return false;
+    }
+    if (j.value("version", 0) != MANIFEST_VERSION || j.value("flags", "") != flags) {
+        LOG_I("conversion flags changed, [%s] is converted again", output_dir.c_str());
+        return false;
+    }
+    for (auto& [key, item] : j["files"].items()) {
+        ManifestEntry entry;
+        entry.size = item.value("size", (uint64_t)0);
+        entry.mtime = item.value("mtime", (int64_t)0);
+        entry.hash = item.value("hash", "");
+        entry.children = item.value("children", std::vector<std::string>());
+        entry.has_other_nodes = item.value("has_other_nodes", false);
+        if (item.contains("content"))
+            entry.content = content_from_json(item["content"]);
+        if (item.contains("other_content"))
+            entry.other_content = content_from_json(item["other_content"]);
+        previous[key] = std::move(entry);
+    }
+    return true;
+}
+
+bool TileManifest::save()
+{
+    json j;
+    j["version"] = MANIFEST_VERSION;
+    j["flags"] = flags;
+    json files = json::object();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [key, entry] : current) {
+            json item;
+            item["size"] = entry.size;
+            item["mtime"] = entry.mtime;
+            item["hash"] = entry.hash;
+            item["children"] = entry.children;
+            item["has_other_nodes"] = entry.has_other_nodes;
+            item["content"] = content_to_json(entry.content);
+            if (entry.has_other_nodes)
+                item["other_content"] = content_to_json(entry.other_content);
+            files[key] = std::move(item);
+        }
+    }
+    j["files"] = std::move(files);
+    std::string buf = j.dump();
+    return write_file(manifest_path.c_str(), buf.data(), buf.size());
+}
+
+bool TileManifest::find_unchanged(const std::string& key, const std::string& source_path, ManifestEntry& entry)
+{
+    entry = ManifestEntry();
+    std::error_code ec;
+    fs::path p(source_path);
+    entry.size = fs::file_size(p, ec);
+    if (ec)
+        return false;
+    entry.mtime = (int64_t)fs::last_write_time(p, ec).time_since_epoch().count();
+    if (ec)
+        return false;
+
+    ManifestEntry recorded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = previous.find(key);
+        if (it == previous.end())
+            return false;
+        recorded = it->second;
+    }
+    // a new size is a new file, there is nothing to compare the hash with
+    if (entry.size != recorded.size)
+        return false;
+    if (entry.mtime != recorded.mtime) {
+        // touched or copied: only the content decides
+        if (!hash_file(source_path, entry.hash) || entry.hash != recorded.hash)
+            return false;
+    }
+    else {
+        entry.hash = recorded.hash;
+    }
+
+    if (!content_present(output_dir, recorded.content))
+        return false;
+    if (recorded.has_other_nodes && !content_present(output_dir, recorded.other_content))
+        return false;
+
+    recorded.mtime = entry.mtime;
+    recorded.hash = entry.hash;
+    entry = std::move(recorded);
+    std::lock_guard<std::mutex> lock(mutex);
+    skipped++;
+    return true;
+}
+
+void TileManifest::update(const std::string& key, const ManifestEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    current[key] = entry;
+}
+
+bool TileManifest::find_current(const std::string& key, ManifestEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = current.find(key);
+    if (it == current.end())
+        return false;
+    entry = it->second;
+    return true;
+}
+
+std::string TileManifest::hash_bytes(const void* data, size_t size)
+{
+    Fnv1a fnv;
+    fnv.update((const unsigned char*)data, size);
+    return fnv.hex();
+}
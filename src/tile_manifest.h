@@ -0,0 +1,76 @@
+#ifndef TILE_MANIFEST_H
+#define TILE_MANIFEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One b3dm written for a source file
+struct ManifestContent {
+    bool written = false;
+    std::string uri;                    // File name relative to the output directory
+    std::vector<double> box_max;        // Content bounding box, as in TileBox
+    std::vector<double> box_min;
+    uint64_t size = 0;
+    std::string hash;
+    double simplify_error = 0;          // Measured simplification error, see MeshInfo
+    int merge_count = 0;                // Leaves sharing the merged b3dm at uri, 0 if not merged
+};
+
+// What a converted source file looked like, and what it produced
+struct ManifestEntry {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string hash;                   // Content hash of the source file, empty until it was touched
+    std::vector<std::string> children;  // PagedLOD file names, relative to the file's directory
+    bool has_other_nodes = false;
+    ManifestContent content;            // <name>.b3dm
+    ManifestContent other_content;      // <name>o.b3dm, only when has_other_nodes
+};
+
+// Per output directory record of the converted files, used to skip the
+// files that did not change since the previous run. The manifest is only
+// valid for the conversion flags it was written with.
+class TileManifest {
+public:
+    TileManifest(const std::string& output_dir, const std::string& flags);
+
+    // Reads the previous manifest; false if there is none or it was written
+    // with other flags, in which case every file is converted again.
+    bool load();
+
+    // Writes the entries recorded by update() during this run
+    bool save();
+
+    // True if the source file and its outputs are the ones recorded by the
+    // previous run, entry is then the recorded one. Otherwise entry only
+    // describes the source file, for the conversion to fill in.
+    // Size and mtime are compared first; the content hash is only computed
+    // when the size matches but the mtime changed, so a file is never read
+    // here unless it was touched.
+    bool find_unchanged(const std::string& key, const std::string& source_path, ManifestEntry& entry);
+
+    // Records the state of a source file for this run (thread safe)
+    void update(const std::string& key, const ManifestEntry& entry);
+
+    // The entry recorded by update() during this run, false if there is none
+    bool find_current(const std::string& key, ManifestEntry& entry);
+
+    static std::string hash_bytes(const void* data, size_t size);
+
+    size_t skipped_count() const { return skipped; }
+
+private:
+    std::string output_dir;
+    std::string manifest_path;
+    std::string flags;
+    std::mutex mutex;
+    std::map<std::string, ManifestEntry> previous;
+    std::map<std::string, ManifestEntry> current;
+    size_t skipped = 0;
+};
+
+#endif // TILE_MANIFEST_H
@@ -69,7 +69,7 @@ enu_init(double lon, double lat, double* origin_enu, char* gdal_data, char* proj
     OGRCoordinateTransformation *poCT = OGRCreateCoordinateTransformation(&outRs, &outRs);
 
     // IMPORTANT: For ENU, pass the ENU offsets to GeoTransform::Init
-    // These will be used in InfoVisitor::Correction to offset local vertices
+    // These will be used by correct_points() in osgb23dtile.cpp to offset local vertices
     // Store: [enu_offset_x, enu_offset_y, enu_offset_z]
     GeoTransform::Init(poCT, origin_enu);
 